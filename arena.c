@@ -0,0 +1,115 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint64_t align8(uint64_t n)
+{
+    return (n + 7) & ~(uint64_t)7;
+}
+
+// the classes above the exact ones are powers of two from 2 * ARENA_SMALL
+#define ARENA_POW2_SHIFT (__builtin_ctz(ARENA_SMALL) + 1)
+
+// class a block of sz bytes is kept in, every block in class c has at
+// least the size a request for class c asks for. Blocks between
+// ARENA_SMALL and 2 * ARENA_SMALL go to the largest exact class
+static inline uint32_t class_of_block(uint64_t sz)
+{
+    if (sz <= ARENA_SMALL) {
+        return sz / 8 - 1;
+    }
+    return ARENA_SMALL / 8 + (63 - __builtin_clzll(sz)) - ARENA_POW2_SHIFT;
+}
+
+// class that serves a request of sz bytes, the smallest whose blocks all
+// have room for it
+static inline uint32_t class_of_request(uint64_t sz)
+{
+    if (sz <= ARENA_SMALL) {
+        return sz / 8 - 1;
+    }
+    return ARENA_SMALL / 8 + (64 - __builtin_clzll(sz - 1)) - ARENA_POW2_SHIFT;
+}
+
+// appends n chunk indices backed by one allocation
+static int push_chunks(arena_t* a, uint64_t n)
+{
+    if (a->chunk_sz + n > a->chunk_cap) {
+        uint64_t cap = a->chunk_cap ? a->chunk_cap * 2 : 16;
+        for (; cap < a->chunk_sz + n; cap *= 2) {  }
+        arena_chunk_t* c = realloc(a->chunk, cap * sizeof(*c));
+        if (!c) {
+            return -1;
+        }
+        a->chunk     = c;
+        a->chunk_cap = cap;
+    }
+
+    char* p = malloc(n << ARENA_SHIFT);
+    if (!p) {
+        return -1;
+    }
+    uint64_t i = 0;
+    for (; i < n; ++i) {
+        a->chunk[a->chunk_sz + i] = (arena_chunk_t){ .p = p + (i << ARENA_SHIFT), .head = i == 0 };
+    }
+    a->chunk_sz += n;
+    return 0;
+}
+
+uint64_t arena_alloc(arena_t* a, uint64_t sz)
+{
+    sz = align8(sz ? sz : 1);
+
+    uint32_t c = class_of_request(sz);
+    if (c < ARENA_CLASSES && a->free[c]) {
+        uint64_t off = a->free[c] - 1;
+        memcpy(&a->free[c], arena_ptr(a, off), sizeof(off));
+        return off;
+    }
+
+    // blocks do not straddle chunks, the rest of the current one is kept
+    // for smaller requests
+    uint64_t end  = a->chunk_sz << ARENA_SHIFT;
+    uint64_t tail = end - a->sz;
+    if (sz > tail) {
+        if (tail >= 8) {
+            arena_free(a, a->sz, tail);
+        }
+        if (push_chunks(a, (sz + ARENA_CHUNK - 1) >> ARENA_SHIFT) < 0) {
+            return ARENA_NONE;
+        }
+        a->sz = end;
+    }
+
+    uint64_t off = a->sz;
+    a->sz       += sz;
+    return off;
+}
+
+void arena_free(arena_t* a, uint64_t off, uint64_t sz)
+{
+    if (!sz) {
+        return;
+    }
+    sz = align8(sz);
+    uint32_t c = class_of_block(sz);
+    if (c >= ARENA_CLASSES) {
+        return;
+    }
+    memcpy(arena_ptr(a, off), &a->free[c], sizeof(off));
+    a->free[c] = off + 1;
+}
+
+void arena_clear(arena_t* a)
+{
+    uint64_t i = 0;
+    for (; i < a->chunk_sz; ++i) {
+        if (a->chunk[i].head) {
+            free(a->chunk[i].p);
+        }
+    }
+    free(a->chunk);
+    memset(a, 0, sizeof(*a));
+}
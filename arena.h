@@ -0,0 +1,52 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// growable arena addressed by offsets. Memory comes in chunks of
+// 1 << ARENA_SHIFT bytes that never move, so pointers stay valid until
+// arena_clear(). A block bigger than a chunk gets a run of chunk indices of
+// its own
+//
+// a zeroed arena_t is empty. Freed blocks are kept in free lists by size
+// class and handed out again: exact sizes up to ARENA_SMALL, powers of two
+// from 2 * ARENA_SMALL. A block in between serves requests of ARENA_SMALL
+
+#define ARENA_SHIFT   20
+#define ARENA_CHUNK   ((uint64_t)1 << ARENA_SHIFT)
+#define ARENA_SMALL   256
+#define ARENA_CLASSES (ARENA_SMALL / 8 + 64)
+#define ARENA_NONE    UINT64_MAX
+
+typedef struct arena_chunk_t arena_chunk_t;
+struct arena_chunk_t {
+    char* p;
+    bool  head;  // p was allocated here, not a later part of a big block
+};
+
+typedef struct arena_t arena_t;
+struct arena_t {
+    arena_chunk_t* chunk;
+    uint64_t       chunk_sz;
+    uint64_t       chunk_cap;
+    uint64_t       sz;                    // next free offset
+    uint64_t       free[ARENA_CLASSES];  // first block per class + 1, 0 if empty
+};
+
+static inline char* arena_ptr(arena_t* a, uint64_t off)
+{
+    return a->chunk[off >> ARENA_SHIFT].p + (off & (ARENA_CHUNK - 1));
+}
+
+// returns ARENA_NONE if out of memory. sz is rounded up to a multiple of 8
+uint64_t arena_alloc(arena_t* a, uint64_t sz);
+
+// sz may be smaller than the size the block was allocated with, nothing is
+// freed for 0
+void arena_free(arena_t* a, uint64_t off, uint64_t sz);
+
+// releases all chunks, a is empty afterwards
+void arena_clear(arena_t* a);
+
+#endif
@@ -0,0 +1,83 @@
+#!/bin/sh
+# times ficor on generated databases, one tab separated line per measurement:
+#
+#     records  op  runs  min_ms  median_ms
+#
+# usage: bench.sh <ficor binary> <gen binary> <record count>...
+# BENCH_RUNS sets the runs per op, BENCH_DIR the scratch directory
+
+set -e
+
+ficor=$(realpath "$1")
+gen=$(realpath "$2")
+shift 2
+
+runs=${BENCH_RUNS:-5}
+dir=${BENCH_DIR:-$(mktemp -d)}
+mkdir -p "$dir"
+cd "$dir"
+
+now() {
+    date +%s%N
+}
+
+# time <op> <records> <command...>: runs the command $runs times
+time_op() {
+    op=$1
+    n=$2
+    shift 2
+    i=0
+    ts=""
+    while [ "$i" -lt "$runs" ]; do
+        s=$(now)
+        "$@" > /dev/null
+        e=$(now)
+        ts="$ts $(( (e - s) / 1000 ))"
+        i=$((i + 1))
+    done
+    echo "$ts" | tr ' ' '\n' | sed '/^$/d' | sort -n | awk -v n="$n" -v op="$op" -v r="$runs" '
+        { t[NR] = $1 }
+        END { printf "%s\t%s\t%d\t%.3f\t%.3f\n", n, op, r, t[1] / 1000, t[int((NR + 1) / 2)] / 1000 }'
+}
+
+# a mutation and its undo, so every run starts from the same database
+mutate() {
+    "$ficor" --no-daemon --add-tag "$1" -t bench-mutation
+    "$ficor" --no-daemon --rm-tag "$1" -t bench-mutation
+}
+
+printf "records\top\truns\tmin_ms\tmedian_ms\n"
+for n in "$@"; do
+    rm -f .ficor .ficor.cache
+    "$ficor" --init
+    "$gen" -n "$n" > cmds
+    file=$(head -n 1 cmds | cut -f 2)
+
+    s=$(now)
+    "$ficor" --no-daemon --batch cmds
+    e=$(now)
+    awk -v n="$n" -v t="$(( (e - s) / 1000 ))" \
+        'BEGIN { printf "%s\tbatch-import\t1\t%.3f\t%.3f\n", n, t / 1000, t / 1000 }'
+
+    time_op compact      "$n" "$ficor" --no-daemon --compact
+    time_op load         "$n" "$ficor" --no-daemon -i no-such-tag
+    time_op get          "$n" "$ficor" --no-daemon --get "$file"
+    time_op list-all     "$n" "$ficor" --no-daemon
+    time_op include-rare "$n" "$ficor" --no-daemon -i tag500
+    time_op include-two  "$n" "$ficor" --no-daemon -i tag0:tag1
+    time_op exclude      "$n" "$ficor" --no-daemon -e tag0
+    time_op query        "$n" "$ficor" --no-daemon -q "(tag3 OR tag7) AND NOT tag0"
+    time_op under        "$n" "$ficor" --no-daemon --under "$(dirname "$file")"
+    time_op search       "$n" "$ficor" --no-daemon --search "record 1234"
+    time_op tag-stats    "$n" "$ficor" --no-daemon --tag-stats
+    time_op fsck         "$n" "$ficor" --no-daemon --fsck
+    time_op page         "$n" "$ficor" --no-daemon --offset 1000 --limit 50
+    time_op sort-path    "$n" "$ficor" --no-daemon --sort path --limit 50
+    time_op sort-tags    "$n" "$ficor" --no-daemon --sort -tags --limit 50
+    time_op cached       "$n" "$ficor" --no-daemon --cache --sort -tags --limit 50
+    time_op mutation     "$n" mutate "$file"
+    rm -f cmds
+done
+
+cd - > /dev/null
+[ -n "$BENCH_DIR" ] || rm -rf "$dir"
@@ -0,0 +1,211 @@
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// cache file, numbers in native byte order:
+//
+//                   8: signature
+//                   8: generation
+//                   4: entry count
+//                   4: unused
+//     CACHE_MAX * 24: entries: key hash, offset, key size, output size
+//
+// followed by the key and the output of every entry, newest first
+
+static const uint64_t CACHE_SIGNATURE = 0xF1C0CAC8EF1C0CA1UL;
+
+typedef struct entry_t entry_t;
+struct entry_t {
+    uint64_t hash;
+    uint64_t off;
+    uint32_t key_sz;
+    uint32_t sz;
+};
+
+typedef struct head_t head_t;
+struct head_t {
+    uint64_t signature;
+    uint64_t gen;
+    uint32_t n;
+    uint32_t unused;
+    entry_t  e[CACHE_MAX];
+};
+
+// FNV-1a
+static uint64_t hash(const char* s, size_t sz)
+{
+    uint64_t h = 0xcbf29ce484222325UL;
+    size_t   i = 0;
+    for (; i < sz; ++i) {
+        h = (h ^ (uint8_t)s[i]) * 0x100000001b3UL;
+    }
+    return h;
+}
+
+// reads the head of the cache in fd, 0 if it is none for gen or damaged
+static bool read_head(int fd, uint64_t gen, head_t* h)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0 || pread(fd, h, sizeof(*h), 0) != sizeof(*h)) {
+        return 0;
+    }
+    if (h->signature != CACHE_SIGNATURE || h->gen != gen || h->n > CACHE_MAX) {
+        return 0;
+    }
+
+    uint32_t i = 0;
+    for (; i < h->n; ++i) {
+        entry_t* e = &h->e[i];
+        if (e->off > (uint64_t)st.st_size || (uint64_t)e->key_sz + e->sz > (uint64_t)st.st_size - e->off) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// reads the key and output of e into a new buffer
+static char* read_entry(int fd, entry_t* e)
+{
+    size_t sz  = (size_t)e->key_sz + e->sz;
+    char*  buf = malloc(sz + 1);
+    if (buf && pread(fd, buf, sz, e->off) != (ssize_t)sz) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+bool cache_get(const char* path, uint64_t gen, const char* key, size_t key_sz, char** data, size_t* sz)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    head_t   h;
+    bool     hit = 0;
+    uint64_t k   = hash(key, key_sz);
+    uint32_t i   = 0;
+    for (; read_head(fd, gen, &h) && i < h.n; ++i) {
+        entry_t* e = &h.e[i];
+        if (e->hash != k || e->key_sz != key_sz) {
+            continue;
+        }
+        char* buf = read_entry(fd, e);
+        if (buf && memcmp(buf, key, key_sz) == 0) {
+            memmove(buf, buf + key_sz, e->sz);
+            *data = buf;
+            *sz   = e->sz;
+            hit   = 1;
+            break;
+        }
+        free(buf);
+    }
+
+    close(fd);
+    return hit;
+}
+
+static int write_all(int fd, const char* s, size_t sz)
+{
+    while (sz) {
+        ssize_t n = write(fd, s, sz);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        s  += n;
+        sz -= n;
+    }
+    return 0;
+}
+
+int cache_put(const char* path, uint64_t gen, const char* key, size_t key_sz, const char* data, size_t sz,
+              mode_t mode)
+{
+    if (sz > CACHE_ENTRY_MAX || key_sz > CACHE_ENTRY_MAX) {
+        return -1;
+    }
+
+    head_t old = { 0 };
+    int    in  = open(path, O_RDONLY | O_CLOEXEC);
+    if (in >= 0 && !read_head(in, gen, &old)) {
+        old.n = 0;
+    }
+
+    char* tmp  = malloc(strlen(path) + sizeof(".XXXXXX"));
+    int   out  = -1;
+    bool  made = 0;  // tmp exists
+    if (!tmp) {
+        goto error;
+    }
+    sprintf(tmp, "%s.XXXXXX", path);
+    out  = mkstemp(tmp);
+    made = out >= 0;
+    if (!made || fchmod(out, mode) < 0) {
+        goto error;
+    }
+
+    // the new entry, then the old ones as long as they fit
+    head_t   h     = { .signature = CACHE_SIGNATURE, .gen = gen };
+    uint64_t k     = hash(key, key_sz);
+    uint64_t total = key_sz + sz;
+    uint32_t from[CACHE_MAX];
+    uint32_t i     = 0;
+    h.e[h.n++] = (entry_t){ .hash = k, .off = sizeof(h), .key_sz = key_sz, .sz = sz };
+    for (; i < old.n && h.n < CACHE_MAX; ++i) {
+        entry_t e = old.e[i];
+        if ((e.hash == k && e.key_sz == key_sz) || total + e.key_sz + e.sz > CACHE_SZ) {
+            continue;
+        }
+        e.off        = sizeof(h) + total;
+        total       += (uint64_t)e.key_sz + e.sz;
+        from[h.n]    = i;
+        h.e[h.n++]   = e;
+    }
+
+    if (write_all(out, (char*)&h, sizeof(h)) < 0 || write_all(out, key, key_sz) < 0
+        || write_all(out, data, sz) < 0) {
+        goto error;
+    }
+    for (i = 1; i < h.n; ++i) {
+        char* buf = read_entry(in, &old.e[from[i]]);
+        int   e   = !buf || write_all(out, buf, (size_t)h.e[i].key_sz + h.e[i].sz) < 0;
+        free(buf);
+        if (e) {
+            goto error;
+        }
+    }
+
+    int e = close(out);
+    out   = -1;
+    if (e < 0 || rename(tmp, path) < 0) {
+        goto error;
+    }
+    if (in >= 0) {
+        close(in);
+    }
+    free(tmp);
+    return 0;
+
+error:
+    if (out >= 0) {
+        close(out);
+    }
+    if (made) {
+        unlink(tmp);
+    }
+    if (in >= 0) {
+        close(in);
+    }
+    free(tmp);
+    return -1;
+}
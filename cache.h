@@ -0,0 +1,27 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// persistent cache of command outputs in a file of its own. It keeps the
+// outputs of the last CACHE_MAX keys, all for the same generation of the
+// data they were computed from; a put for another generation starts over.
+// The file is replaced as a whole by rename(), so readers need no lock, and
+// a cache that cannot be read or written just misses
+
+#define CACHE_MAX       16
+#define CACHE_SZ        (4 << 20)  // bytes of keys and outputs at most
+#define CACHE_ENTRY_MAX (1 << 20)  // bigger outputs are not kept
+
+// the output kept for key at generation gen, in *data (malloc'ed) and *sz
+bool cache_get(const char* path, uint64_t gen, const char* key, size_t key_sz, char** data, size_t* sz);
+
+// keeps data as the output of key at generation gen, in front of the others.
+// A new file gets mode. Returns 0 on success and -1 if nothing was kept
+int cache_put(const char* path, uint64_t gen, const char* key, size_t key_sz, const char* data, size_t sz,
+              mode_t mode);
+
+#endif
@@ -0,0 +1,178 @@
+#include "crc.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC_X86
+#endif
+
+// reversed Castagnoli polynomial
+#define CRC_POLY 0x82f63b78
+
+// the sse4.2 version runs three streams of CRC_LONG, then of CRC_SHORT bytes
+// side by side and joins them with the zeros tables. Both are powers of two
+#define CRC_LONG  8192
+#define CRC_SHORT 256
+
+static uint32_t table[8][256];
+static uint32_t zeros_long[4][256];
+static uint32_t zeros_short[4][256];
+
+static uint32_t gf2_times(const uint32_t* mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, ++mat) {
+        sum ^= vec & 1 ? *mat : 0;
+    }
+    return sum;
+}
+
+static void gf2_square(uint32_t* square, const uint32_t* mat)
+{
+    uint32_t n = 0;
+    for (; n < 32; ++n) {
+        square[n] = gf2_times(mat, mat[n]);
+    }
+}
+
+// tables that take a crc past sz zero bytes: the operator for one zero bit
+// is squared up to sz bytes and applied to every value of each crc byte
+static void zeros_init(uint32_t zeros[4][256], size_t sz)
+{
+    uint32_t op[32];
+    uint32_t sq[32];
+    uint32_t n = 1;
+    op[0] = CRC_POLY;
+    for (; n < 32; ++n) {
+        op[n] = (uint32_t)1 << (n - 1);
+    }
+
+    // 1, 2, 4 ... 8 * sz bits
+    for (n = 1; n < 8 * sz; n *= 2) {
+        gf2_square(sq, op);
+        memcpy(op, sq, sizeof(op));
+    }
+
+    for (n = 0; n < 256; ++n) {
+        zeros[0][n] = gf2_times(op, n);
+        zeros[1][n] = gf2_times(op, n << 8);
+        zeros[2][n] = gf2_times(op, n << 16);
+        zeros[3][n] = gf2_times(op, n << 24);
+    }
+}
+
+static inline uint32_t zeros_shift(uint32_t zeros[4][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff]
+         ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+static void table_init(void)
+{
+    uint32_t n = 0;
+    for (; n < 256; ++n) {
+        uint32_t c = n;
+        uint32_t k = 0;
+        for (; k < 8; ++k) {
+            c = c & 1 ? (c >> 1) ^ CRC_POLY : c >> 1;
+        }
+        table[0][n] = c;
+    }
+    for (n = 0; n < 256; ++n) {
+        uint32_t k = 1;
+        for (; k < 8; ++k) {
+            table[k][n] = (table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xff];
+        }
+    }
+}
+
+uint32_t crc_table(uint32_t crc, const void* buf, size_t sz)
+{
+    const uint8_t* p = buf;
+    crc = ~crc;
+    for (; sz >= 8; sz -= 8, p += 8) {
+        crc ^= (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+        crc  = table[7][crc & 0xff] ^ table[6][(crc >> 8) & 0xff]
+             ^ table[5][(crc >> 16) & 0xff] ^ table[4][crc >> 24]
+             ^ table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+    }
+    for (; sz; --sz, ++p) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *p) & 0xff];
+    }
+    return ~crc;
+}
+
+#ifdef CRC_X86
+
+static inline uint64_t load64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// the crc32 instruction takes three cycles but starts one every cycle, so
+// three independent streams keep it busy
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const void* buf, size_t sz)
+{
+    const uint8_t* p  = buf;
+    uint64_t       c0 = ~crc;
+
+    for (; sz && (uintptr_t)p % 8; --sz, ++p) {
+        c0 = _mm_crc32_u8(c0, *p);
+    }
+
+    for (; sz >= 3 * CRC_LONG; sz -= 3 * CRC_LONG, p += 3 * CRC_LONG) {
+        uint64_t             c1 = 0;
+        uint64_t             c2 = 0;
+        const uint8_t* const e  = p + CRC_LONG;
+        const uint8_t*       q  = p;
+        for (; q != e; q += 8) {
+            c0 = _mm_crc32_u64(c0, load64(q));
+            c1 = _mm_crc32_u64(c1, load64(q + CRC_LONG));
+            c2 = _mm_crc32_u64(c2, load64(q + 2 * CRC_LONG));
+        }
+        c0 = zeros_shift(zeros_long, c0) ^ c1;
+        c0 = zeros_shift(zeros_long, c0) ^ c2;
+    }
+
+    for (; sz >= 3 * CRC_SHORT; sz -= 3 * CRC_SHORT, p += 3 * CRC_SHORT) {
+        uint64_t             c1 = 0;
+        uint64_t             c2 = 0;
+        const uint8_t* const e  = p + CRC_SHORT;
+        const uint8_t*       q  = p;
+        for (; q != e; q += 8) {
+            c0 = _mm_crc32_u64(c0, load64(q));
+            c1 = _mm_crc32_u64(c1, load64(q + CRC_SHORT));
+            c2 = _mm_crc32_u64(c2, load64(q + 2 * CRC_SHORT));
+        }
+        c0 = zeros_shift(zeros_short, c0) ^ c1;
+        c0 = zeros_shift(zeros_short, c0) ^ c2;
+    }
+
+    for (; sz >= 8; sz -= 8, p += 8) {
+        c0 = _mm_crc32_u64(c0, load64(p));
+    }
+    for (; sz; --sz, ++p) {
+        c0 = _mm_crc32_u8(c0, *p);
+    }
+    return ~(uint32_t)c0;
+}
+
+#endif
+
+crc_fn_t* crc_select(void)
+{
+    table_init();
+#ifdef CRC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        zeros_init(zeros_long, CRC_LONG);
+        zeros_init(zeros_short, CRC_SHORT);
+        return crc_sse42;
+    }
+#endif
+    return crc_table;
+}
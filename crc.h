@@ -0,0 +1,19 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli), as in iSCSI and ext4. crc is the checksum of the
+// bytes before buf, 0 for none, so a checksum can be built piece by piece
+
+typedef uint32_t crc_fn_t(uint32_t crc, const void* buf, size_t sz);
+
+// eight bytes per step through tables
+uint32_t crc_table(uint32_t crc, const void* buf, size_t sz);
+
+// builds the tables and returns the fastest implementation the running cpu
+// supports. Call it before any of them
+crc_fn_t* crc_select(void);
+
+#endif
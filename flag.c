@@ -54,6 +54,10 @@ static inline flag_error_t parse_flag_long_identifier(
         *eq_sign = '=';
     }
 
+    if (!f) {
+        return FLAG_ERROR_FLAG_UNKNOWN;
+    }
+
     switch (f->type) {
     case FLAG_BOOL: {
         if (eq_sign) {
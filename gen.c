@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flag.h" // @source: flag.c
+
+// writes --batch commands for a synthetic database to stdout:
+//
+//     gen.out -n 100000 -t 1000 -k 6 -d zipf | ficor.out --batch -
+//
+// paths are unique, tags are named tag<rank> with rank 0 the most common
+// under the zipf distribution
+
+static bool  flag_help     = 0;
+static char* flag_records  = "1000";
+static char* flag_path_len = "48";
+static char* flag_tags     = "1000";
+static char* flag_per_rec  = "6";
+static char* flag_dist     = "zipf";
+static char* flag_info     = "4";
+static char* flag_seed     = "1";
+
+static flag_t flags[] = {
+    {
+        .short_identifier = 'h',
+        .long_identifier  = "help",
+        .description      = "show this page and exit",
+        .target           = &flag_help,
+        .type             = FLAG_BOOL,
+    },
+    {
+        .short_identifier = 'n',
+        .long_identifier  = "records",
+        .description      = "number of records",
+        .target           = &flag_records,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 'p',
+        .long_identifier  = "path-len",
+        .description      = "length of every path",
+        .target           = &flag_path_len,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 't',
+        .long_identifier  = "tags",
+        .description      = "number of distinct tags",
+        .target           = &flag_tags,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 'k',
+        .long_identifier  = "per-record",
+        .description      = "average number of tags per record, uniform in [1, 2k - 1]",
+        .target           = &flag_per_rec,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 'd',
+        .long_identifier  = "dist",
+        .description      = "tag distribution: 'uniform' or 'zipf'",
+        .target           = &flag_dist,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 'i',
+        .long_identifier  = "info-every",
+        .description      = "give every n-th record an info, 0 for none",
+        .target           = &flag_info,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 's',
+        .long_identifier  = "seed",
+        .description      = "random seed",
+        .target           = &flag_seed,
+        .type             = FLAG_STR,
+    },
+};
+
+static const uint32_t flags_len = sizeof(flags) / sizeof(*flags);
+
+static uint64_t rng = 0;
+
+// xorshift64*
+static uint64_t next(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 0x2545F4914F6CDD1DUL;
+}
+
+static uint64_t below(uint64_t n)
+{
+    return next() % n;
+}
+
+static int number(char* s, uint64_t* v, const char* name)
+{
+    char* e = NULL;
+    *v = strtoull(s, &e, 10);
+    if (!*s || *e) {
+        fprintf(stderr, "Error: %s expects a number, not '%s'\n", name, s);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    double*   cdf  = NULL;
+    uint32_t* pick = NULL;
+
+    int e = flag_parse(argc, argv, flags, flags_len, &argc, &argv);
+    if (e) {
+        fprintf(stderr, "Error: while parsing flags: %s: %s\n", flag_error_format(e), *flag_error_position());
+        return 1;
+    }
+    if (flag_help) {
+        flag_print_usage(stdout, "Generate a synthetic ficor database as --batch commands", flags, flags_len);
+        return 0;
+    }
+
+    uint64_t records, path_len, tags, per_rec, info, seed;
+    if (number(flag_records, &records, "--records") || number(flag_path_len, &path_len, "--path-len")
+        || number(flag_tags, &tags, "--tags") || number(flag_per_rec, &per_rec, "--per-record")
+        || number(flag_info, &info, "--info-every") || number(flag_seed, &seed, "--seed")) {
+        return 1;
+    }
+    bool zipf = strcmp(flag_dist, "zipf") == 0;
+    if (!zipf && strcmp(flag_dist, "uniform") != 0) {
+        fprintf(stderr, "Error: unknown distribution '%s'\n", flag_dist);
+        return 1;
+    }
+    if (!tags || !per_rec) {
+        fprintf(stderr, "Error: --tags and --per-record have to be positive\n");
+        return 1;
+    }
+    rng = seed * 0x9E3779B97F4A7C15UL + 1;
+
+    // zipf with exponent 1: tag r is drawn with weight 1 / (r + 1)
+    cdf  = malloc(tags * sizeof(*cdf));
+    pick = malloc((2 * per_rec) * sizeof(*pick));
+    if (!cdf || !pick) {
+        fprintf(stderr, "Error: out of memory\n");
+        goto error;
+    }
+    double   sum = 0;
+    uint64_t r   = 0;
+    for (; r < tags; ++r) {
+        sum   += zipf ? 1.0 / (r + 1) : 1.0;
+        cdf[r] = sum;
+    }
+
+    // path: /bench/<record index in hex>/ followed by filler to path_len
+    char     path[4096];
+    uint64_t i = 0;
+    for (; i < records; ++i) {
+        int l = snprintf(path, sizeof(path), "/bench/%08lx/", (unsigned long)i);
+        for (; (uint64_t)l < path_len && l < (int)sizeof(path) - 1; ++l) {
+            path[l] = 'a' + below(26);
+        }
+        path[l] = 0;
+        fputs("add-file\t", stdout);
+        fputs(path, stdout);
+        putc('\t', stdout);
+
+        uint64_t k = 1 + below(2 * per_rec - 1);
+        k = k < tags ? k : tags;
+        uint64_t n = 0;
+        while (n < k) {
+            double   x  = (double)(next() >> 11) / (double)(1UL << 53) * sum;
+            uint32_t lo = 0;
+            uint32_t hi = tags - 1;
+            while (lo < hi) {
+                uint32_t m = (lo + hi) / 2;
+                if (cdf[m] <= x) {
+                    lo = m + 1;
+                } else {
+                    hi = m;
+                }
+            }
+            uint64_t j = 0;
+            for (; j < n && pick[j] != lo; ++j) {  }
+            if (j == n) {
+                printf(n ? ":tag%u" : "tag%u", lo);
+                pick[n++] = lo;
+            }
+        }
+
+        if (info && i % info == 0) {
+            printf("\tinfo of record %lu", (unsigned long)i);
+        }
+        putc('\n', stdout);
+    }
+
+    free(cdf);
+    free(pick);
+    return 0;
+
+error:
+    free(cdf);
+    free(pick);
+    return 1;
+}
@@ -0,0 +1,329 @@
+// struct ucred
+#define _GNU_SOURCE
+
+#include "ipc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define IPC_MAX_FDS  8
+#define IPC_MAX_ARGC 4096
+#define IPC_MAX_ARG  (1 << 20)
+
+#define IPC_TIMEOUT_S 5
+
+static int ipc_addr(struct sockaddr_un* addr, const char* path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int ipc_listen(const char* path)
+{
+    struct sockaddr_un addr;
+    if (ipc_addr(&addr, path) < 0) {
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    // only the owner may connect, before anyone can
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || chmod(path, 0600) < 0
+        || listen(sock, 64) < 0) {
+        int e = errno;
+        close(sock);
+        errno = e;
+        return -1;
+    }
+    return sock;
+}
+
+int ipc_connect(const char* path)
+{
+    struct sockaddr_un addr;
+    if (ipc_addr(&addr, path) < 0) {
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        int e = errno;
+        close(sock);
+        errno = e;
+        return -1;
+    }
+    return sock;
+}
+
+int ipc_accept(int sock)
+{
+    int c;
+    while ((c = accept(sock, NULL, NULL)) < 0 && errno == EINTR) {  }
+    if (c < 0) {
+        return -1;
+    }
+
+    // a peer stalling in the middle of its request or not taking its answer
+    // is dropped
+    struct timeval t = { .tv_sec = IPC_TIMEOUT_S };
+    if (fcntl(c, F_SETFD, FD_CLOEXEC) < 0
+        || setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(t)) < 0
+        || setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &t, sizeof(t)) < 0) {
+        int e = errno;
+        close(c);
+        errno = e;
+        return -1;
+    }
+    return c;
+}
+
+int ipc_peer_uid(int sock, uid_t* uid)
+{
+    struct ucred cred;
+    socklen_t    sz = sizeof(cred);
+    if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &sz) < 0) {
+        return -1;
+    }
+    *uid = cred.uid;
+    return 0;
+}
+
+static int ipc_write(int sock, const void* buf, size_t sz)
+{
+    const char* p = buf;
+    while (sz) {
+        ssize_t n = send(sock, p, sz, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p  += n;
+        sz -= n;
+    }
+    return 0;
+}
+
+static int ipc_read(int sock, void* buf, size_t sz)
+{
+    char* p = buf;
+    while (sz) {
+        ssize_t n = read(sock, p, sz);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0) {
+            errno = ECONNRESET;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p  += n;
+        sz -= n;
+    }
+    return 0;
+}
+
+int ipc_send_request(int sock, int argc, char** argv, int* fds, int fd_sz)
+{
+    if (fd_sz > IPC_MAX_FDS || argc > IPC_MAX_ARGC) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // the fds ride along with argc
+    uint32_t n = argc;
+    union {
+        char           buf[CMSG_SPACE(IPC_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+
+    struct iovec  iov = { .iov_base = &n, .iov_len = sizeof(n) };
+    struct msghdr msg = {
+        .msg_iov        = &iov,
+        .msg_iovlen     = 1,
+        .msg_control    = fd_sz ? ctl.buf : NULL,
+        .msg_controllen = fd_sz ? CMSG_SPACE(fd_sz * sizeof(int)) : 0,
+    };
+    if (fd_sz) {
+        struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type  = SCM_RIGHTS;
+        c->cmsg_len   = CMSG_LEN(fd_sz * sizeof(int));
+        memcpy(CMSG_DATA(c), fds, fd_sz * sizeof(int));
+    }
+
+    ssize_t sent;
+    while ((sent = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR) {  }
+    if (sent < 0) {
+        return -1;
+    }
+    if (ipc_write(sock, (char*)&n + sent, sizeof(n) - sent) < 0) {
+        return -1;
+    }
+
+    int i = 0;
+    for (; i < argc; ++i) {
+        uint32_t l = strlen(argv[i]);
+        if (ipc_write(sock, &l, sizeof(l)) < 0 || ipc_write(sock, argv[i], l) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ipc_recv_request(int sock, int* argc, char*** argv, int* fds, int fd_sz)
+{
+    int i = 0;
+    for (; i < fd_sz; ++i) {
+        fds[i] = -1;
+    }
+    *argv = NULL;
+
+    uint32_t n = 0;
+    union {
+        char           buf[CMSG_SPACE(IPC_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+
+    struct iovec  iov = { .iov_base = &n, .iov_len = sizeof(n) };
+    struct msghdr msg = {
+        .msg_iov        = &iov,
+        .msg_iovlen     = 1,
+        .msg_control    = ctl.buf,
+        .msg_controllen = sizeof(ctl.buf),
+    };
+
+    ssize_t got;
+    while ((got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {  }
+    if (got <= 0) {
+        if (got == 0) {
+            errno = ECONNRESET;
+        }
+        return -1;
+    }
+
+    struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    for (; c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int  sz  = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int* in = (int*)CMSG_DATA(c);
+        for (i = 0; i < sz; ++i) {
+            int fd;
+            memcpy(&fd, in + i, sizeof(fd));
+            if (i < fd_sz) {
+                fds[i] = fd;
+            } else {
+                close(fd);
+            }
+        }
+    }
+
+    if (ipc_read(sock, (char*)&n + got, sizeof(n) - got) < 0) {
+        goto error;
+    }
+    // there is always a program name
+    if (n == 0) {
+        errno = EINVAL;
+        goto error;
+    }
+    if (n > IPC_MAX_ARGC) {
+        errno = E2BIG;
+        goto error;
+    }
+
+    // pointers first, strings behind them
+    size_t sz  = (n + 1) * sizeof(char*);
+    size_t cap = sz + 256;
+    char*  buf = malloc(cap);
+    if (!buf) {
+        goto error;
+    }
+
+    uint32_t j = 0;
+    for (; j < n; ++j) {
+        uint32_t l = 0;
+        if (ipc_read(sock, &l, sizeof(l)) < 0) {
+            free(buf);
+            goto error;
+        }
+        if (l > IPC_MAX_ARG) {
+            free(buf);
+            errno = E2BIG;
+            goto error;
+        }
+        if (sz + l + 1 > cap) {
+            for (; sz + l + 1 > cap; cap *= 2) {  }
+            char* b = realloc(buf, cap);
+            if (!b) {
+                free(buf);
+                goto error;
+            }
+            buf = b;
+        }
+        if (ipc_read(sock, buf + sz, l) < 0) {
+            free(buf);
+            goto error;
+        }
+        if (memchr(buf + sz, 0, l)) {
+            free(buf);
+            errno = EINVAL;
+            goto error;
+        }
+        ((size_t*)buf)[j] = sz;
+        buf[sz + l]       = 0;
+        sz               += l + 1;
+    }
+
+    // offsets become pointers once buf does not move anymore
+    char** a = (char**)buf;
+    for (j = 0; j < n; ++j) {
+        a[j] = buf + ((size_t*)buf)[j];
+    }
+    a[n] = NULL;
+
+    *argc = n;
+    *argv = a;
+    return 0;
+
+error:
+    for (i = 0; i < fd_sz; ++i) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+    return -1;
+}
+
+int ipc_send_status(int sock, int32_t status)
+{
+    return ipc_write(sock, &status, sizeof(status));
+}
+
+int ipc_recv_status(int sock, int32_t* status)
+{
+    return ipc_read(sock, status, sizeof(*status));
+}
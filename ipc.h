@@ -0,0 +1,40 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// requests travel over a unix stream socket as
+//
+//              4: argc
+//       for argc:
+//                  4: len
+//                len: arg
+//
+// with fd_sz file descriptors attached to the first byte. The answer is a
+// single 4 byte status. All functions return 0 on success and -1 with errno
+// set otherwise
+
+// the socket at path can be connected to by its owner only
+int ipc_listen(const char* path);
+int ipc_connect(const char* path);
+
+// returns the next connection, reads from and writes to it time out after a
+// few seconds
+int ipc_accept(int sock);
+
+// the user the peer of sock ran as when it connected
+int ipc_peer_uid(int sock, uid_t* uid);
+
+int ipc_send_request(int sock, int argc, char** argv, int* fds, int fd_sz);
+
+// argv is a single allocation, NULL terminated, free it with free(). fds
+// not sent by the peer are set to -1. A request without arguments or with a
+// NUL inside one fails with EINVAL
+int ipc_recv_request(int sock, int* argc, char*** argv, int* fds, int fd_sz);
+
+int ipc_send_status(int sock, int32_t status);
+int ipc_recv_status(int sock, int32_t* status);
+
+#endif
@@ -3,27 +3,72 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <sys/random.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <fnmatch.h>
 
-#include "flag.h" // @source: flag.c
+#include "flag.h"  // @source: flag.c
+#include "ipc.h"   // @source: ipc.c
+#include "arena.h" // @source: arena.c
+#include "out.h"   // @source: out.c
+#include "match.h" // @source: match.c
+#include "query.h" // @source: query.c
+#include "walk.h"  // @source: walk.c
+#include "text.h"  // @source: text.c
+#include "stats.h" // @source: stats.c
+#include "cache.h" // @source: cache.c
+#include "crc.h"   // @source: crc.c
 
-static const uint64_t SIGNATURE = 0xF1C0F1C0F1C0F1C0UL;
+static const uint64_t SIGNATURE = 0xF1C0F1C0F1C0F1C1UL;
 
 // flag stuff
 
-static bool  flag_help     = 0;
-static bool  flag_init     = 0;
-static bool  flag_dump     = 0;
-static char* flag_add_file = NULL;
-static char* flag_set_info = NULL;
-static char* flag_set_tag  = NULL;
-static char* flag_include  = NULL;
-static char* flag_exclude  = NULL;
-static bool  flag_info     = 0;
-static char* ficor_file    = ".ficor";
-static char* flag_rm_file  = NULL;
-static bool  flag_tags     = 0;
-static char* flag_rm_tag   = NULL;
-static char* flag_add_tag  = NULL;
+static bool  flag_help      = 0;
+static bool  flag_init      = 0;
+static bool  flag_dump      = 0;
+static char* flag_add_file  = NULL;
+static char* flag_set_info  = NULL;
+static char* flag_set_tag   = NULL;
+static char* flag_include   = NULL;
+static char* flag_exclude   = NULL;
+static bool  flag_info      = 0;
+static char* ficor_file     = ".ficor";
+static char* flag_rm_file   = NULL;
+static bool  flag_tags      = 0;
+static char* flag_rm_tag    = NULL;
+static char* flag_add_tag   = NULL;
+static bool  flag_compact   = 0;
+static char* flag_get       = NULL;
+static char* flag_batch     = NULL;
+static bool  flag_null      = 0;
+static bool  flag_serve     = 0;
+static bool  flag_no_daemon = 0;
+static char* flag_jobs      = NULL;
+static char* flag_query     = NULL;
+static char* flag_format    = NULL;
+static char* flag_add_tree  = NULL;
+static char* flag_tag_rules = NULL;
+static char* flag_under     = NULL;
+static char* flag_glob      = NULL;
+static char* flag_search    = NULL;
+static char* flag_edit_file = NULL;
+static bool  flag_tag_stats = 0;
+static bool  flag_stats     = 0;
+static char* flag_limit     = NULL;
+static char* flag_offset    = NULL;
+static char* flag_sort      = NULL;
+static char* flag_across    = NULL;
+static bool  flag_cache     = 0;
+static bool  flag_fsck      = 0;
 
 static flag_t flags[] = {
     {
@@ -106,7 +151,7 @@ static flag_t flags[] = {
     {
         .short_identifier = 0,
         .long_identifier  = "tags",
-        .description      = "print tags to output",
+        .description      = "print tags to output, in the order the database first saw them",
         .target           = &flag_tags,
         .type             = FLAG_BOOL,
     },
@@ -124,11 +169,241 @@ static flag_t flags[] = {
         .target           = &flag_add_tag,
         .type             = FLAG_STR,
     },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "compact",
+        .description      = "merge the journal into a new snapshot",
+        .target           = &flag_compact,
+        .type             = FLAG_BOOL,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "get",
+        .description      = "print the decorator of the given file",
+        .target           = &flag_get,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "batch",
+        .description      = "apply the commands in the given file, '-' for stdin, and commit once",
+        .target           = &flag_batch,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = '0',
+        .long_identifier  = "null",
+        .description      = "NUL terminate listed files and --batch commands instead of one per line",
+        .target           = &flag_null,
+        .type             = FLAG_BOOL,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "serve",
+        .description      = "keep the database loaded and answer other invocations over <config>.sock",
+        .target           = &flag_serve,
+        .type             = FLAG_BOOL,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "no-daemon",
+        .description      = "load the database even if a daemon is serving it",
+        .target           = &flag_no_daemon,
+        .type             = FLAG_BOOL,
+    },
+    {
+        .short_identifier = 'j',
+        .long_identifier  = "jobs",
+        .description      = "filter with the given number of threads, by default one per core on large databases",
+        .target           = &flag_jobs,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 'q',
+        .long_identifier  = "query",
+        .description      = "only include files matching the expression, e.g. '(raw OR jpeg) AND NOT archived'",
+        .target           = &flag_query,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "format",
+        .description      = "rewrite the database as 'mapped' (used in place) or 'packed' (compressed, decoded on load)",
+        .target           = &flag_format,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "add-tree",
+        .description      = "add the files below a directory that are not in ficor yet: '--add-tree <dir> [-t <tags>] [--tag-rules <file>] [--set-info <info>]'",
+        .target           = &flag_add_tree,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "tag-rules",
+        .description      = "tag files added by --add-tree by glob, lines of '<glob>' and '<tags>' separated by a tab",
+        .target           = &flag_tag_rules,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "under",
+        .description      = "only list files below the given directory",
+        .target           = &flag_under,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "glob",
+        .description      = "only list files whose path matches the given glob, '*' does not match '/'",
+        .target           = &flag_glob,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "search",
+        .description      = "only list files whose info contains every word of the given text, ignoring case",
+        .target           = &flag_search,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "edit-file",
+        .description      = "replace the info of a file: '--edit-file <filename> [--set-info <info>]', without --set-info it is removed",
+        .target           = &flag_edit_file,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "tag-stats",
+        .description      = "print per tag the number and share of files carrying it and the tags most often found with it",
+        .target           = &flag_tag_stats,
+        .type             = FLAG_BOOL,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "stats",
+        .description      = "print time, faults, memory and i/o per phase to stderr, FICOR_STATS=<file> appends them as JSON",
+        .target           = &flag_stats,
+        .type             = FLAG_BOOL,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "limit",
+        .description      = "list at most this many matches",
+        .target           = &flag_limit,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "offset",
+        .description      = "skip this many matches before listing",
+        .target           = &flag_offset,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "sort",
+        .description      = "list matches by 'path', 'tags' (count) or 'time' (added), a leading '-' reverses: '--sort -time'",
+        .target           = &flag_sort,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "across",
+        .description      = "list every database named like --config below a directory, relative paths below the database's directory. --offset and --limit count over all, --sort orders within each",
+        .target           = &flag_across,
+        .type             = FLAG_STR,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "cache",
+        .description      = "answer a listing from <config>.cache if it is there, else keep it there",
+        .target           = &flag_cache,
+        .type             = FLAG_BOOL,
+    },
+    {
+        .short_identifier = 0,
+        .long_identifier  = "fsck",
+        .description      = "check the database against its checksums and report every damaged block",
+        .target           = &flag_fsck,
+        .type             = FLAG_BOOL,
+    },
 };
 
 static const uint32_t flags_len = sizeof(flags) / sizeof(*flags);
 
 // ficor file spec
+//
+// the file is mapped and used in place, so every section starts 8 byte
+// aligned and records reference their strings by offset into the heap
+//
+//                   8: signature
+//                   4: version
+//                   4: ficor_sz
+//                   8: journal offset
+//                   8: generation
+//                   4: check, CRC-32C of the header with check 0 followed
+//                      by SECTION_CHECKS
+//                   4: check_block, bytes per checksummed block
+//    SECTION_MAX * 16: section table: offset, size
+//
+//     SECTION_RECORDS: ficor_sz * ficor_t
+//        SECTION_TAGS: tag dictionary, tag_t per tag id
+//  SECTION_PATH_TABLE: open addressing hash table, path -> record index
+//   SECTION_TAG_TABLE: open addressing hash table, tag name -> tag id
+//  SECTION_PATH_ORDER: ficor_sz * 4, record indices sorted by path
+//       SECTION_GRAMS: gram_t per trigram of the infos, sorted by trigram
+//   SECTION_GRAM_POST: per trigram the sorted indices of the records whose
+//                      info has it, gram_t.post is the position of the first
+//        SECTION_HEAP: strings and tag arrays referenced by the records
+//      SECTION_CHECKS: CRC-32C per check_block bytes of the file from the
+//                      end of the 8 byte aligned header up to here, the
+//                      last block may be shorter
+//
+// both tables are slot_t arrays with a power of two size, probed linearly
+// from hash & (size - 1)
+//
+// the snapshot is followed by the journal, mutations are appended to it and
+// replayed on load until the next compaction writes a new snapshot
+//
+// the generation counts mutations, so two loads that end up with the same
+// one see the same records. A new database starts at a random one, every
+// journal entry adds one and a snapshot keeps the count of all before it
+//
+//   for entry:
+//                   4: entry_sz
+//                   4: CRC-32C of the rest of the entry
+//                   4: op
+//      entry_sz - 8: per argument op takes a byte, 1 if it is given, and
+//                    then the NUL terminated argument if it is. An empty
+//                    argument is given, a missing one is not
+//
+// the heap starts with the NUL terminated tag names, followed by the posting
+// lists: per tag the sorted indices of the records carrying it. Then per record
+//       4 * ficor.tag_sz: sorted tag ids
+//          ficor.file_sz: ficor.file
+//          ficor.info_sz: ficor.info
+//
+// VERSION_PACKED files trade the in place use for size: records are decoded
+// into memory on load. Only SECTION_TAGS, SECTION_RECORDS and SECTION_CHECKS
+// are used, all numbers are LEB128 varints
+//
+//        SECTION_TAGS: tag count, then per tag id: name length, name,
+//                      number of records carrying it
+//     SECTION_RECORDS: records in blocks of PACKED_BLOCK, per record of a
+//                      block, sorted by path:
+//                          shared: bytes in common with the previous path
+//                                  of the block
+//                          suffix: length of the rest, the rest
+//                             pos: index of the record in the block
+//                          tag_sz: tag count, then the sorted tag ids, each
+//                                  as the difference to the one before
+//                         info_sz: info length + 1, 0 if none, the info
+//
+// files starting with SIGNATURE_LEGACY use the old layout and are converted
+// on load:
 //                 8: signature
 //                 4: ficor_sz
 //      for ficor_sz:
@@ -140,6 +415,21 @@ static const uint32_t flags_len = sizeof(flags) / sizeof(*flags);
 //      ficortag_buf_sz: ficor.tag_buf
 //                     4: ficor.tag_sz
 
+static const uint64_t SIGNATURE_LEGACY = 0xF1C0F1C0F1C0F1C0UL;
+static const uint32_t VERSION          = 17;
+static const uint32_t VERSION_PACKED   = 18;
+
+// loading checks the header and the checksum table, a packed file all of
+// its blocks as it is read whole anyway. --fsck checks everything
+#define CHECK_BLOCK (1 << 20)
+
+// a listing decodes a packed file one block at a time
+#define PACKED_BLOCK 4096
+
+// compaction kicks in once the journal is bigger than both of these
+static const uint64_t COMPACT_MIN_SZ   = 1 << 16;
+static const uint64_t COMPACT_RATIO    = 4;
+
 typedef enum {
     ERR_OK = 0,
     ERR_BAD_MALLOC,
@@ -193,495 +483,5225 @@ void format_error(void)
         }                                   \
     } while (0)
 
+typedef enum {
+    SECTION_RECORDS = 0,
+    SECTION_TAGS,
+    SECTION_PATH_TABLE,
+    SECTION_TAG_TABLE,
+    SECTION_PATH_ORDER,
+    SECTION_GRAMS,
+    SECTION_GRAM_POST,
+    SECTION_HEAP,
+    SECTION_CHECKS,
+    SECTION_MAX,
+} section_id_t;
+
+typedef struct section_t section_t;
+struct section_t {
+    uint64_t off;
+    uint64_t sz;
+};
+
+typedef struct header_t header_t;
+struct header_t {
+    uint64_t  signature;
+    uint32_t  version;
+    uint32_t  ficor_sz;
+    uint64_t  journal;
+    uint64_t  generation;
+    uint32_t  check;
+    uint32_t  check_block;
+    section_t section[SECTION_MAX];
+};
+
+typedef enum {
+    JOURNAL_ADD_FILE = 1,
+    JOURNAL_RM_FILE,
+    JOURNAL_ADD_TAG,
+    JOURNAL_RM_TAG,
+    JOURNAL_SET_INFO,
+    JOURNAL_MAX,
+} journal_op_t;
+
+static const uint32_t journal_argc[JOURNAL_MAX] = {
+    [JOURNAL_ADD_FILE] = 3, // file, tags, info
+    [JOURNAL_RM_FILE]  = 1, // file
+    [JOURNAL_ADD_TAG]  = 2, // file, tags
+    [JOURNAL_RM_TAG]   = 2, // file, tags
+    [JOURNAL_SET_INFO] = 2, // file, info
+};
+
+// command names used by --batch
+static const char* const journal_name[JOURNAL_MAX] = {
+    [JOURNAL_ADD_FILE] = "add-file",
+    [JOURNAL_RM_FILE]  = "rm-file",
+    [JOURNAL_ADD_TAG]  = "add-tag",
+    [JOURNAL_RM_TAG]   = "rm-tag",
+    [JOURNAL_SET_INFO] = "set-info",
+};
+
+// on disk and in memory representation of a record, all strings are heap
+// offsets. Bit (id % 64) of tag_mask is set for every tag, so most filters
+// are decided without looking at the tag array
 typedef struct ficor_t ficor_t;
 struct ficor_t {
-    char*  info;
-    char*  file;
-    char*  tag_buf;
-    char** tag;
-    uint32_t  file_sz;
-    uint32_t  tag_buf_sz;
-    uint32_t  tag_sz;
-    uint32_t  info_sz;
+    uint64_t file;
+    uint64_t info;
+    uint64_t tag;
+    uint64_t tag_mask;
+    uint32_t file_sz;
+    uint32_t info_sz;
+    uint32_t tag_sz;
+    uint32_t flags;
 };
 
-static ficor_t* ficor    = NULL;
-static uint32_t ficor_sz = 0;
+typedef enum {
+    FICOR_DEAD = 1 << 0, // removed, dropped by the next compaction
+} ficor_flags_t;
 
-static char** find_tag(char** buf, uint32_t sz, char* tag);
+// tag dictionary entry, the index is the tag id. count is the number of live
+// records carrying the tag, kept up to date by every mutation, while the
+// posting list only grows until the next compaction
+typedef struct tag_t tag_t;
+struct tag_t {
+    uint64_t name;
+    uint64_t post;
+    uint32_t name_sz;
+    uint32_t post_sz;
+    uint32_t count;
+    uint32_t unused;
+};
 
-static void load_ficor(void)
-{
-    FILE* f = fopen(ficor_file, "rb");
-    ERR_IF_MSG(!f, ERR_FILE, "could not open file '%s': %s", 
-               ficor_file, 
-               strerror(errno));
-    
-    uint64_t sig;
-    fread(&sig, 1, sizeof(sig), f);
-    ERR_IF_MSG(sig != SIGNATURE, ERR_FILE, 
-               "%s is not a valid ficor file",
-               ficor_file);
+// trigram index entry, see text.h
+typedef struct gram_t gram_t;
+struct gram_t {
+    uint32_t gram;
+    uint32_t post_sz;
+    uint64_t post;
+};
 
-    fread(&ficor_sz, 1, sizeof(ficor_sz), f);
-    ficor = calloc(ficor_sz + 1, sizeof(*ficor));
-    ERR_IF(!ficor, ERR_BAD_MALLOC);
+// id is the index of the entry + 1, 0 marks an empty slot. hash is kept to
+// skip most string compares and to move entries without rehashing
+typedef struct slot_t slot_t;
+struct slot_t {
+    uint32_t hash;
+    uint32_t id;
+};
 
-    uint32_t i = 0;
-    for (; i < ficor_sz; ++i) {
-        fread(&ficor[i].file_sz, 1, sizeof(ficor[i].file_sz), f);
-        ficor[i].file = malloc(ficor[i].file_sz);
-        ERR_IF(!ficor[i].file, ERR_BAD_MALLOC);
-        fread(ficor[i].file, 1, ficor[i].file_sz, f);
-
-        fread(&ficor[i].info_sz, 1, sizeof(ficor[i].info_sz), f);
-        if (ficor[i].info_sz) {
-            ficor[i].info = malloc(ficor[i].info_sz);
-            ERR_IF(!ficor[i].info, ERR_BAD_MALLOC);
-            fread(ficor[i].info, 1, ficor[i].info_sz, f);
-        } else {
-            ficor[i].info = NULL;
-        }
+// holds live entries only, removal shifts the following entries back
+typedef struct table_t table_t;
+struct table_t {
+    slot_t*  slot;
+    uint32_t cap;
+    uint32_t used;
+    bool     owned;  // slot is allocated, not mapped
+};
 
-        fread(&ficor[i].tag_buf_sz, 1, sizeof(ficor[i].tag_buf_sz), f);
-        if (ficor[i].tag_buf_sz) {
+// records that got a tag since the last compaction, sorted, id is a heap
+// offset. Postings are not shrunk when a tag goes away: every candidate is
+// checked against its record before it is listed
+typedef struct post_t post_t;
+struct post_t {
+    uint64_t id;
+    uint32_t sz;
+    uint32_t cap;
+};
 
-            ficor[i].tag_buf = malloc(ficor[i].tag_buf_sz);
-            ERR_IF(!ficor[i].tag_buf_sz, ERR_BAD_MALLOC);
-            fread(ficor[i].tag_buf, 1, ficor[i].tag_buf_sz, f);
+// checks a tag array against a filter's bitsets, picked for the cpu in main()
+static match_fn_t* match_tags = match_scalar;
 
-            fread(&ficor[i].tag_sz, 1, sizeof(ficor[i].tag_sz), f);
+// checksums of the file, picked for the cpu first thing in main()
+static crc_fn_t* crc32c = crc_table;
 
-            ficor[i].tag = malloc(ficor[i].tag_sz * sizeof(*ficor[i].tag));
-            ERR_IF(!ficor[i].tag, ERR_BAD_MALLOC);
+// include / exclude tags as bitsets over the tag ids. The tags a query
+// requires or forbids are added to them, the rest of it is run per record.
+// Paths are checked against the --under directory and the --glob, infos
+// against the words of --search
+typedef struct filter_t filter_t;
+struct filter_t {
+    uint64_t* include;
+    uint64_t* exclude;
+    uint32_t* include_id;
+    uint64_t  include_mask;
+    uint64_t  exclude_mask;
+    uint32_t  include_sz;
+    bool      empty;     // an include tag is unknown, nothing matches
+    query_t   query;
+    char*     under;     // ends in '/'
+    uint32_t  under_sz;
+    char*     glob;
+    uint32_t  glob_sz;   // length of the literal prefix of glob
+    char**    word;      // one allocation with the copied words
+    uint32_t  word_sz;
+    uint32_t* word_gram; // trigrams of the words, sorted
+    uint32_t  word_gram_sz;
+};
 
-            // parse tags
-            {
-                char* s = ficor[i].tag_buf;
-                uint32_t j = 0;
-                for (; j < ficor[i].tag_sz; ++j, ++s) {
-                    ficor[i].tag[j] = s;
-                    for (; *s; ++s) {  }
-                }
-            }
-        } else {
-            ficor[i].tag_buf = NULL;
-            ficor[i].tag     = NULL;
-            ficor[i].tag_sz  = 0;
-        }
-    }
+// records [0, ficor_map_sz) live in the mapping, the rest in ficor_new
+static ficor_t* ficor         = NULL;
+static uint32_t ficor_map_sz  = 0;
+static ficor_t* ficor_new     = NULL;
+static uint32_t ficor_new_cap = 0;
+static uint32_t ficor_sz      = 0;
 
-    fclose(f);
+// same split for the tag dictionary
+static tag_t*   dict_map     = NULL;
+static uint32_t dict_map_sz  = 0;
+static tag_t*   dict_new     = NULL;
+static uint32_t dict_new_cap = 0;
+static uint32_t dict_sz      = 0;
 
-    return;
+// posting additions, indexed by tag id
+static post_t*  post_new    = NULL;
+static uint32_t post_new_sz = 0;
 
-error:
-    if (f) fclose(f);
-    return;
-}
+static table_t path_table = { 0 };
+static table_t tag_table  = { 0 };
 
-void unload_ficor(void)
-{
-    FILE* f = fopen(ficor_file, "wb");
-    ERR_IF_MSG(!f, ERR_FILE, "could not open file '%s': %s", ficor_file, strerror(errno));
+// indices of the records in the mapping sorted by path, NULL if the snapshot
+// has none (packed and legacy files). Records added later are not in it
+static uint32_t* path_order = NULL;
 
-    fwrite(&SIGNATURE, 1, sizeof(SIGNATURE), f);
-    fwrite(&ficor_sz, 1, sizeof(ficor_sz), f);
+// trigram index over the infos of the records in the mapping, NULL if the
+// snapshot has none. Neither records added later nor those whose info
+// changed since (info_edit, unsorted) are in it
+static gram_t*   gram_index    = NULL;
+static uint64_t  gram_index_sz = 0;
+static uint32_t* gram_post     = NULL;
+static uint64_t  gram_post_sz  = 0;
+static uint32_t* info_edit     = NULL;
+static uint32_t  info_edit_sz  = 0;
+static uint32_t  info_edit_cap = 0;
 
-    ficor_t* i = ficor;
-    ficor_t* const e = ficor + ficor_sz;
+// bit per record in the mapping, set once a change moved its strings or tags
+// to the arena or removed it. Those were checked before, see rec_ok()
+static uint64_t* map_edited = NULL;
 
-    for (; i != e; ++i) {
-        fwrite(&i->file_sz, 1, sizeof(i->file_sz), f);
-        fwrite(i->file, 1, i->file_sz, f);
-        free(i->file);
+// the mapping is private and writable: patching a record copies only the
+// touched page
+static uint8_t* map    = NULL;
+static size_t   map_sz = 0;
 
-        fwrite(&i->info_sz, 1, sizeof(i->info_sz), f);
-        if (i->info_sz) {
-            fwrite(i->info, 1, i->info_sz, f);
-            free(i->info);
-        }
+// heap offsets below heap_map_sz point into the mapping, everything above
+// into the heap arena, which grows while running
+static char*    heap_map    = NULL;
+static uint64_t heap_map_sz = 0;
+static arena_t  heap        = { 0 };
 
-        fwrite(&i->tag_buf_sz, 1, sizeof(i->tag_buf_sz), f);
-        if (i->tag_buf_sz) {
-            fwrite(i->tag_buf, 1, i->tag_buf_sz, f);
-            free(i->tag_buf);
-            fwrite(&i->tag_sz, 1, sizeof(i->tag_sz), f);
-            free(i->tag);
-        }
-    }
+// buffered stdout of list(), get() and dump()
+#define OUT_SZ (256 * 1024)
 
-    free(ficor);
-    ficor    = NULL;
-    ficor_sz = 0;
+static out_t out = { 0 };
 
-    fclose(f);
-    return;
+// what --stats and FICOR_STATS report. printed counts the records written
+// out, checked the ones the filter was run on
+static stats_t     stats      = { 0 };
+static const char* stats_file = NULL;
+static uint64_t    printed    = 0;
+static uint64_t    checked    = 0;
 
-error:
-    if (f) fclose(f);
-    return;
+// the snapshot is in the packed format, and so will be the next one
+static bool packed = 0;
+
+// set by main() when the invocation only lists. If the journal is empty the
+// mapping is then never written (map_clean) and its pages are dropped once
+// read, and the records of a packed snapshot (stream) are decoded while
+// listing instead of on load, unless --sort needs them all at once
+static bool      list_only = 0;
+static bool      map_clean = 0;
+static header_t* stream    = NULL;
+
+// where the journal starts in the mapping, how much of it is on disk, and
+// entries not yet written
+static uint64_t journal_off     = 0;
+static uint64_t journal_disk_sz = 0;
+static bool     journal_rewrite = 0;
+static char*    journal         = NULL;
+static uint64_t journal_sz      = 0;
+static uint64_t journal_cap     = 0;
+
+// of the records in memory, see the file spec
+static uint64_t generation = 0;
+
+// the generation of a new database, random so one created again at the same
+// path does not pick up where the old one left off
+static uint64_t new_generation(void)
+{
+    uint64_t g = 0;
+    if (getrandom(&g, sizeof(g), 0) != sizeof(g)) {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        g = (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+        g ^= (uint64_t)getpid() << 32;
+    }
+    return g;
 }
 
-static void add_tag(void)
+static inline uint64_t align8(uint64_t n)
 {
-    ERR_IF_MSG(!flag_set_tag, ERR_GENERAL, "--add-flag requires -t / --set-tag");
-    ficor_t* f = ficor;
-    ficor_t* fe = ficor + ficor_sz;
+    return (n + 7) & ~(uint64_t)7;
+}
 
-    for (; f != fe; ++f) {
-        if (strcmp(f->file, flag_add_tag) == 0) {
-            break;
-        }
-    }
-    ERR_IF_MSG(f == fe, ERR_GENERAL, "%s not found", flag_add_tag);
+static inline ficor_t* rec(uint32_t i)
+{
+    return i < ficor_map_sz ? &ficor[i] : &ficor_new[i - ficor_map_sz];
+}
 
-    uint32_t sz = strlen(flag_set_tag) + 1;
-    f->tag_buf  = realloc(f->tag_buf, sz + f->tag_buf_sz);
-    f->tag      = realloc(f->tag, (f->tag_sz + 1) * sizeof(*f->tag));
-    ERR_IF(!f->tag || !f->tag_buf, ERR_BAD_MALLOC);
+static inline char* str(uint64_t off)
+{
+    return off < heap_map_sz ? heap_map + off : arena_ptr(&heap, off - heap_map_sz);
+}
 
-    memcpy(f->tag_buf, flag_set_tag, sz);
+static inline uint32_t* tags(ficor_t* f)
+{
+    return (uint32_t*)str(f->tag);
+}
 
-    f->tag[f->tag_sz++] = &f->tag_buf[f->tag_buf_sz];
-    f->tag_buf_sz       += sz;
+static inline tag_t* dict(uint32_t id)
+{
+    return id < dict_map_sz ? &dict_map[id] : &dict_new[id - dict_map_sz];
+}
 
-    return;
+static inline char* tag_name(uint32_t id)
+{
+    return str(dict(id)->name);
+}
 
-error:
-    return;
+static inline uint32_t* postings(uint32_t id)
+{
+    return (uint32_t*)str(dict(id)->post);
 }
 
-static void tag_array(char*** tag_array, uint32_t* tag_sz, char* buf)
+static inline uint32_t post_sz(uint32_t id)
 {
-    char* s = buf;
-    *tag_sz = 1;
-    for (; *s; ++s) {
-        if (*s == ':') {
-            *s++ = 0;
-            *tag_sz += 1;
-        }
-    }
+    return dict(id)->post_sz + (id < post_new_sz ? post_new[id].sz : 0);
+}
 
-    *tag_array = malloc(*tag_sz * sizeof(**tag_array));
-    ERR_IF(!*tag_array, ERR_BAD_MALLOC);
+// posting additions of tag id, NULL if there are none
+static inline uint32_t* post_added(uint32_t id)
+{
+    return id < post_new_sz && post_new[id].cap ? (uint32_t*)str(post_new[id].id) : NULL;
+}
 
-    char** t  = *tag_array;
-    char** te = *tag_array + *tag_sz;
-    s = buf;
-    for (; t != te; ++t, ++s) {
-        *t = s;
-        for (; *s; ++s) {  }
-    }
-error:
-    return;
+static inline bool bit(uint64_t* set, uint32_t i)
+{
+    return set[i / 64] >> (i % 64) & 1;
 }
 
-static void rm_tag(void)
+// sz bytes at heap offset off, aligned to align, lie in the mapped heap
+static bool heap_has(uint64_t off, uint64_t sz, uint64_t align)
 {
-    ERR_IF_MSG(!flag_set_tag, ERR_GENERAL, "--rm-tag requires -t to work");
-    uint32_t tag_sz = 0;
-    char**   tag    = NULL;
-    tag_array(&tag, &tag_sz, flag_set_tag);
-    ERR_FORWARD();
+    return off % align == 0 && off <= heap_map_sz && sz <= heap_map_sz - off;
+}
 
-    ficor_t* f = ficor;
-    // find according ficor
-    {
-        ficor_t* fe = ficor + ficor_sz;
-        for (; f != fe; ++f) {
-            if (strcmp(f->file, flag_rm_tag) == 0) {
-                break;
-            }
-        }
-        ERR_IF_MSG(f == fe, ERR_GENERAL, "could not find decorator for file: %s", flag_rm_tag);
+// record i exists and may be used. Loading does not read the records of the
+// mapping, so one is checked before it is used: its strings and tag array lie
+// in the heap, as the files compaction writes have them. The heap ends in a
+// NUL, every string in it is terminated. Tag ids are checked by tags_ok()
+// where they are looked up, most listings never read them
+static bool rec_ok(uint32_t i)
+{
+    if (i >= ficor_map_sz || (map_edited && bit(map_edited, i))) {
+        return i < ficor_sz;
     }
 
-    // using remove_if implementation
-    char*  new_tag_buf = malloc(f->tag_buf_sz);
-    char** new_tag   = malloc(f->tag_sz * sizeof(*new_tag));
-    ERR_IF(!new_tag || !new_tag_buf, ERR_BAD_MALLOC);
-
-    char*  tb = new_tag_buf;
-    char** tn = new_tag;
-    char** t  = f->tag;
-    char** te = f->tag + f->tag_sz;
+    ficor_t* f = &ficor[i];
+    return !f->flags && f->file_sz && heap_has(f->file, f->file_sz, 1)
+        && (!f->info_sz || heap_has(f->info, f->info_sz, 1))
+        && heap_has(f->tag, (uint64_t)f->tag_sz * sizeof(uint32_t), sizeof(uint32_t));
+}
 
+// the tag ids of f, a record that passed rec_ok(), are in the dictionary
+static bool tags_ok(ficor_t* f)
+{
+    const uint32_t*       t  = tags(f);
+    const uint32_t* const te = t + f->tag_sz;
     for (; t != te; ++t) {
-        if (!find_tag(tag, tag_sz, *t)) {
-            *tn++ = *t;
-            uint32_t l = strlen(*t) + 1;
-            memcpy(tb, *t, l);
-            tb += l;
+        if (*t >= dict_sz) {
+            return 0;
         }
     }
-
-    free(f->tag_buf);
-    free(f->tag);
-
-    f->tag_buf    = new_tag_buf;
-    f->tag_buf_sz = tb - new_tag_buf;
-    f->tag        = new_tag;
-    f->tag_sz      = tn - new_tag;
-    
-    free(tag);
-    return;
-
-error:
-    free(tag);
-    return;
+    return 1;
 }
 
-static void rm_file(void)
+// records change in place from here on, i has been checked
+static void rec_edit(uint32_t i)
 {
-    ficor_t* f = ficor;
-    ficor_t* fe = ficor + ficor_sz;
-    for (; f != fe; ++f) {
-        if (strcmp(f->file, flag_rm_file) == 0) {
-            break;
+    if (i < ficor_map_sz) {
+        if (!map_edited) {
+            map_edited = calloc(ficor_map_sz / 64 + 1, sizeof(*map_edited));
+            ERR_IF(!map_edited, ERR_BAD_MALLOC);
         }
+        map_edited[i / 64] |= (uint64_t)1 << (i % 64);
     }
-    ERR_IF_MSG(f == fe, ERR_GENERAL, "could not remove %s: no such file in ficor", flag_rm_file);
-
-    free(f->file);
-    free(f->info);
-    free(f->tag_buf);
-    free(f->tag);
-
-    memmove(f, f + 1, (fe - f - 1) * sizeof(*f));
-    ficor_sz -= 1;
 
-    return;
 error:
     return;
 }
 
-void init(void)
+// LEB128
+static void put_varint(FILE* f, uint64_t v)
 {
-    FILE* f = fopen(ficor_file, "wb");
-    ERR_IF_MSG(!f, ERR_FILE, "could not open file '%s': %s", ficor_file, strerror(errno));
-
-    fwrite(&SIGNATURE, 1, sizeof(SIGNATURE), f);
-    uint32_t zero = 0;
-    fwrite(&zero, 1, sizeof(zero), f);
-
-    fclose(f);
-    return;
-
-error:
-    if (f) fclose(f);
-    return;
+    uint8_t  b[10];
+    uint32_t n = 0;
+    for (; v >= 0x80; v >>= 7) {
+        b[n++] = v | 0x80;
+    }
+    b[n++] = v;
+    fwrite(b, 1, n, f);
 }
 
-void dump(void)
+// false if the varint runs past e or is too long
+static bool get_varint(const uint8_t** p, const uint8_t* e, uint64_t* v)
 {
-    ficor_t*       f = ficor;
-    ficor_t* const e = ficor + ficor_sz;
-    for (; f != e; ++f) {
-        printf("Name:\n\t%s\nInfo:\n", f->file);
-        if (f->info) {
-            printf("\t%s\n", f->info);
-        }
-        printf("Tags:\n");
-
-        char** t = f->tag;
-        char** const te = f->tag + f->tag_sz;
-        for (; t != te; ++t) {
-            printf("\t%s\n", *t);
+    uint32_t shift = 0;
+    *v = 0;
+    for (; *p != e && shift < 64; shift += 7) {
+        uint8_t b = *(*p)++;
+        *v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return 1;
         }
-        putc('\n', stdout);
     }
+    return 0;
 }
 
-void add_file(void)
+static uint64_t heap_alloc(uint64_t sz)
 {
-    ficor_t* f = &ficor[ficor_sz++];
-
-    f->file_sz = strlen(flag_add_file) + 1;
-    f->file = malloc(f->file_sz);
-    ERR_IF(!f->file, ERR_BAD_MALLOC);
-    strcpy(f->file, flag_add_file);
+    uint64_t off = arena_alloc(&heap, sz);
+    ERR_IF(off == ARENA_NONE, ERR_BAD_MALLOC);
+    return heap_map_sz + off;
 
-    if (flag_set_tag) {
-        f->tag_buf_sz = strlen(flag_set_tag) + 1;
-        f->tag_buf    = malloc(f->tag_buf_sz);
-        ERR_IF(!f->tag_buf, ERR_BAD_MALLOC);
-        strcpy(f->tag_buf, flag_set_tag);
-
-        f->tag_sz = 1;
-        char* s = f->tag_buf;
-        for (; *s; ++s) {
-            if (*s == ':') {
-                *s++ = 0;
-                f->tag_sz += 1;
-            }
-        }
+error:
+    return 0;
+}
 
-        s = f->tag_buf;
-        f->tag = malloc(f->tag_sz * sizeof(*f->tag));
-        ERR_IF(!f->tag, ERR_BAD_MALLOC);
+// blocks in the mapping stay where they are until the next compaction
+static void heap_free(uint64_t off, uint64_t sz)
+{
+    if (off >= heap_map_sz) {
+        arena_free(&heap, off - heap_map_sz, sz);
+    }
+}
 
-        char** t = f->tag;
-        char** const te = f->tag + f->tag_sz;
+static ficor_t* push_ficor(void)
+{
+    uint32_t i = ficor_sz - ficor_map_sz;
+    if (i == ficor_new_cap) {
+        uint32_t cap = ficor_new_cap ? ficor_new_cap * 2 : 64;
+        ficor_t* n   = realloc(ficor_new, cap * sizeof(*n));
+        ERR_IF(!n, ERR_BAD_MALLOC);
+        ficor_new     = n;
+        ficor_new_cap = cap;
+    }
+    ficor_sz += 1;
+    ficor_t* f = &ficor_new[i];
+    memset(f, 0, sizeof(*f));
+    return f;
 
-        for (; t != te; ++t, ++s) {
-            *t = s;
-            for (; *s; ++s) {  }
-        }
+error:
+    return NULL;
+}
 
-    } else {
-        f->tag_buf_sz = 0;
-    }
+static uint64_t heap_str(const char* s, uint32_t sz)
+{
+    uint64_t off = heap_alloc(sz);
+    ERR_FORWARD();
+    memcpy(str(off), s, sz);
+    return off;
 
-    if (flag_set_info) {
-        f->info_sz = strlen(flag_set_info) + 1;
-        f->info    = malloc(f->info_sz);
-        strcpy(f->info, flag_set_info);
-    } else {
-        f->info_sz = 0;
-    }
-    
 error:
-    return;
+    return 0;
 }
 
-static char** find_tag(char** buf, uint32_t sz, char* tag)
+static void replay_journal(uint8_t* p, uint8_t* const e);
+
+// FNV-1a, folded to 32 bits
+static uint32_t hash(const char* s)
 {
-    char** iter = buf;
-    char** end  = buf + sz;
-    for (; iter != end; ++iter) {
-        if (strcmp(*iter, tag) == 0) {
-            return iter;
-        }
+    uint64_t h = 0xcbf29ce484222325UL;
+    for (; *s; ++s) {
+        h = (h ^ (uint8_t)*s) * 0x100000001b3UL;
     }
-    return NULL;
+    return h ^ h >> 32;
 }
 
-static bool is_tag_disjunct(char** a, uint32_t a_sz, char** b, uint32_t b_sz)
+// NULL for an entry that cannot be used, it matches no key
+static char* path_key(uint32_t i)
 {
-    char** iter = b;
-    char** end  = b + b_sz;
-    for (; iter != end; ++iter) {
-        if (find_tag(a, a_sz, *iter)) {
-            return 0;
-        }
-    }
-    return 1;
+    return rec_ok(i) ? str(rec(i)->file) : NULL;
 }
 
-static bool is_tag_subset(char** a, uint32_t a_sz, char** b, uint32_t b_sz)
+static char* tag_key(uint32_t i)
 {
-    char** iter = b;
-    char** end  = b + b_sz;
-    for (; iter != end; ++iter) {
-        if (!find_tag(a, a_sz, *iter)) {
+    return i < dict_sz ? tag_name(i) : NULL;
+}
+
+// slot holding key or the empty slot its probe ends in, NULL for an empty
+// table
+static slot_t* table_find(table_t* t, uint32_t h, char* key, char* (*key_of)(uint32_t))
+{
+    if (!t->cap) {
+        return NULL;
+    }
+    uint32_t m = t->cap - 1;
+    uint32_t i = h & m;
+    for (; t->slot[i].id; i = (i + 1) & m) {
+        const char* k = t->slot[i].hash == h ? key_of(t->slot[i].id - 1) : NULL;
+        if (k && strcmp(k, key) == 0) {
+            break;
+        }
+    }
+    return &t->slot[i];
+}
+
+static void table_put(slot_t* slot, uint32_t cap, slot_t s)
+{
+    uint32_t m = cap - 1;
+    uint32_t i = s.hash & m;
+    for (; slot[i].id; i = (i + 1) & m) {  }
+    slot[i] = s;
+}
+
+static void table_grow(table_t* t)
+{
+    uint32_t cap  = t->cap ? t->cap * 2 : 16;
+    slot_t*  slot = calloc(cap, sizeof(*slot));
+    ERR_IF(!slot, ERR_BAD_MALLOC);
+
+    uint32_t i = 0;
+    for (; i < t->cap; ++i) {
+        if (t->slot[i].id) {
+            table_put(slot, cap, t->slot[i]);
+        }
+    }
+
+    if (t->owned) {
+        free(t->slot);
+    }
+    t->slot  = slot;
+    t->cap   = cap;
+    t->owned = 1;
+
+error:
+    return;
+}
+
+// i must not be in t yet
+static void table_insert(table_t* t, uint32_t h, uint32_t i)
+{
+    if ((t->used + 1) * 4 > t->cap * 3) {
+        table_grow(t);
+        ERR_FORWARD();
+    }
+    table_put(t->slot, t->cap, (slot_t){ .hash = h, .id = i + 1 });
+    t->used += 1;
+
+error:
+    return;
+}
+
+static void table_remove(table_t* t, slot_t* s)
+{
+    uint32_t m = t->cap - 1;
+    uint32_t i = s - t->slot;
+    uint32_t j = i;
+
+    // pull back every following entry whose home is not between the hole and
+    // its slot
+    for (;;) {
+        t->slot[i].id = 0;
+        for (;;) {
+            j = (j + 1) & m;
+            if (!t->slot[j].id) {
+                t->used -= 1;
+                return;
+            }
+            uint32_t home = t->slot[j].hash & m;
+            if (((j - home) & m) >= ((j - i) & m)) {
+                break;
+            }
+        }
+        t->slot[i] = t->slot[j];
+        i          = j;
+    }
+}
+
+static void table_free(table_t* t)
+{
+    if (t->owned) {
+        free(t->slot);
+    }
+    memset(t, 0, sizeof(*t));
+}
+
+// index of the live record of file, ficor_sz if there is none
+static uint32_t find_ficor(char* file)
+{
+    slot_t* s = table_find(&path_table, hash(file), file, path_key);
+    return s && s->id ? s->id - 1 : ficor_sz;
+}
+
+// id of the tag called name, dict_sz if there is none
+static uint32_t find_dict(char* name)
+{
+    slot_t* s = table_find(&tag_table, hash(name), name, tag_key);
+    return s && s->id ? s->id - 1 : dict_sz;
+}
+
+// id of the tag called name, added to the dictionary if needed
+static uint32_t intern(char* name)
+{
+    uint32_t id = find_dict(name);
+    if (id != dict_sz) {
+        return id;
+    }
+
+    if (id - dict_map_sz == dict_new_cap) {
+        uint32_t cap = dict_new_cap ? dict_new_cap * 2 : 64;
+        tag_t*   n   = realloc(dict_new, cap * sizeof(*n));
+        ERR_IF(!n, ERR_BAD_MALLOC);
+        dict_new     = n;
+        dict_new_cap = cap;
+    }
+
+    tag_t t = { .name_sz = strlen(name) + 1 };
+    t.name = heap_str(name, t.name_sz);
+    ERR_FORWARD();
+
+    dict_new[id - dict_map_sz] = t;
+    dict_sz += 1;
+
+    table_insert(&tag_table, hash(name), id);
+    ERR_FORWARD();
+    return id;
+
+error:
+    return 0;
+}
+
+// note that record i carries tag id
+static void post_push(uint32_t id, uint32_t i)
+{
+    if (id >= post_new_sz) {
+        uint32_t sz = post_new_sz ? post_new_sz : 64;
+        for (; sz <= id; sz *= 2) {  }
+        post_t* n = realloc(post_new, sz * sizeof(*n));
+        ERR_IF(!n, ERR_BAD_MALLOC);
+        memset(n + post_new_sz, 0, (sz - post_new_sz) * sizeof(*n));
+        post_new    = n;
+        post_new_sz = sz;
+    }
+
+    post_t* p = &post_new[id];
+    if (p->sz == p->cap) {
+        uint32_t cap = p->cap ? p->cap * 2 : 4;
+        uint64_t n   = heap_alloc((uint64_t)cap * sizeof(uint32_t));
+        ERR_FORWARD();
+        if (p->cap) {
+            memcpy(str(n), str(p->id), (uint64_t)p->sz * sizeof(uint32_t));
+            heap_free(p->id, (uint64_t)p->cap * sizeof(uint32_t));
+        }
+        p->id  = n;
+        p->cap = cap;
+    }
+
+    // records mostly arrive in order, keep the list sorted and unique
+    uint32_t* l = (uint32_t*)str(p->id);
+    uint32_t  j = p->sz;
+    for (; j && l[j - 1] > i; --j) {  }
+    if (j && l[j - 1] == i) {
+        return;
+    }
+    memmove(l + j + 1, l + j, (p->sz - j) * sizeof(*l));
+    l[j]   = i;
+    p->sz += 1;
+
+error:
+    return;
+}
+
+static int cmp_id(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// rebuild the sorted tag array of record i without the tags in rm and with
+// the tags in add, unknown tags in rm are ignored
+static void set_tags(uint32_t i, char** add, uint32_t add_sz, char** rm, uint32_t rm_sz)
+{
+    ficor_t* f = rec(i);
+
+    uint32_t* id = malloc((add_sz + rm_sz + 1) * sizeof(*id));
+    ERR_IF(!id, ERR_BAD_MALLOC);
+    ERR_IF_MSG(!tags_ok(f), ERR_FILE, "%s is corrupted. --fsck tells more", ficor_file);
+    rec_edit(i);
+    ERR_FORWARD();
+
+    uint32_t* a  = id;
+    uint32_t* ae = id;
+    uint32_t  j  = 0;
+    for (; j < add_sz; ++j) {
+        *ae++ = intern(add[j]);
+        ERR_FORWARD();
+    }
+    uint32_t* r  = ae;
+    uint32_t* re = ae;
+    for (j = 0; j < rm_sz; ++j) {
+        uint32_t k = find_dict(rm[j]);
+        if (k != dict_sz) {
+            *re++ = k;
+        }
+    }
+    qsort(a, ae - a, sizeof(*a), cmp_id);
+    qsort(r, re - r, sizeof(*r), cmp_id);
+
+    uint64_t off = heap_alloc(((uint64_t)f->tag_sz + add_sz) * sizeof(uint32_t));
+    ERR_FORWARD();
+
+    // merge old and add, dropping duplicates and everything in rm
+    uint32_t*       t    = tags(f);
+    uint32_t* const te   = t + f->tag_sz;
+    uint32_t*       n    = (uint32_t*)str(off);
+    uint32_t        sz   = 0;
+    uint64_t        mask = 0;
+    while (t != te || a != ae) {
+        uint32_t v   = t == te || (a != ae && *a < *t) ? *a : *t;
+        bool     had = t != te && *t == v;
+        for (; t != te && *t == v; ++t) {  }
+        for (; a != ae && *a == v; ++a) {  }
+        for (; r != re && *r < v; ++r) {  }
+        if (r != re && *r == v) {
+            dict(v)->count -= had;
+            continue;
+        }
+        n[sz++] = v;
+        mask   |= (uint64_t)1 << (v % 64);
+
+        if (!had) {
+            dict(v)->count += 1;
+            post_push(v, i);
+            ERR_FORWARD();
+        }
+    }
+
+    heap_free(f->tag, (uint64_t)f->tag_sz * sizeof(uint32_t));
+    f->tag      = off;
+    f->tag_sz   = sz;
+    f->tag_mask = mask;
+
+    free(id);
+    return;
+
+error:
+    free(id);
+    return;
+}
+
+static void free_ficor(void)
+{
+    if (map) {
+        munmap(map, map_sz);
+    }
+    free(ficor_new);
+    free(dict_new);
+    arena_clear(&heap);
+    free(post_new);
+    post_new    = NULL;
+    post_new_sz = 0;
+    free(info_edit);
+    info_edit     = NULL;
+    info_edit_sz  = 0;
+    info_edit_cap = 0;
+    free(map_edited);
+    map_edited    = NULL;
+
+    table_free(&path_table);
+    table_free(&tag_table);
+
+    map           = NULL;
+    map_sz        = 0;
+    ficor         = NULL;
+    ficor_map_sz  = 0;
+    ficor_new     = NULL;
+    ficor_new_cap = 0;
+    ficor_sz      = 0;
+    dict_map      = NULL;
+    dict_map_sz   = 0;
+    dict_new      = NULL;
+    dict_new_cap  = 0;
+    dict_sz       = 0;
+    heap_map      = NULL;
+    heap_map_sz   = 0;
+    path_order    = NULL;
+    gram_index    = NULL;
+    gram_index_sz = 0;
+    gram_post     = NULL;
+    gram_post_sz  = 0;
+    map_clean     = 0;
+    stream        = NULL;
+
+    free(journal);
+    journal_off     = 0;
+    journal_disk_sz = 0;
+    journal_rewrite = 0;
+    journal         = NULL;
+    journal_sz      = 0;
+    journal_cap     = 0;
+    generation      = 0;
+}
+
+// converts a file in the old layout into heap records
+static void load_legacy(void)
+{
+    char**         tag = NULL;
+    uint8_t*       p   = map + sizeof(SIGNATURE_LEGACY);
+    uint8_t* const e = map + map_sz;
+
+#define LEGACY_READ(dst, sz)                                            \
+    do {                                                                \
+        ERR_IF_MSG((uint64_t)(e - p) < (sz), ERR_FILE,                  \
+                   "%s is truncated", ficor_file);                      \
+        memcpy((dst), p, (sz));                                         \
+        p += (sz);                                                      \
+    } while (0)
+
+    uint32_t sz = 0;
+    LEGACY_READ(&sz, sizeof(sz));
+
+    uint32_t n = 0;
+    for (; n < sz; ++n) {
+        uint32_t l = 0;
+        LEGACY_READ(&l, sizeof(l));
+        ERR_IF_MSG((uint64_t)(e - p) < l, ERR_FILE, "%s is truncated", ficor_file);
+
+        uint32_t file_sz = strnlen((char*)p, l) + 1;
+        uint64_t file    = heap_alloc(file_sz);
+        ERR_FORWARD();
+        memcpy(str(file), p, file_sz - 1);
+        str(file)[file_sz - 1] = 0;
+        p += l;
+
+        // old files may list a path more than once, those are merged into
+        // the first record
+        uint32_t i = find_ficor(str(file));
+        if (i == ficor_sz) {
+            ficor_t* f = push_ficor();
+            ERR_FORWARD();
+            f->file    = file;
+            f->file_sz = file_sz;
+            table_insert(&path_table, hash(str(file)), i);
+            ERR_FORWARD();
+        }
+
+        LEGACY_READ(&l, sizeof(l));
+        if (l) {
+            ERR_IF_MSG((uint64_t)(e - p) < l, ERR_FILE, "%s is truncated", ficor_file);
+            if (!rec(i)->info_sz) {
+                uint32_t info_sz = strnlen((char*)p, l) + 1;
+                uint64_t info    = heap_alloc(info_sz);
+                ERR_FORWARD();
+                memcpy(str(info), p, info_sz - 1);
+                str(info)[info_sz - 1] = 0;
+                rec(i)->info    = info;
+                rec(i)->info_sz = info_sz;
+            }
+            p += l;
+        }
+
+        LEGACY_READ(&l, sizeof(l));
+        if (l) {
+            ERR_IF_MSG((uint64_t)(e - p) < l, ERR_FILE, "%s is truncated", ficor_file);
+            uint8_t* buf = p;
+            p += l;
+
+            uint32_t tag_sz = 0;
+            LEGACY_READ(&tag_sz, sizeof(tag_sz));
+            ERR_IF_MSG(tag_sz > l, ERR_FILE, "%s is corrupted", ficor_file);
+
+            // pointers followed by a copy of the tags, a missing terminator
+            // in the last tag is supplied here
+            tag = malloc(tag_sz * sizeof(*tag) + l + 1);
+            ERR_IF(!tag, ERR_BAD_MALLOC);
+
+            char*       s  = memcpy(tag + tag_sz, buf, l);
+            char* const se = s + l;
+            *se = 0;
+
+            char**       t  = tag;
+            char** const te = tag + tag_sz;
+            for (; t != te; ++t) {
+                ERR_IF_MSG(s >= se, ERR_FILE, "%s is corrupted", ficor_file);
+                *t = s;
+                s += strlen(s) + 1;
+            }
+
+            set_tags(i, tag, tag_sz, NULL, 0);
+            ERR_FORWARD();
+
+            free(tag);
+            tag = NULL;
+        }
+    }
+
+#undef LEGACY_READ
+
+    // everything has been copied, the first commit writes a new snapshot.
+    // Legacy files carry no generation, until then every load gets a new one
+    munmap(map, map_sz);
+    map             = NULL;
+    map_sz          = 0;
+    journal_rewrite = 1;
+    generation      = new_generation();
+    return;
+
+error:
+    free(tag);
+    return;
+}
+
+// CRC-32C of the header, taken with check 0, and of the checksum table
+static uint32_t header_check(header_t* h, const void* table)
+{
+    header_t c = *h;
+    c.check    = 0;
+    return crc32c(crc32c(0, &c, sizeof(c)), table, h->section[SECTION_CHECKS].sz);
+}
+
+// the blocks between the header and the checksum table
+static uint64_t check_blocks(header_t* h)
+{
+    uint64_t lo = align8(sizeof(*h));
+    uint64_t hi = h->section[SECTION_CHECKS].off;
+    return hi > lo ? (hi - lo - 1) / h->check_block + 1 : 0;
+}
+
+// block i of the mapped file at base matches its checksum
+static bool check_block_ok(header_t* h, const uint8_t* base, uint64_t i)
+{
+    uint64_t off = align8(sizeof(*h)) + i * h->check_block;
+    uint64_t end = h->section[SECTION_CHECKS].off;
+    uint64_t sz  = end - off < h->check_block ? end - off : h->check_block;
+    uint32_t want;
+    memcpy(&want, base + h->section[SECTION_CHECKS].off + i * sizeof(want), sizeof(want));
+    return crc32c(0, base + off, sz) == want;
+}
+
+// the header of the mapped file at base, of size sz, and its checksum table
+// agree, so its offsets can be trusted as far as it reaches
+static bool check_header_ok(header_t* h, const uint8_t* base, uint64_t sz)
+{
+    section_t* c = &h->section[SECTION_CHECKS];
+    return h->check_block && c->off >= align8(sizeof(*h)) && c->off <= sz && c->sz <= sz - c->off
+        && c->sz == check_blocks(h) * sizeof(uint32_t) && header_check(h, base + c->off) == h->check;
+}
+
+// a power of two number of slots with room for used entries
+static bool is_table(section_t* s, uint64_t used)
+{
+    uint64_t cap = s->sz / sizeof(slot_t);
+    return s->sz % sizeof(slot_t) == 0 && (cap & (cap - 1)) == 0
+        && cap <= UINT32_MAX && used < cap + !cap;
+}
+
+// grows *buf to hold at least sz bytes
+static void reserve(char** buf, uint64_t* cap, uint64_t sz)
+{
+    if (sz > *cap) {
+        uint64_t c = *cap ? *cap : 256;
+        for (; c < sz; c *= 2) {  }
+        char* n = realloc(*buf, c);
+        ERR_IF(!n, ERR_BAD_MALLOC);
+        *buf = n;
+        *cap = c;
+    }
+
+error:
+    return;
+}
+
+// reads the tag section of a VERSION_PACKED snapshot into the dictionary.
+// Without records in memory there are no postings, with counts set their
+// sizes are the record counts from the file as well
+static void load_packed_tags(header_t* h, bool counts)
+{
+    char*    buf = NULL;
+    uint64_t cap = 0;
+    uint64_t v   = 0;
+
+    const uint8_t* p = map + h->section[SECTION_TAGS].off;
+    const uint8_t* e = p + h->section[SECTION_TAGS].sz;
+
+    ERR_IF_MSG(!get_varint(&p, e, &v) || v > UINT32_MAX, ERR_FILE, "%s is corrupted", ficor_file);
+    uint64_t n = v;
+    uint64_t i = 0;
+    for (; i < n; ++i) {
+        ERR_IF_MSG(!get_varint(&p, e, &v) || v > (uint64_t)(e - p), ERR_FILE, "%s is corrupted", ficor_file);
+        reserve(&buf, &cap, v + 1);
+        ERR_FORWARD();
+        memcpy(buf, p, v);
+        buf[v] = 0;
+        p     += v;
+        ERR_IF_MSG(intern(buf) != i || error, ERR_FILE, "%s is corrupted", ficor_file);
+
+        ERR_IF_MSG(!get_varint(&p, e, &v) || v > h->ficor_sz, ERR_FILE, "%s is corrupted", ficor_file);
+        dict(i)->count = v;
+        if (counts) {
+            dict(i)->post_sz = v;
+        }
+    }
+    ERR_IF_MSG(p != e, ERR_FILE, "%s is corrupted", ficor_file);
+
+error:
+    free(buf);
+    return;
+}
+
+// decoder of the records of a VERSION_PACKED snapshot, one at a time
+typedef struct unpack_t unpack_t;
+struct unpack_t {
+    const uint8_t* p;
+    const uint8_t* e;
+    uint32_t       n;         // records in the snapshot
+    uint32_t       i;         // records decoded so far
+
+    // the last record decoded. info points into the mapping and is not NUL
+    // terminated, info_sz is its length + 1 as in ficor_t
+    uint32_t       pos;
+    char*          file;
+    uint32_t       file_sz;
+    uint64_t       file_cap;
+    uint32_t*      tag;
+    uint32_t       tag_sz;
+    uint64_t       tag_mask;
+    const char*    info;
+    uint32_t       info_sz;
+};
+
+static void unpack_init(unpack_t* u, header_t* h)
+{
+    memset(u, 0, sizeof(*u));
+    u->p   = map + h->section[SECTION_RECORDS].off;
+    u->e   = u->p + h->section[SECTION_RECORDS].sz;
+    u->n   = h->ficor_sz;
+    u->tag = malloc((dict_sz + 1) * sizeof(*u->tag));
+    ERR_IF(!u->tag, ERR_BAD_MALLOC);
+
+error:
+    return;
+}
+
+static void unpack_free(unpack_t* u)
+{
+    free(u->file);
+    free(u->tag);
+    u->file = NULL;
+    u->tag  = NULL;
+}
+
+static void unpack_next(unpack_t* u)
+{
+    uint32_t base   = u->i / PACKED_BLOCK * PACKED_BLOCK;
+    uint32_t blk    = u->n - base < PACKED_BLOCK ? u->n - base : PACKED_BLOCK;
+    uint64_t shared = 0;
+    uint64_t suffix = 0;
+    uint64_t v      = 0;
+
+    // front coding starts over with every block
+    if (u->i == base) {
+        u->file_sz = 1;
+    }
+    ERR_IF_MSG(!get_varint(&u->p, u->e, &shared) || shared >= u->file_sz
+               || !get_varint(&u->p, u->e, &suffix) || suffix > (uint64_t)(u->e - u->p)
+               || shared + suffix >= UINT32_MAX,
+               ERR_FILE, "%s is corrupted", ficor_file);
+    reserve(&u->file, &u->file_cap, shared + suffix + 1);
+    ERR_FORWARD();
+    memcpy(u->file + shared, u->p, suffix);
+    u->p       += suffix;
+    u->file_sz  = shared + suffix + 1;
+    u->file[u->file_sz - 1] = 0;
+
+    ERR_IF_MSG(!get_varint(&u->p, u->e, &v) || v >= blk, ERR_FILE, "%s is corrupted", ficor_file);
+    u->pos = base + v;
+
+    ERR_IF_MSG(!get_varint(&u->p, u->e, &v) || v > dict_sz, ERR_FILE, "%s is corrupted", ficor_file);
+    u->tag_sz   = v;
+    u->tag_mask = 0;
+    uint64_t last = 0;
+    uint32_t j    = 0;
+    for (; j < u->tag_sz; ++j) {
+        ERR_IF_MSG(!get_varint(&u->p, u->e, &v) || (j && !v) || last + v >= dict_sz,
+                   ERR_FILE, "%s is corrupted", ficor_file);
+        last         += v;
+        u->tag[j]     = last;
+        u->tag_mask  |= (uint64_t)1 << (last % 64);
+    }
+
+    ERR_IF_MSG(!get_varint(&u->p, u->e, &v) || (v && v - 1 > (uint64_t)(u->e - u->p)) || v >= UINT32_MAX,
+               ERR_FILE, "%s is corrupted", ficor_file);
+    u->info_sz = v;
+    u->info    = (const char*)u->p;
+    u->p      += v ? v - 1 : 0;
+
+    u->i += 1;
+    ERR_IF_MSG(u->i == u->n && u->p != u->e, ERR_FILE, "%s is corrupted", ficor_file);
+
+error:
+    return;
+}
+
+// decodes a VERSION_PACKED snapshot, all records end up in ficor_new and
+// the heap arena
+static void load_packed(header_t* h)
+{
+    uint64_t* seen = NULL;
+    unpack_t  u    = { 0 };
+
+    load_packed_tags(h, 0);
+    ERR_FORWARD();
+
+    uint32_t n = h->ficor_sz;
+    if (n) {
+        ficor_new     = calloc(n, sizeof(*ficor_new));
+        seen          = calloc((n + 63) / 64, sizeof(*seen));
+        ERR_IF(!ficor_new || !seen, ERR_BAD_MALLOC);
+        ficor_new_cap = n;
+        ficor_sz      = n;
+    }
+
+    unpack_init(&u, h);
+    ERR_FORWARD();
+    ERR_IF_MSG(!n && u.p != u.e, ERR_FILE, "%s is corrupted", ficor_file);
+    while (u.i < n) {
+        unpack_next(&u);
+        ERR_FORWARD();
+        ERR_IF_MSG(bit(seen, u.pos), ERR_FILE, "%s is corrupted", ficor_file);
+        seen[u.pos / 64] |= (uint64_t)1 << (u.pos % 64);
+
+        ficor_t* f  = &ficor_new[u.pos];
+        f->file_sz  = u.file_sz;
+        f->file     = heap_str(u.file, u.file_sz);
+        ERR_FORWARD();
+        f->tag_sz   = u.tag_sz;
+        f->tag_mask = u.tag_mask;
+        f->tag      = heap_alloc(u.tag_sz * sizeof(uint32_t));
+        ERR_FORWARD();
+        memcpy(tags(f), u.tag, u.tag_sz * sizeof(uint32_t));
+        if (u.info_sz) {
+            f->info_sz = u.info_sz;
+            f->info    = heap_alloc(u.info_sz);
+            ERR_FORWARD();
+            memcpy(str(f->info), u.info, u.info_sz - 1);
+            str(f->info)[u.info_sz - 1] = 0;
+        }
+    }
+
+    // indexes in record order, so posting lists are appended to
+    uint32_t i = 0;
+    for (; i < n; ++i) {
+        ficor_t* f = rec(i);
+        table_insert(&path_table, hash(str(f->file)), i);
+        ERR_FORWARD();
+
+        uint32_t*       t  = tags(f);
+        uint32_t* const te = t + f->tag_sz;
+        for (; t != te; ++t) {
+            post_push(*t, i);
+            ERR_FORWARD();
+        }
+    }
+
+error:
+    unpack_free(&u);
+    free(seen);
+    return;
+}
+
+// takes flock() on fd, retrying when a signal comes in
+static int lock_fd(int fd, int op)
+{
+    int r = 0;
+    while ((r = flock(fd, op)) < 0 && errno == EINTR) {  }
+    return r;
+}
+
+// writers hold an exclusive lock on <ficor_file>.lock from loading the
+// database until their changes are written, a daemon as long as it serves.
+// Readers never take it, so they do not wait for a slow writer. It goes away
+// with the process
+static void lock_writer(void)
+{
+    int   fd   = -1;
+    char* path = malloc(strlen(ficor_file) + sizeof(".lock"));
+    ERR_IF(!path, ERR_BAD_MALLOC);
+    sprintf(path, "%s.lock", ficor_file);
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    ERR_IF_MSG(fd < 0, ERR_FILE, "could not open file '%s': %s", path, strerror(errno));
+
+    int r = lock_fd(fd, LOCK_EX | LOCK_NB);
+    if (r < 0 && errno == EWOULDBLOCK) {
+        fprintf(stderr, "Waiting for another writer of %s\n", ficor_file);
+        r = lock_fd(fd, LOCK_EX);
+    }
+    ERR_IF_MSG(r < 0, ERR_FILE, "could not lock file '%s': %s", path, strerror(errno));
+
+    free(path);
+    return;
+
+error:
+    if (fd >= 0) close(fd);
+    free(path);
+    return;
+}
+
+// sets up the database from the mapping, whatever layout it has
+static void load_mapping(void)
+{
+    uint64_t sig;
+    memcpy(&sig, map, sizeof(sig));
+    packed = 0;
+    if (sig == SIGNATURE_LEGACY) {
+        load_legacy();
+        return;
+    }
+
+    header_t* h = (header_t*)map;
+    ERR_IF_MSG(sig != SIGNATURE || map_sz < sizeof(*h), ERR_FILE,
+               "%s is not a valid ficor file",
+               ficor_file);
+    ERR_IF_MSG(h->version != VERSION && h->version != VERSION_PACKED, ERR_FILE,
+               "%s has unsupported version %u",
+               ficor_file, h->version);
+
+    {
+        section_t* s        = h->section;
+        section_t* const se = h->section + SECTION_MAX;
+        for (; s != se; ++s) {
+            ERR_IF_MSG(s->off % 8 || s->off > map_sz || s->sz > map_sz - s->off,
+                       ERR_FILE, "%s is corrupted", ficor_file);
+        }
+    }
+    ERR_IF_MSG(h->journal > map_sz, ERR_FILE, "%s is corrupted", ficor_file);
+    ERR_IF_MSG(!check_header_ok(h, map, map_sz), ERR_FILE,
+               "%s is damaged, its header does not match its checksum. --fsck tells more", ficor_file);
+    journal_off     = h->journal;
+    journal_disk_sz = map_sz - journal_off;
+    generation      = h->generation;
+    map_clean       = list_only && !journal_disk_sz;
+
+    if (h->version == VERSION_PACKED) {
+        packed = 1;
+        uint64_t n = check_blocks(h);
+        uint64_t i = 0;
+        for (; i < n; ++i) {
+            ERR_IF_MSG(!check_block_ok(h, map, i), ERR_FILE,
+                       "%s is damaged in block %llu. --fsck tells more", ficor_file, (unsigned long long)i);
+        }
+        if (map_clean && !flag_sort) {
+            load_packed_tags(h, 1);
+            ERR_FORWARD();
+            stream = h;
+            return;
+        }
+        load_packed(h);
+        ERR_FORWARD();
+        replay_journal(map + journal_off, map + map_sz);
+        ERR_FORWARD_MSG("could not replay journal of %s", ficor_file);
+        return;
+    }
+
+    ERR_IF_MSG(h->section[SECTION_RECORDS].sz != (uint64_t)h->ficor_sz * sizeof(ficor_t)
+               || h->section[SECTION_TAGS].sz % sizeof(tag_t)
+               || h->section[SECTION_TAGS].sz / sizeof(tag_t) > UINT32_MAX
+               || !is_table(&h->section[SECTION_PATH_TABLE], h->ficor_sz)
+               || !is_table(&h->section[SECTION_TAG_TABLE],
+                            h->section[SECTION_TAGS].sz / sizeof(tag_t))
+               || h->section[SECTION_PATH_ORDER].sz != (uint64_t)h->ficor_sz * sizeof(uint32_t)
+               || h->section[SECTION_GRAMS].sz % sizeof(gram_t)
+               || h->section[SECTION_GRAM_POST].sz % sizeof(uint32_t),
+               ERR_FILE, "%s is corrupted", ficor_file);
+
+    ficor        = (ficor_t*)(map + h->section[SECTION_RECORDS].off);
+    ficor_map_sz = h->ficor_sz;
+    ficor_sz     = h->ficor_sz;
+    dict_map     = (tag_t*)(map + h->section[SECTION_TAGS].off);
+    dict_map_sz  = h->section[SECTION_TAGS].sz / sizeof(tag_t);
+    dict_sz      = dict_map_sz;
+
+    path_table.slot = (slot_t*)(map + h->section[SECTION_PATH_TABLE].off);
+    path_table.cap  = h->section[SECTION_PATH_TABLE].sz / sizeof(slot_t);
+    path_table.used = ficor_map_sz;
+    tag_table.slot  = (slot_t*)(map + h->section[SECTION_TAG_TABLE].off);
+    tag_table.cap   = h->section[SECTION_TAG_TABLE].sz / sizeof(slot_t);
+    tag_table.used  = dict_map_sz;
+    heap_map     = (char*)map + h->section[SECTION_HEAP].off;
+    heap_map_sz  = h->section[SECTION_HEAP].sz;
+    path_order   = (uint32_t*)(map + h->section[SECTION_PATH_ORDER].off);
+    gram_index    = (gram_t*)(map + h->section[SECTION_GRAMS].off);
+    gram_index_sz = h->section[SECTION_GRAMS].sz / sizeof(gram_t);
+    gram_post     = (uint32_t*)(map + h->section[SECTION_GRAM_POST].off);
+    gram_post_sz  = h->section[SECTION_GRAM_POST].sz / sizeof(uint32_t);
+
+    // the dictionary is small, the records are checked as they are used
+    ERR_IF_MSG(heap_map_sz && heap_map[heap_map_sz - 1], ERR_FILE, "%s is corrupted", ficor_file);
+    uint32_t i = 0;
+    for (; i < dict_map_sz; ++i) {
+        tag_t* t = &dict_map[i];
+        ERR_IF_MSG(!t->name_sz || !heap_has(t->name, t->name_sz, 1)
+                   || !heap_has(t->post, (uint64_t)t->post_sz * sizeof(uint32_t), sizeof(uint32_t)),
+                   ERR_FILE, "%s is corrupted", ficor_file);
+    }
+
+    replay_journal(map + journal_off, map + map_sz);
+    ERR_FORWARD_MSG("could not replay journal of %s", ficor_file);
+
+    return;
+
+error:
+    return;
+}
+
+// journal appends take the file exclusively, so the journal is read under a
+// shared lock. The snapshot itself never changes, compaction renames a new
+// file over it
+static void load_ficor(void)
+{
+    int fd = open(ficor_file, O_RDONLY | O_CLOEXEC);
+    ERR_IF_MSG(fd < 0, ERR_FILE, "could not open file '%s': %s",
+               ficor_file,
+               strerror(errno));
+    ERR_IF_MSG(lock_fd(fd, LOCK_SH) < 0, ERR_FILE, "could not lock file '%s': %s",
+               ficor_file,
+               strerror(errno));
+
+    struct stat st;
+    ERR_IF_MSG(fstat(fd, &st) < 0, ERR_FILE, "could not stat file '%s': %s",
+               ficor_file,
+               strerror(errno));
+    ERR_IF_MSG((size_t)st.st_size < sizeof(uint64_t), ERR_FILE,
+               "%s is not a valid ficor file",
+               ficor_file);
+
+    map_sz = st.st_size;
+    map    = mmap(NULL, map_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        map = NULL;
+        ERR_IF_MSG(1, ERR_FILE, "could not map file '%s': %s",
+                   ficor_file,
+                   strerror(errno));
+    }
+
+    load_mapping();
+    ERR_FORWARD();
+
+    // the mapping keeps the file open, closing would not drop the lock
+    lock_fd(fd, LOCK_UN);
+    close(fd);
+    return;
+
+error:
+    if (fd >= 0) {
+        lock_fd(fd, LOCK_UN);
+        close(fd);
+    }
+    return;
+}
+
+// checks every record of the mapping as rec_ok() and tags_ok() do and the
+// posting lists of its dictionary, for the commands that read all of them
+static void check_records(void)
+{
+    uint32_t i = 0;
+    for (; i < ficor_map_sz; ++i) {
+        ERR_IF_MSG(!rec_ok(i) || !tags_ok(rec(i)), ERR_FILE, "%s is corrupted in record %u. --fsck tells more",
+                   ficor_file, i);
+    }
+    for (i = 0; i < dict_map_sz; ++i) {
+        uint32_t*       p  = postings(i);
+        uint32_t* const pe = p + dict_map[i].post_sz;
+        for (; p != pe; ++p) {
+            ERR_IF_MSG(*p >= ficor_map_sz, ERR_FILE, "%s is corrupted in the postings of tag %u. --fsck tells more",
+                       ficor_file, i);
+        }
+    }
+
+error:
+    return;
+}
+
+static uint64_t record_heap_sz(ficor_t* f)
+{
+    return align8(f->tag_sz * sizeof(uint32_t) + f->file_sz + f->info_sz);
+}
+
+static int cmp_path(const void* a, const void* b)
+{
+    return strcmp(str(rec(*(const uint32_t*)a)->file), str(rec(*(const uint32_t*)b)->file));
+}
+
+// sorts (trigram << 32 | record) pairs by trigram with one counting pass per
+// byte. It is stable, the records of a trigram stay in order. Returns a or
+// tmp, whichever holds the result
+static uint64_t* sort_grams(uint64_t* a, uint64_t* tmp, uint64_t sz)
+{
+    uint32_t shift = 32;
+    for (; shift < 56; shift += 8) {
+        uint64_t count[257] = { 0 };
+        uint64_t i          = 0;
+        for (; i < sz; ++i) {
+            count[(a[i] >> shift & 0xff) + 1] += 1;
+        }
+        for (i = 1; i < 257; ++i) {
+            count[i] += count[i - 1];
+        }
+        for (i = 0; i < sz; ++i) {
+            tmp[count[a[i] >> shift & 0xff]++] = a[i];
+        }
+
+        uint64_t* t = a;
+        a   = tmp;
+        tmp = t;
+    }
+    return a;
+}
+
+// the trigram index over the infos of the live records, in their new
+// indices. post_sz is the number of postings of all trigrams
+static void build_grams(gram_t** index, uint64_t* index_sz, uint32_t** post, uint64_t* post_sz)
+{
+    uint64_t* pair = NULL;
+    uint64_t* tmp  = NULL;
+    uint32_t* g    = NULL;
+    uint64_t  n    = 0;
+    uint32_t  max  = 0;
+    uint32_t  i    = 0;
+
+    *index    = NULL;
+    *index_sz = 0;
+    *post     = NULL;
+    *post_sz  = 0;
+
+    // an info of info_sz - 1 bytes has at most info_sz - 3 trigrams
+    for (i = 0; i < ficor_sz; ++i) {
+        ficor_t* o = rec(i);
+        if (!(o->flags & FICOR_DEAD) && o->info_sz > 3) {
+            n  += o->info_sz - 3;
+            max = o->info_sz - 3 > max ? o->info_sz - 3 : max;
+        }
+    }
+
+    pair = malloc((n + 1) * sizeof(*pair));
+    tmp  = malloc((n + 1) * sizeof(*tmp));
+    g    = malloc(((uint64_t)max + 1) * sizeof(*g));
+    ERR_IF(!pair || !tmp || !g, ERR_BAD_MALLOC);
+
+    n = 0;
+    {
+        uint32_t r = 0;
+        for (i = 0; i < ficor_sz; ++i) {
+            ficor_t* o = rec(i);
+            if (o->flags & FICOR_DEAD) {
+                continue;
+            }
+            uint32_t k = o->info_sz > 3 ? text_grams(str(o->info), o->info_sz - 1, g) : 0;
+            uint32_t j = 0;
+            for (; j < k; ++j) {
+                pair[n++] = (uint64_t)g[j] << 32 | r;
+            }
+            r += 1;
+        }
+    }
+
+    uint64_t* sorted = sort_grams(pair, tmp, n);
+    free(sorted == pair ? tmp : pair);
+    pair = sorted;
+    tmp  = NULL;
+
+    uint64_t d = 0;
+    uint64_t j = 0;
+    for (; j < n; ++j) {
+        d += !j || pair[j] >> 32 != pair[j - 1] >> 32;
+    }
+
+    *index = malloc((d + 1) * sizeof(**index));
+    *post  = malloc((n + 1) * sizeof(**post));
+    ERR_IF(!*index || !*post, ERR_BAD_MALLOC);
+
+    for (j = 0; j < n; ++j) {
+        if (!j || pair[j] >> 32 != pair[j - 1] >> 32) {
+            (*index)[(*index_sz)++] = (gram_t){ .gram = pair[j] >> 32, .post = j };
+        }
+        (*index)[*index_sz - 1].post_sz += 1;
+        (*post)[j] = (uint32_t)pair[j];
+    }
+    *post_sz = n;
+
+    free(g);
+    free(pair);
+    return;
+
+error:
+    free(g);
+    free(tmp);
+    free(pair);
+    free(*index);
+    free(*post);
+    *index    = NULL;
+    *index_sz = 0;
+    *post     = NULL;
+    return;
+}
+
+// writes the mapped layout described by the file spec. remap holds the new
+// tag ids, count the number of live records carrying each old one
+static void write_mapped(FILE* f, uint32_t* remap, uint32_t* count, uint32_t live, uint64_t total,
+                         uint32_t used, uint64_t names_sz)
+{
+    uint32_t* post     = NULL;
+    slot_t*   paths    = NULL;
+    slot_t*   names    = NULL;
+    uint32_t* order    = NULL;
+    uint32_t* pos      = NULL;
+    gram_t*   grams    = NULL;
+    uint64_t  grams_sz = 0;
+    uint32_t* gpost    = NULL;
+    uint64_t  gpost_sz = 0;
+    uint32_t  i        = 0;
+
+    names_sz = align8(names_sz);
+
+    // posting lists in new ids, count becomes the fill position of each
+    post = malloc((total + 1) * sizeof(*post));
+    ERR_IF(!post, ERR_BAD_MALLOC);
+    {
+        uint64_t n = 0;
+        for (i = 0; i < dict_sz; ++i) {
+            uint32_t c = count[i];
+            count[i]   = n;
+            n         += c;
+        }
+
+        uint32_t r = 0;
+        for (i = 0; i < ficor_sz; ++i) {
+            ficor_t* o = rec(i);
+            if (o->flags & FICOR_DEAD) {
+                continue;
+            }
+
+            uint32_t*       t  = tags(o);
+            uint32_t* const te = t + o->tag_sz;
+            for (; t != te; ++t) {
+                post[count[*t]++] = r;
+            }
+            r += 1;
+        }
+    }
+    uint64_t post_off = names_sz;
+    uint64_t posts_sz = align8(total * sizeof(*post));
+
+    // hash tables at most half full, so the journal can add to them in place
+    uint32_t paths_cap = 16;
+    uint32_t names_cap = 16;
+    for (; paths_cap < 2 * (uint64_t)live; paths_cap *= 2) {  }
+    for (; names_cap < 2 * (uint64_t)used; names_cap *= 2) {  }
+    paths = calloc(paths_cap, sizeof(*paths));
+    names = calloc(names_cap, sizeof(*names));
+    ERR_IF(!paths || !names, ERR_BAD_MALLOC);
+    {
+        uint32_t r = 0;
+        for (i = 0; i < ficor_sz; ++i) {
+            ficor_t* o = rec(i);
+            if (!(o->flags & FICOR_DEAD)) {
+                table_put(paths, paths_cap, (slot_t){ hash(str(o->file)), ++r });
+            }
+        }
+        for (i = 0; i < dict_sz; ++i) {
+            if (remap[i] != UINT32_MAX) {
+                table_put(names, names_cap, (slot_t){ hash(tag_name(i)), remap[i] + 1 });
+            }
+        }
+    }
+
+    // new indices of the live records in path order
+    order = malloc(((uint64_t)live + 1) * sizeof(*order));
+    pos   = malloc(((uint64_t)ficor_sz + 1) * sizeof(*pos));
+    ERR_IF(!order || !pos, ERR_BAD_MALLOC);
+    {
+        uint32_t n = 0;
+        for (i = 0; i < ficor_sz; ++i) {
+            if (!(rec(i)->flags & FICOR_DEAD)) {
+                pos[i]     = n;
+                order[n++] = i;
+            }
+        }
+        qsort(order, live, sizeof(*order), cmp_path);
+        for (i = 0; i < live; ++i) {
+            order[i] = pos[order[i]];
+        }
+    }
+
+    build_grams(&grams, &grams_sz, &gpost, &gpost_sz);
+    ERR_FORWARD();
+
+    header_t h = {
+        .signature = SIGNATURE,
+        .version    = VERSION,
+        .ficor_sz   = live,
+        .generation = generation,
+    };
+    h.section[SECTION_RECORDS].off = align8(sizeof(h));
+    h.section[SECTION_RECORDS].sz  = (uint64_t)live * sizeof(ficor_t);
+    h.section[SECTION_TAGS].off    = h.section[SECTION_RECORDS].off
+                                   + h.section[SECTION_RECORDS].sz;
+    h.section[SECTION_TAGS].sz     = (uint64_t)used * sizeof(tag_t);
+    h.section[SECTION_PATH_TABLE].off = h.section[SECTION_TAGS].off
+                                      + h.section[SECTION_TAGS].sz;
+    h.section[SECTION_PATH_TABLE].sz  = (uint64_t)paths_cap * sizeof(*paths);
+    h.section[SECTION_TAG_TABLE].off  = h.section[SECTION_PATH_TABLE].off
+                                      + h.section[SECTION_PATH_TABLE].sz;
+    h.section[SECTION_TAG_TABLE].sz   = (uint64_t)names_cap * sizeof(*names);
+    h.section[SECTION_PATH_ORDER].off = h.section[SECTION_TAG_TABLE].off
+                                      + h.section[SECTION_TAG_TABLE].sz;
+    h.section[SECTION_PATH_ORDER].sz  = (uint64_t)live * sizeof(*order);
+    h.section[SECTION_GRAMS].off      = align8(h.section[SECTION_PATH_ORDER].off
+                                             + h.section[SECTION_PATH_ORDER].sz);
+    h.section[SECTION_GRAMS].sz       = grams_sz * sizeof(*grams);
+    h.section[SECTION_GRAM_POST].off  = h.section[SECTION_GRAMS].off
+                                      + h.section[SECTION_GRAMS].sz;
+    h.section[SECTION_GRAM_POST].sz   = gpost_sz * sizeof(*gpost);
+    h.section[SECTION_HEAP].off    = align8(h.section[SECTION_GRAM_POST].off
+                                            + h.section[SECTION_GRAM_POST].sz);
+
+    static const uint8_t pad[8] = { 0 };
+
+    fwrite(&h, 1, sizeof(h), f);
+    fwrite(pad, 1, h.section[SECTION_RECORDS].off - sizeof(h), f);
+
+    // records, with offsets into the new heap
+    uint64_t off = names_sz + posts_sz;
+    for (i = 0; i < ficor_sz; ++i) {
+        ficor_t* o = rec(i);
+        ficor_t  n = *o;
+        if (o->flags & FICOR_DEAD) {
+            continue;
+        }
+
+        n.tag      = off;
+        n.file     = n.tag + n.tag_sz * sizeof(uint32_t);
+        n.info     = n.info_sz ? n.file + n.file_sz : 0;
+        n.tag_mask = 0;
+        off       += record_heap_sz(o);
+
+        uint32_t*       t  = tags(o);
+        uint32_t* const te = t + o->tag_sz;
+        for (; t != te; ++t) {
+            n.tag_mask |= (uint64_t)1 << (remap[*t] % 64);
+        }
+
+        fwrite(&n, 1, sizeof(n), f);
+    }
+    h.section[SECTION_HEAP].sz = off;
+    h.journal                  = h.section[SECTION_HEAP].off + off;
+
+    // dictionary, its names and posting lists lead the heap. count[i] now
+    // is the end of the posting list of i in post
+    off = 0;
+    {
+        uint64_t p = 0;
+        for (i = 0; i < dict_sz; ++i) {
+            if (remap[i] != UINT32_MAX) {
+                tag_t t = {
+                    .name    = off,
+                    .name_sz = dict(i)->name_sz,
+                    .post    = post_off + p * sizeof(*post),
+                    .post_sz = count[i] - p,
+                    .count   = count[i] - p,
+                };
+                fwrite(&t, 1, sizeof(t), f);
+                off += t.name_sz;
+                p    = count[i];
+            }
+        }
+    }
+    fwrite(paths, sizeof(*paths), paths_cap, f);
+    fwrite(names, sizeof(*names), names_cap, f);
+    fwrite(order, sizeof(*order), live, f);
+    fwrite(pad, 1, h.section[SECTION_GRAMS].off - h.section[SECTION_PATH_ORDER].off
+                   - h.section[SECTION_PATH_ORDER].sz, f);
+    fwrite(grams, sizeof(*grams), grams_sz, f);
+    fwrite(gpost, sizeof(*gpost), gpost_sz, f);
+    fwrite(pad, 1, h.section[SECTION_HEAP].off - h.section[SECTION_GRAM_POST].off
+                   - h.section[SECTION_GRAM_POST].sz, f);
+    for (i = 0; i < dict_sz; ++i) {
+        if (remap[i] != UINT32_MAX) {
+            fwrite(tag_name(i), 1, dict(i)->name_sz, f);
+        }
+    }
+    fwrite(pad, 1, names_sz - off, f);
+    fwrite(post, sizeof(*post), total, f);
+    fwrite(pad, 1, posts_sz - total * sizeof(*post), f);
+
+    // records' part of the heap, same layout as computed above
+    for (i = 0; i < ficor_sz; ++i) {
+        ficor_t* o = rec(i);
+        if (o->flags & FICOR_DEAD) {
+            continue;
+        }
+
+        uint32_t*       t  = tags(o);
+        uint32_t* const te = t + o->tag_sz;
+        for (; t != te; ++t) {
+            fwrite(&remap[*t], 1, sizeof(*t), f);
+        }
+
+        fwrite(str(o->file), 1, o->file_sz, f);
+        if (o->info_sz) {
+            fwrite(str(o->info), 1, o->info_sz, f);
+        }
+
+        uint64_t sz = o->tag_sz * sizeof(uint32_t) + o->file_sz + o->info_sz;
+        fwrite(pad, 1, align8(sz) - sz, f);
+    }
+
+    fseek(f, 0, SEEK_SET);
+    fwrite(&h, 1, sizeof(h), f);
+
+    free(gpost);
+    free(grams);
+    free(pos);
+    free(order);
+    free(names);
+    free(paths);
+    free(post);
+    return;
+
+error:
+    free(gpost);
+    free(grams);
+    free(pos);
+    free(order);
+    free(names);
+    free(paths);
+    free(post);
+    return;
+}
+
+static void pad8(FILE* f)
+{
+    static const uint8_t pad[8] = { 0 };
+    fwrite(pad, 1, align8(ftell(f)) - ftell(f), f);
+}
+
+// writes the packed layout described by the file spec, remap holds the new
+// tag ids, count the number of live records carrying each old one
+static void write_packed(FILE* f, uint32_t* remap, uint32_t* count, uint32_t live)
+{
+    uint32_t* order = NULL;
+    uint32_t* pos   = NULL;
+
+    header_t h = {
+        .signature = SIGNATURE,
+        .version    = VERSION_PACKED,
+        .ficor_sz   = live,
+        .generation = generation,
+    };
+    fwrite(&h, 1, sizeof(h), f);
+    pad8(f);
+
+    uint32_t used = 0;
+    uint32_t i    = 0;
+    for (; i < dict_sz; ++i) {
+        used += remap[i] != UINT32_MAX;
+    }
+    h.section[SECTION_TAGS].off = ftell(f);
+    put_varint(f, used);
+    for (i = 0; i < dict_sz; ++i) {
+        if (remap[i] != UINT32_MAX) {
+            put_varint(f, dict(i)->name_sz - 1);
+            fwrite(tag_name(i), 1, dict(i)->name_sz - 1, f);
+            put_varint(f, count[i]);
+        }
+    }
+    h.section[SECTION_TAGS].sz = ftell(f) - h.section[SECTION_TAGS].off;
+    pad8(f);
+
+    // live records by path within each block, pos is their index in the new
+    // file
+    order = malloc(((uint64_t)live + 1) * sizeof(*order));
+    pos   = malloc(((uint64_t)ficor_sz + 1) * sizeof(*pos));
+    ERR_IF(!order || !pos, ERR_BAD_MALLOC);
+    {
+        uint32_t n = 0;
+        for (i = 0; i < ficor_sz; ++i) {
+            if (!(rec(i)->flags & FICOR_DEAD)) {
+                pos[i]     = n;
+                order[n++] = i;
+            }
+        }
+    }
+    for (i = 0; i < live; i += PACKED_BLOCK) {
+        qsort(order + i, live - i < PACKED_BLOCK ? live - i : PACKED_BLOCK, sizeof(*order), cmp_path);
+    }
+
+    h.section[SECTION_RECORDS].off = ftell(f);
+    const char* prev    = "";
+    uint64_t    prev_sz = 0;
+    for (i = 0; i < live; ++i) {
+        ficor_t*    o  = rec(order[i]);
+        const char* p  = str(o->file);
+        uint64_t    sz = o->file_sz - 1;
+        if (i % PACKED_BLOCK == 0) {
+            prev_sz = 0;
+        }
+
+        uint64_t shared = 0;
+        for (; shared < sz && shared < prev_sz && p[shared] == prev[shared]; ++shared) {  }
+        put_varint(f, shared);
+        put_varint(f, sz - shared);
+        fwrite(p + shared, 1, sz - shared, f);
+        put_varint(f, pos[order[i]] % PACKED_BLOCK);
+
+        put_varint(f, o->tag_sz);
+        uint32_t*       t    = tags(o);
+        uint32_t* const te   = t + o->tag_sz;
+        uint32_t        last = 0;
+        for (; t != te; ++t) {
+            put_varint(f, remap[*t] - last);
+            last = remap[*t];
+        }
+
+        put_varint(f, o->info_sz);
+        if (o->info_sz) {
+            fwrite(str(o->info), 1, o->info_sz - 1, f);
+        }
+
+        prev    = p;
+        prev_sz = sz;
+    }
+    h.section[SECTION_RECORDS].sz = ftell(f) - h.section[SECTION_RECORDS].off;
+    pad8(f);
+    h.journal = ftell(f);
+
+    fseek(f, 0, SEEK_SET);
+    fwrite(&h, 1, sizeof(h), f);
+
+error:
+    free(order);
+    free(pos);
+    return;
+}
+
+// appends the checksum table to the snapshot the writers left in f, named
+// tmp, and completes its header. The blocks are read back from the file
+static void write_checks(FILE* f, const char* tmp)
+{
+    uint32_t* table = NULL;
+    uint8_t*  buf   = NULL;
+    header_t  h;
+
+    int fd = fileno(f);
+    ERR_IF_MSG(fflush(f) || pread(fd, &h, sizeof(h), 0) != sizeof(h), ERR_FILE,
+               "could not read back file '%s': %s", tmp, strerror(errno));
+
+    h.check_block                 = CHECK_BLOCK;
+    h.section[SECTION_CHECKS].off = h.journal;
+    uint64_t n                    = check_blocks(&h);
+    h.section[SECTION_CHECKS].sz  = n * sizeof(*table);
+    h.journal                     = align8(h.section[SECTION_CHECKS].off + h.section[SECTION_CHECKS].sz);
+
+    table = malloc(n * sizeof(*table) + 1);
+    buf   = malloc(CHECK_BLOCK);
+    ERR_IF(!table || !buf, ERR_BAD_MALLOC);
+
+    uint64_t off = align8(sizeof(h));
+    uint64_t end = h.section[SECTION_CHECKS].off;
+    uint64_t i   = 0;
+    for (; i < n; ++i, off += CHECK_BLOCK) {
+        uint64_t sz = end - off < CHECK_BLOCK ? end - off : CHECK_BLOCK;
+        ERR_IF_MSG(pread(fd, buf, sz, off) != (ssize_t)sz, ERR_FILE,
+                   "could not read back file '%s': %s", tmp, strerror(errno));
+        table[i] = crc32c(0, buf, sz);
+    }
+
+    h.check = header_check(&h, table);
+    fseek(f, end, SEEK_SET);
+    fwrite(table, sizeof(*table), n, f);
+    pad8(f);
+    fseek(f, 0, SEEK_SET);
+    fwrite(&h, 1, sizeof(h), f);
+
+error:
+    free(buf);
+    free(table);
+    return;
+}
+
+// permissions of a new snapshot: those of the file it replaces, the default
+// ones for a new file
+static mode_t file_mode(void)
+{
+    struct stat st;
+    if (stat(ficor_file, &st) == 0) {
+        return st.st_mode & 07777;
+    }
+    mode_t m = umask(0);
+    umask(m);
+    return 0666 & ~m;
+}
+
+// makes a rename in the directory of ficor_file durable, file systems that
+// cannot sync directories are fine
+static void sync_dir(void)
+{
+    char* slash = strrchr(ficor_file, '/');
+    char* dir   = slash ? strndup(ficor_file, slash == ficor_file ? 1 : slash - ficor_file) : strdup(".");
+    ERR_IF(!dir, ERR_BAD_MALLOC);
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+
+error:
+    return;
+}
+
+// writes a fresh file under a unique name next to ficor_file, syncs it and
+// renames it over the old one, so readers see either of them complete. The
+// old file stays mapped until free_ficor(). Tags no live record uses are
+// dropped from the dictionary, the others keep their relative order so the
+// tag arrays stay sorted. Posting lists are rebuilt exactly
+static void save_ficor(void)
+{
+    char*     tmp   = NULL;
+    FILE*     f     = NULL;
+    uint32_t* remap = NULL;
+    uint32_t* count = NULL;
+
+    check_records();
+    ERR_FORWARD();
+
+    tmp = malloc(strlen(ficor_file) + sizeof(".XXXXXX"));
+    ERR_IF(!tmp, ERR_BAD_MALLOC);
+    sprintf(tmp, "%s.XXXXXX", ficor_file);
+
+    remap = malloc((dict_sz + 1) * sizeof(*remap));
+    count = calloc(dict_sz + 1, sizeof(*count));
+    ERR_IF(!remap || !count, ERR_BAD_MALLOC);
+    memset(remap, 0xFF, (dict_sz + 1) * sizeof(*remap));
+
+    {
+        mode_t mode = file_mode();
+        int    fd   = mkstemp(tmp);
+        ERR_IF_MSG(fd < 0, ERR_FILE, "could not create file '%s': %s", tmp, strerror(errno));
+        f = fdopen(fd, "wb");
+        if (!f) {
+            close(fd);
+            remove(tmp);
+            ERR_IF_MSG(1, ERR_FILE, "could not open file '%s': %s", tmp, strerror(errno));
+        }
+        fchmod(fd, mode);
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    uint32_t live  = 0;
+    uint64_t total = 0;
+    uint32_t i     = 0;
+    for (; i < ficor_sz; ++i) {
+        ficor_t* o = rec(i);
+        if (o->flags & FICOR_DEAD) {
+            continue;
+        }
+        live  += 1;
+        total += o->tag_sz;
+
+        uint32_t*       t  = tags(o);
+        uint32_t* const te = t + o->tag_sz;
+        for (; t != te; ++t) {
+            count[*t] += 1;
+        }
+    }
+
+    // new ids and the size of the names in front of the heap
+    uint32_t used     = 0;
+    uint64_t names_sz = 0;
+    for (i = 0; i < dict_sz; ++i) {
+        if (count[i]) {
+            remap[i]  = used++;
+            names_sz += dict(i)->name_sz;
+        }
+    }
+
+    if (packed) {
+        write_packed(f, remap, count, live);
+    } else {
+        write_mapped(f, remap, count, live, total, used, names_sz);
+    }
+    ERR_FORWARD();
+    write_checks(f, tmp);
+    ERR_FORWARD();
+
+    ERR_IF_MSG(fflush(f) || ferror(f) || fsync(fileno(f)) < 0, ERR_FILE,
+               "could not write file '%s': %s", tmp, strerror(errno));
+    fclose(f);
+    f = NULL;
+
+    if (rename(tmp, ficor_file) < 0) {
+        remove(tmp);
+        ERR_IF_MSG(1, ERR_FILE, "could not replace file '%s': %s", ficor_file, strerror(errno));
+    }
+    sync_dir();
+    ERR_FORWARD();
+
+    journal_sz      = 0;
+    journal_rewrite = 0;
+
+    free(count);
+    free(remap);
+    free(tmp);
+    return;
+
+error:
+    if (f) {
+        fclose(f);
+        remove(tmp);
+    }
+    free(count);
+    free(remap);
+    free(tmp);
+    return;
+}
+
+// splits a ':' separated list into a single allocation holding the pointers
+// and a copy of buf, buf itself is left untouched
+static void tag_array(char*** tag_array, uint32_t* tag_sz, char* buf)
+{
+    uint32_t l = strlen(buf) + 1;
+    char*    s = buf;
+    *tag_sz = 1;
+    for (; *s; ++s) {
+        *tag_sz += *s == ':';
+    }
+
+    *tag_array = malloc(*tag_sz * sizeof(**tag_array) + l);
+    ERR_IF(!*tag_array, ERR_BAD_MALLOC);
+
+    char** t  = *tag_array;
+    char** te = *tag_array + *tag_sz;
+    s = memcpy(te, buf, l);
+    for (; t != te; ++t, ++s) {
+        *t = s;
+        for (; *s && *s != ':'; ++s) {  }
+        *s = 0;
+    }
+error:
+    return;
+}
+
+// an empty tag in a ':' separated list: "", ":a", "a:" or "a::b"
+static bool has_empty_tag(const char* tag_list)
+{
+    return !*tag_list || *tag_list == ':' || tag_list[strlen(tag_list) - 1] == ':'
+        || strstr(tag_list, "::");
+}
+
+static void add_tag(char* file, char* tag_list)
+{
+    uint32_t tag_sz = 0;
+    char**   tag    = NULL;
+
+    ERR_IF_MSG(!tag_list, ERR_GENERAL, "--add-tag requires -t / --set-tag");
+    ERR_IF_MSG(has_empty_tag(tag_list), ERR_GENERAL, "empty tag in '%s'", tag_list);
+
+    uint32_t i = find_ficor(file);
+    ERR_IF_MSG(i == ficor_sz, ERR_GENERAL, "%s not found", file);
+
+    tag_array(&tag, &tag_sz, tag_list);
+    ERR_FORWARD();
+
+    set_tags(i, tag, tag_sz, NULL, 0);
+    ERR_FORWARD();
+
+    free(tag);
+    return;
+
+error:
+    free(tag);
+    return;
+}
+
+static void rm_tag(char* file, char* tag_list)
+{
+    uint32_t tag_sz = 0;
+    char**   tag    = NULL;
+
+    ERR_IF_MSG(!tag_list, ERR_GENERAL, "--rm-tag requires -t to work");
+    ERR_IF_MSG(has_empty_tag(tag_list), ERR_GENERAL, "empty tag in '%s'", tag_list);
+    tag_array(&tag, &tag_sz, tag_list);
+    ERR_FORWARD();
+
+    uint32_t i = find_ficor(file);
+    ERR_IF_MSG(i == ficor_sz, ERR_GENERAL, "could not find decorator for file: %s", file);
+
+    set_tags(i, NULL, 0, tag, tag_sz);
+    ERR_FORWARD();
+
+    free(tag);
+    return;
+
+error:
+    free(tag);
+    return;
+}
+
+static void rm_file(char* file)
+{
+    slot_t* s = table_find(&path_table, hash(file), file, path_key);
+    ERR_IF_MSG(!s || !s->id, ERR_GENERAL, "could not remove %s: no such file in ficor", file);
+
+    ficor_t* f = rec(s->id - 1);
+    ERR_IF_MSG(!tags_ok(f), ERR_FILE, "%s is corrupted. --fsck tells more", ficor_file);
+    rec_edit(s->id - 1);
+    ERR_FORWARD();
+    table_remove(&path_table, s);
+
+    uint32_t*       t  = tags(f);
+    uint32_t* const te = t + f->tag_sz;
+    for (; t != te; ++t) {
+        dict(*t)->count -= 1;
+    }
+
+    heap_free(f->file, f->file_sz);
+    heap_free(f->info, f->info_sz);
+    heap_free(f->tag, (uint64_t)f->tag_sz * sizeof(uint32_t));
+    memset(f, 0, sizeof(*f));
+    f->flags = FICOR_DEAD;
+
+    return;
+error:
+    return;
+}
+
+static void add_file(char* file, char* tag_list, char* info)
+{
+    uint32_t tag_sz = 0;
+    char**   tag    = NULL;
+
+    ERR_IF_MSG(tag_list && has_empty_tag(tag_list), ERR_GENERAL, "empty tag in '%s'", tag_list);
+    ERR_IF_MSG(find_ficor(file) != ficor_sz, ERR_GENERAL, "%s is already in ficor", file);
+
+    ficor_t* f = push_ficor();
+    ERR_FORWARD();
+
+    f->file_sz = strlen(file) + 1;
+    f->file    = heap_str(file, f->file_sz);
+    ERR_FORWARD();
+
+    table_insert(&path_table, hash(file), ficor_sz - 1);
+    ERR_FORWARD();
+
+    if (tag_list) {
+        tag_array(&tag, &tag_sz, tag_list);
+        ERR_FORWARD();
+        set_tags(ficor_sz - 1, tag, tag_sz, NULL, 0);
+        ERR_FORWARD();
+    }
+
+    if (info) {
+        f->info_sz = strlen(info) + 1;
+        f->info    = heap_str(info, f->info_sz);
+        ERR_FORWARD();
+    }
+
+    free(tag);
+    return;
+
+error:
+    free(tag);
+    return;
+}
+
+// replaces the info of file, NULL removes it. A record in the mapping goes to
+// info_edit, the trigram index no longer covers it
+static void set_info(char* file, char* info)
+{
+    uint32_t i = find_ficor(file);
+    ERR_IF_MSG(i == ficor_sz, ERR_GENERAL, "%s not found", file);
+
+    if (i < ficor_map_sz) {
+        if (info_edit_sz == info_edit_cap) {
+            uint32_t  cap = info_edit_cap ? info_edit_cap * 2 : 64;
+            uint32_t* n   = realloc(info_edit, cap * sizeof(*n));
+            ERR_IF(!n, ERR_BAD_MALLOC);
+            info_edit     = n;
+            info_edit_cap = cap;
+        }
+        info_edit[info_edit_sz++] = i;
+        rec_edit(i);
+        ERR_FORWARD();
+    }
+
+    ficor_t* f = rec(i);
+    heap_free(f->info, f->info_sz);
+    f->info    = 0;
+    f->info_sz = 0;
+    if (info) {
+        f->info_sz = strlen(info) + 1;
+        f->info    = heap_str(info, f->info_sz);
+        ERR_FORWARD();
+    }
+
+error:
+    return;
+}
+
+// queue an entry for commit_ficor()
+static void journal_push(journal_op_t op, char* a, char* b, char* c)
+{
+    char*    argv[] = { a, b, c };
+    uint32_t sz     = 2 * sizeof(uint32_t);  // crc, op
+    uint32_t i      = 0;
+    for (; i < journal_argc[op]; ++i) {
+        sz += 1 + (argv[i] ? strlen(argv[i]) + 1 : 0);
+    }
+
+    if (journal_sz + sizeof(sz) + sz > journal_cap) {
+        uint64_t cap = journal_cap ? journal_cap * 2 : 4096;
+        for (; cap < journal_sz + sizeof(sz) + sz; cap *= 2) {  }
+        char* j = realloc(journal, cap);
+        ERR_IF(!j, ERR_BAD_MALLOC);
+        journal     = j;
+        journal_cap = cap;
+    }
+
+    uint32_t o   = op;
+    char*    p   = journal + journal_sz;
+    char*    sum = p + sizeof(sz);
+    memcpy(p, &sz, sizeof(sz));
+    p += sizeof(sz) + sizeof(uint32_t);
+    memcpy(p, &o, sizeof(o));
+    p += sizeof(o);
+    for (i = 0; i < journal_argc[op]; ++i) {
+        *p++ = argv[i] != NULL;
+        if (argv[i]) {
+            uint32_t l = strlen(argv[i]) + 1;
+            memcpy(p, argv[i], l);
+            p += l;
+        }
+    }
+    uint32_t check = crc32c(0, sum + sizeof(check), sz - sizeof(check));
+    memcpy(sum, &check, sizeof(check));
+    journal_sz += sizeof(sz) + sz;
+
+error:
+    return;
+}
+
+// every op takes a file first
+static void apply(journal_op_t op, char* a, char* b, char* c)
+{
+    ERR_IF_MSG(!a || !*a, ERR_GENERAL, "%s needs a file name", journal_name[op]);
+
+    switch (op) {
+    case JOURNAL_ADD_FILE:
+        add_file(a, b, c);
+        break;
+    case JOURNAL_RM_FILE:
+        rm_file(a);
+        break;
+    case JOURNAL_ADD_TAG:
+        add_tag(a, b);
+        break;
+    case JOURNAL_RM_TAG:
+        rm_tag(a, b);
+        break;
+    case JOURNAL_SET_INFO:
+        set_info(a, b);
+        break;
+    case JOURNAL_MAX:
+        break;
+    }
+
+error:
+    return;
+}
+
+// applies a mutation and queues it for commit_ficor()
+static void mutate(journal_op_t op, char* a, char* b, char* c)
+{
+    apply(op, a, b, c);
+    ERR_FORWARD();
+    journal_push(op, a, b, c);
+    ERR_FORWARD();
+    generation += 1;
+
+error:
+    return;
+}
+
+// parses the entry at p, before e, into op and argv. Returns its size, 0 if
+// it is torn or damaged
+static uint64_t journal_entry(uint8_t* p, uint8_t* const e, uint32_t* op, char* argv[3])
+{
+    uint32_t sz    = 0;
+    uint32_t check = 0;
+    if ((uint64_t)(e - p) < sizeof(sz) + sizeof(check) + sizeof(*op)) {
+        return 0;
+    }
+    memcpy(&sz, p, sizeof(sz));
+    memcpy(&check, p + sizeof(sz), sizeof(check));
+    memcpy(op, p + sizeof(sz) + sizeof(check), sizeof(*op));
+    if (sz < sizeof(check) + sizeof(*op) || sz > (uint64_t)(e - p) - sizeof(sz)
+        || *op == 0 || *op >= JOURNAL_MAX
+        || crc32c(0, p + sizeof(sz) + sizeof(check), sz - sizeof(check)) != check) {
+        return 0;
+    }
+
+    char*       a  = (char*)p + sizeof(sz) + sizeof(check) + sizeof(*op);
+    char* const ae = (char*)p + sizeof(sz) + sz;
+    uint32_t    i  = 0;
+    argv[0] = argv[1] = argv[2] = NULL;
+    for (; i < journal_argc[*op]; ++i) {
+        if (a == ae || (uint8_t)*a > 1) {
+            return 0;
+        }
+        if (!*a++) {
+            continue;
+        }
+        argv[i] = a;
+        for (; a != ae && *a; ++a) {  }
+        if (a == ae) {
+            return 0;
+        }
+        a += 1;
+    }
+    return a == ae ? sizeof(sz) + sz : 0;
+}
+
+// applies the journal in [p, e), a torn or damaged tail is dropped and the
+// next commit rewrites the snapshot so it does not stay in the file. So is
+// an entry that fails, the others still apply
+static void replay_journal(uint8_t* p, uint8_t* const e)
+{
+    uint8_t* const b = p;
+    while (p != e) {
+        char*    argv[3];
+        uint32_t op = 0;
+        uint64_t sz = journal_entry(p, e, &op, argv);
+        if (!sz) {
+            break;
+        }
+
+        apply(op, argv[0], argv[1], argv[2]);
+        if (error == ERR_BAD_MALLOC) {
+            goto error;
+        }
+        if (error != ERR_OK) {
+            fprintf(stderr, "Warning: skipping %s at byte %llu of the journal of %s, additional output above\n",
+                    journal_name[op], (unsigned long long)(p - b), ficor_file);
+            error           = ERR_OK;
+            journal_rewrite = 1;
+        }
+
+        generation += 1;
+        p          += sz;
+    }
+
+    if (p != e) {
+        fprintf(stderr, "Warning: dropping damaged journal tail of %s\n", ficor_file);
+        journal_rewrite = 1;
+    }
+    return;
+
+error:
+    return;
+}
+
+// the journal has grown past the compaction threshold, or is damaged
+static bool want_compact(void)
+{
+    uint64_t snapshot = journal_off;
+    uint64_t total    = journal_disk_sz + journal_sz;
+    return journal_rewrite || (total > COMPACT_MIN_SZ && total > snapshot / COMPACT_RATIO);
+}
+
+static void append_journal(void)
+{
+    int fd = open(ficor_file, O_WRONLY | O_APPEND | O_CLOEXEC);
+    ERR_IF_MSG(fd < 0, ERR_FILE, "could not open file '%s': %s", ficor_file, strerror(errno));
+
+    // readers take it shared while they read the journal
+    ERR_IF_MSG(lock_fd(fd, LOCK_EX) < 0, ERR_FILE, "could not lock file '%s': %s", ficor_file, strerror(errno));
+
+    // one write, so a crash leaves at most a torn last entry
+    ERR_IF_MSG(write(fd, journal, journal_sz) != (ssize_t)journal_sz, ERR_FILE,
+               "could not append to '%s': %s", ficor_file, strerror(errno));
+
+    close(fd);
+    journal_disk_sz += journal_sz;
+    journal_sz       = 0;
+    return;
+
+error:
+    if (fd >= 0) close(fd);
+    return;
+}
+
+// writes the queued journal entries, or a new snapshot once the journal has
+// grown past the compaction threshold
+static void commit_ficor(void)
+{
+    if (!journal_sz && !flag_compact) {
+        return;
+    }
+
+    if (flag_compact || want_compact()) {
+        save_ficor();
+    } else {
+        append_journal();
+    }
+}
+
+// runs the commands of path against the loaded database, one per line (or
+// NUL terminated with --null), fields separated by tabs:
+//
+//     add-file <file> [<tags> [<info>]]
+//     rm-file  <file>
+//     add-tag  <file> <tags>
+//     rm-tag   <file> <tags>
+//     set-info <file> [<info>]
+//
+// empty lines and lines starting with '#' are skipped. A failing command is
+// reported with its line number and does not stop the batch, the number of
+// failed commands is returned
+static uint32_t batch(char* path)
+{
+    uint32_t failed = 0;
+    char*    line   = NULL;
+    size_t   cap    = 0;
+    uint32_t n      = 0;
+
+    FILE* f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    ERR_IF_MSG(!f, ERR_FILE, "could not open file '%s': %s", path, strerror(errno));
+
+    int     delim = flag_null ? 0 : '\n';
+    ssize_t l     = 0;
+    while ((l = getdelim(&line, &cap, delim, f)) > 0) {
+        n += 1;
+        l -= line[l - 1] == delim;
+        l -= !flag_null && l && line[l - 1] == '\r';
+        line[l] = 0;
+        if (!l || *line == '#') {
+            continue;
+        }
+
+        char*    field[4] = { NULL, NULL, NULL, NULL };
+        uint32_t field_sz = 0;
+        char*    s        = line;
+        for (; s && field_sz < 4; ++field_sz) {
+            field[field_sz] = s;
+            s = strchr(s, '\t');
+            if (s) {
+                *s++ = 0;
+            }
+        }
+
+        uint32_t i = 1;
+        for (; i < 4; ++i) {
+            if (field[i] && !*field[i]) {
+                field[i] = NULL;
+            }
+        }
+
+        journal_op_t op = 1;
+        for (; op < JOURNAL_MAX && strcmp(field[0], journal_name[op]) != 0; ++op) {  }
+
+        if (op == JOURNAL_MAX || s || !field[1] || field_sz > journal_argc[op] + 1) {
+            fprintf(stderr, "Error: %s:%u: malformed command '%s'\n", path, n, field[0]);
+            failed += 1;
+            continue;
+        }
+
+        mutate(op, field[1], field[2], field[3]);
+        if (error == ERR_BAD_MALLOC) {
+            goto error;
+        }
+        if (error != ERR_OK) {
+            fprintf(stderr, "Error: %s:%u: %s failed, additional output above\n",
+                    path, n, journal_name[op]);
+            error   = ERR_OK;
+            failed += 1;
+        }
+    }
+
+    if (f != stdin) {
+        fclose(f);
+    }
+    free(line);
+    return failed;
+
+error:
+    if (f && f != stdin) {
+        fclose(f);
+    }
+    free(line);
+    return failed;
+}
+
+// applies --format to the next snapshot
+static void set_format(void)
+{
+    ERR_IF_MSG(strcmp(flag_format, "mapped") && strcmp(flag_format, "packed"), ERR_GENERAL,
+               "unknown format '%s', expected 'mapped' or 'packed'", flag_format);
+    packed = strcmp(flag_format, "packed") == 0;
+
+error:
+    return;
+}
+
+void init(void)
+{
+    if (flag_format) {
+        set_format();
+        ERR_FORWARD();
+    }
+    generation = new_generation();
+    save_ficor();
+
+error:
+    return;
+}
+
+void dump(void)
+{
+    uint32_t i = 0;
+    for (; i < ficor_sz; ++i) {
+        ficor_t* f = rec(i);
+        if (f->flags & FICOR_DEAD) {
+            continue;
+        }
+        out_str(&out, "Name:\n\t");
+        out_write(&out, str(f->file), f->file_sz - 1);
+        out_str(&out, "\nInfo:\n");
+        if (f->info_sz) {
+            out_char(&out, '\t');
+            out_write(&out, str(f->info), f->info_sz - 1);
+            out_char(&out, '\n');
+        }
+        out_str(&out, "Tags:\n");
+
+        uint32_t* t        = tags(f);
+        uint32_t* const te = t + f->tag_sz;
+        for (; t != te; ++t) {
+            out_char(&out, '\t');
+            out_write(&out, tag_name(*t), dict(*t)->name_sz - 1);
+            out_char(&out, '\n');
+        }
+        out_char(&out, '\n');
+    }
+}
+
+// resolves the ':' separated include and exclude lists against the dictionary
+static void filter_include(filter_t* q, uint32_t id)
+{
+    if (!bit(q->include, id)) {
+        q->include[id / 64] |= (uint64_t)1 << (id % 64);
+        q->include_mask     |= (uint64_t)1 << (id % 64);
+        q->include_id[q->include_sz++] = id;
+    }
+}
+
+static void filter_exclude(filter_t* q, uint32_t id)
+{
+    q->exclude[id / 64] |= (uint64_t)1 << (id % 64);
+    q->exclude_mask     |= (uint64_t)1 << (id % 64);
+}
+
+// resolves a query tag, selectivity is the share of live records carrying it
+static uint32_t query_tag(const char* name, double* p)
+{
+    uint32_t id = find_dict((char*)name);
+    if (id == dict_sz) {
+        return QUERY_UNKNOWN;
+    }
+    uint32_t n = stream ? stream->ficor_sz : path_table.used;
+    *p = n ? (double)dict(id)->count / n : 0;
+    return id;
+}
+
+// splits --search at white space into q->word, and collects their trigrams
+static void filter_words(filter_t* q, char* search)
+{
+    static const char* const space = " \t\n\v\f\r";
+
+    uint32_t l = strlen(search) + 1;
+    char*    s = search + strspn(search, space);
+    while (*s) {
+        q->word_sz += 1;
+        s          += strcspn(s, space);
+        s          += strspn(s, space);
+    }
+    ERR_IF_MSG(!q->word_sz, ERR_GENERAL, "--search expects some text");
+
+    q->word      = malloc(q->word_sz * sizeof(*q->word) + l);
+    q->word_gram = malloc(l * sizeof(*q->word_gram));
+    ERR_IF(!q->word || !q->word_gram, ERR_BAD_MALLOC);
+
+    char**    w = q->word;
+    uint32_t* g = q->word_gram;
+    s = memcpy(q->word + q->word_sz, search, l);
+    for (s += strspn(s, space); *s; s += strspn(s, space)) {
+        size_t sz = strcspn(s, space);
+        *w++ = s;
+        g   += text_grams(s, sz, g);
+        s   += sz;
+        if (*s) {
+            *s++ = 0;
+        }
+    }
+
+    q->word_gram_sz = g - q->word_gram;
+    qsort(q->word_gram, q->word_gram_sz, sizeof(*q->word_gram), cmp_id);
+    uint32_t* o = q->word_gram;
+    uint32_t  i = 0;
+    for (; i < q->word_gram_sz; ++i) {
+        if (o == q->word_gram || o[-1] != q->word_gram[i]) {
+            *o++ = q->word_gram[i];
+        }
+    }
+    q->word_gram_sz = o - q->word_gram;
+
+error:
+    return;
+}
+
+static void filter_init(filter_t* q, char* include, char* exclude, char* query, char* under, char* glob,
+                        char* search)
+{
+    char**   tag    = NULL;
+    uint32_t tag_sz = 0;
+    uint32_t words  = (dict_sz + 63) / 64;
+
+    memset(q, 0, sizeof(*q));
+    q->include = calloc(2 * words + 1, sizeof(*q->include));
+    ERR_IF(!q->include, ERR_BAD_MALLOC);
+    q->exclude = q->include + words;
+
+    // "/" stays, any other directory gets a single trailing '/'
+    if (under) {
+        size_t sz = strlen(under);
+        ERR_IF_MSG(!sz, ERR_GENERAL, "--under expects a directory");
+        for (; sz > 1 && under[sz - 1] == '/'; --sz) {  }
+        q->under = malloc(sz + 2);
+        ERR_IF(!q->under, ERR_BAD_MALLOC);
+        memcpy(q->under, under, sz);
+        q->under[sz]  = '/';
+        q->under_sz   = sz + (under[sz - 1] != '/');
+        q->under[q->under_sz] = 0;
+    }
+    if (glob) {
+        q->glob    = glob;
+        q->glob_sz = strcspn(glob, "*?[\\");
+    }
+    if (search) {
+        filter_words(q, search);
+        ERR_FORWARD();
+    }
+
+    if (query) {
+        int e = query_parse(&q->query, query);
+        ERR_IF(e == -2, ERR_BAD_MALLOC);
+        ERR_IF_MSG(e, ERR_GENERAL, "in query: %s at '%s'", q->query.error, q->query.error_at);
+        ERR_IF(query_plan(&q->query, query_tag) < 0, ERR_BAD_MALLOC);
+        q->empty = q->query.never;
+    }
+
+    if (include) {
+        tag_array(&tag, &tag_sz, include);
+        ERR_FORWARD();
+    }
+
+    q->include_id = malloc((tag_sz + q->query.must_sz + 1) * sizeof(*q->include_id));
+    ERR_IF(!q->include_id, ERR_BAD_MALLOC);
+
+    char**       t  = tag;
+    char** const te = tag + tag_sz;
+    for (; t != te; ++t) {
+        uint32_t id = find_dict(*t);
+        if (id == dict_sz) {
+            q->empty = 1;
+        } else {
+            filter_include(q, id);
+        }
+    }
+    free(tag);
+    tag = NULL;
+
+    uint32_t i = 0;
+    for (; i < q->query.must_sz; ++i) {
+        filter_include(q, q->query.must[i]);
+    }
+    for (i = 0; i < q->query.must_not_sz; ++i) {
+        filter_exclude(q, q->query.must_not[i]);
+    }
+
+    if (exclude) {
+        tag_array(&tag, &tag_sz, exclude);
+        ERR_FORWARD();
+
+        for (t = tag; t != tag + tag_sz; ++t) {
+            uint32_t id = find_dict(*t);
+            if (id != dict_sz) {
+                filter_exclude(q, id);
+            }
+        }
+        free(tag);
+        tag = NULL;
+    }
+
+    return;
+
+error:
+    free(tag);
+    return;
+}
+
+static void filter_free(filter_t* q)
+{
+    free(q->include);
+    free(q->include_id);
+    free(q->under);
+    free(q->word);
+    free(q->word_gram);
+    query_free(&q->query);
+    q->include    = NULL;
+    q->exclude    = NULL;
+    q->include_id = NULL;
+    q->under      = NULL;
+    q->word       = NULL;
+    q->word_gram  = NULL;
+}
+
+static bool filter_match_tags(filter_t* q, uint32_t* t, uint32_t sz, uint64_t mask)
+{
+    if (q->empty || (mask & q->include_mask) != q->include_mask) {
+        return 0;
+    }
+    if ((q->include_sz || (mask & q->exclude_mask))
+        && match_tags(q->include, q->exclude, t, sz) != q->include_sz) {
+        return 0;
+    }
+    return !q->query.op_sz || query_run(&q->query, t, sz, mask);
+}
+
+static bool filter_match_path(filter_t* q, const char* path)
+{
+    return (!q->under || strncmp(path, q->under, q->under_sz) == 0)
+        && (!q->glob || fnmatch(q->glob, path, FNM_PATHNAME) == 0);
+}
+
+// info_sz counts a NUL as in ficor_t, info need not have one
+static bool filter_match_info(filter_t* q, const char* info, uint32_t info_sz)
+{
+    uint32_t i = 0;
+    for (; i < q->word_sz; ++i) {
+        if (!info_sz || !text_find(info, info_sz - 1, q->word[i], strlen(q->word[i]))) {
             return 0;
         }
     }
-    return 1;
+    return 1;
+}
+
+// record i passed rec_ok() and the tag ids q looks up, if any, tags_ok()
+static bool filter_ok(filter_t* q, uint32_t i)
+{
+    return rec_ok(i) && (!(q->include_sz || q->exclude_mask) || tags_ok(rec(i)));
+}
+
+static bool filter_match(filter_t* q, ficor_t* f)
+{
+    return filter_match_tags(q, tags(f), f->tag_sz, f->tag_mask)
+        && filter_match_path(q, str(f->file))
+        && filter_match_info(q, str(f->info), f->info_sz);
+}
+
+static bool in_sorted(uint32_t* a, uint32_t sz, uint32_t v)
+{
+    while (sz) {
+        uint32_t h = sz / 2;
+        if (a[h] < v) {
+            a  += h + 1;
+            sz -= h + 1;
+        } else if (a[h] > v) {
+            sz = h;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static bool in_postings(uint32_t id, uint32_t i)
+{
+    return in_sorted(postings(id), dict(id)->post_sz, i)
+        || (id < post_new_sz && in_sorted(post_added(id), post_new[id].sz, i));
+}
+
+static int cmp_post_sz(const void* a, const void* b)
+{
+    uint32_t x = post_sz(*(const uint32_t*)a);
+    uint32_t y = post_sz(*(const uint32_t*)b);
+    return (x > y) - (x < y);
+}
+
+// the path at k of path_order. A record removed since the snapshot has lost
+// its path, it sorts like the next one alive, or after all of them (NULL)
+static const char* order_path(uint32_t k)
+{
+    for (; k < ficor_map_sz; ++k) {
+        uint32_t i = path_order[k];
+        if (i < ficor_map_sz && rec_ok(i) && !(ficor[i].flags & FICOR_DEAD)) {
+            return str(ficor[i].file);
+        }
+    }
+    return NULL;
+}
+
+// narrows [*lo, *hi) of path_order to the paths starting with the sz bytes of
+// prefix, two binary searches. Removed records may stay in the range, they
+// are no candidates anyway
+static void path_range(const char* prefix, uint32_t sz, uint32_t* lo, uint32_t* hi)
+{
+    uint32_t a = *lo;
+    uint32_t b = *hi;
+    while (a < b) {
+        uint32_t    m = a + (b - a) / 2;
+        const char* p = order_path(m);
+        if (p && strncmp(p, prefix, sz) < 0) {
+            a = m + 1;
+        } else {
+            b = m;
+        }
+    }
+    *lo = a;
+
+    b = *hi;
+    while (a < b) {
+        uint32_t    m = a + (b - a) / 2;
+        const char* p = order_path(m);
+        if (p && strncmp(p, prefix, sz) <= 0) {
+            a = m + 1;
+        } else {
+            b = m;
+        }
+    }
+    *hi = a;
+}
+
+// the records of path_order[lo, hi) in record order, followed by all records
+// added since the snapshot. A superset of the matches as for candidates()
+static uint32_t* path_candidates(uint32_t lo, uint32_t hi, uint32_t* sz)
+{
+    uint32_t* c = malloc(((uint64_t)hi - lo + ficor_sz - ficor_map_sz + 1) * sizeof(*c));
+    ERR_IF(!c, ERR_BAD_MALLOC);
+
+    *sz = 0;
+    for (; lo < hi; ++lo) {
+        if (path_order[lo] < ficor_map_sz) {
+            c[(*sz)++] = path_order[lo];
+        }
+    }
+    qsort(c, *sz, sizeof(*c), cmp_id);
+
+    uint32_t i = ficor_map_sz;
+    for (; i < ficor_sz; ++i) {
+        c[(*sz)++] = i;
+    }
+    return c;
+
+error:
+    *sz = 0;
+    return NULL;
+}
+
+// the index entry of trigram g, NULL if no info in the mapping has it
+static gram_t* find_gram(uint32_t g)
+{
+    gram_t*  a  = gram_index;
+    uint64_t sz = gram_index_sz;
+    while (sz) {
+        uint64_t h = sz / 2;
+        if (a[h].gram < g) {
+            a  += h + 1;
+            sz -= h + 1;
+        } else if (a[h].gram > g) {
+            sz = h;
+        } else {
+            return &a[h];
+        }
+    }
+    return NULL;
+}
+
+// the size of the smallest trigram posting list of the --search words,
+// UINT32_MAX without index or trigrams
+static uint32_t text_rare(filter_t* q)
+{
+    uint32_t rare = UINT32_MAX;
+    uint32_t i    = 0;
+    for (; gram_index && i < q->word_gram_sz; ++i) {
+        gram_t* g = find_gram(q->word_gram[i]);
+        rare = !g ? 0 : g->post_sz < rare ? g->post_sz : rare;
+    }
+    return rare;
+}
+
+static int cmp_gram_sz(const void* a, const void* b)
+{
+    uint32_t x = (*(gram_t* const*)a)->post_sz;
+    uint32_t y = (*(gram_t* const*)b)->post_sz;
+    return (x > y) - (x < y);
+}
+
+// intersects the trigram posting lists of the --search words, smallest
+// first, and adds the records the index does not cover. Sorted, a superset
+// of the matches as for candidates()
+static uint32_t* text_candidates(filter_t* q, uint32_t* sz)
+{
+    uint32_t* c = NULL;
+    gram_t**  g = malloc((q->word_gram_sz + 1) * sizeof(*g));
+    ERR_IF(!g, ERR_BAD_MALLOC);
+
+    uint32_t g_sz = 0;
+    uint32_t i    = 0;
+    for (; i < q->word_gram_sz; ++i) {
+        gram_t* e = find_gram(q->word_gram[i]);
+        ERR_IF_MSG(e && (e->post > gram_post_sz || e->post_sz > gram_post_sz - e->post),
+                   ERR_FILE, "%s is corrupted", ficor_file);
+        if (!e) {
+            g_sz = 0;
+            break;
+        }
+        g[g_sz++] = e;
+    }
+    qsort(g, g_sz, sizeof(*g), cmp_gram_sz);
+
+    uint64_t first = g_sz ? g[0]->post_sz : 0;
+    c = malloc((first + info_edit_sz + ficor_sz - ficor_map_sz + 1) * sizeof(*c));
+    ERR_IF(!c, ERR_BAD_MALLOC);
+
+    *sz = 0;
+    for (i = 0; i < first; ++i) {
+        uint32_t r = gram_post[g[0]->post + i];
+        if (r < ficor_map_sz) {
+            c[(*sz)++] = r;
+        }
+    }
+    // lists of similar size are merged, a much longer one is searched
+    for (i = 1; i < g_sz && *sz; ++i) {
+        uint32_t*       p     = gram_post + g[i]->post;
+        uint32_t* const pe    = p + g[i]->post_sz;
+        uint32_t*       o     = c;
+        uint32_t        j     = 0;
+        bool            merge = g[i]->post_sz / 16 < *sz;
+        for (; j < *sz; ++j) {
+            for (; merge && p != pe && *p < c[j]; ++p) {  }
+            if (merge ? p != pe && *p == c[j] : in_sorted(p, g[i]->post_sz, c[j])) {
+                *o++ = c[j];
+            }
+        }
+        *sz = o - c;
+    }
+
+    // edited infos may have any trigram now
+    if (info_edit_sz) {
+        memcpy(c + *sz, info_edit, info_edit_sz * sizeof(*c));
+        *sz += info_edit_sz;
+        qsort(c, *sz, sizeof(*c), cmp_id);
+        uint32_t* o = c;
+        for (i = 0; i < *sz; ++i) {
+            if (o == c || o[-1] != c[i]) {
+                *o++ = c[i];
+            }
+        }
+        *sz = o - c;
+    }
+
+    for (i = ficor_map_sz; i < ficor_sz; ++i) {
+        c[(*sz)++] = i;
+    }
+
+    free(g);
+    return c;
+
+error:
+    free(g);
+    free(c);
+    *sz = 0;
+    return NULL;
+}
+
+// merges the mapped posting list of id and its additions into c, which has
+// room for post_sz(id) entries. Returns how many there are
+static uint32_t post_merge(uint32_t id, uint32_t* c)
+{
+    uint32_t*       a  = postings(id);
+    uint32_t* const ae = a + dict(id)->post_sz;
+    uint32_t*       b  = post_added(id);
+    uint32_t* const be = b + (id < post_new_sz ? post_new[id].sz : 0);
+    uint32_t        sz = 0;
+    while (a != ae || b != be) {
+        uint32_t v = a == ae || (b != be && *b < *a) ? *b : *a;
+        for (; a != ae && *a == v; ++a) {  }
+        for (; b != be && *b == v; ++b) {  }
+        c[sz++] = v;
+    }
+    return sz;
+}
+
+// intersects the posting lists of the include tags, smallest first. The
+// result is sorted and a superset of the matches, filter_match() decides
+static uint32_t* candidates(filter_t* q, uint32_t* sz)
+{
+    qsort(q->include_id, q->include_sz, sizeof(*q->include_id), cmp_post_sz);
+
+    uint32_t  id = q->include_id[0];
+    uint32_t* c  = malloc((post_sz(id) + 1) * sizeof(*c));
+    ERR_IF(!c, ERR_BAD_MALLOC);
+    *sz = post_merge(id, c);
+
+    uint32_t* t        = q->include_id + 1;
+    uint32_t* const te = q->include_id + q->include_sz;
+    for (; t != te && *sz; ++t) {
+        uint32_t* o = c;
+        uint32_t  j = 0;
+        for (; j < *sz; ++j) {
+            if (in_postings(*t, c[j])) {
+                *o++ = c[j];
+            }
+        }
+        *sz = o - c;
+    }
+
+    return c;
+
+error:
+    *sz = 0;
+    return NULL;
+}
+
+// --across: the directory of the database listed, it goes in front of
+// relative paths
+static const char* qualify    = NULL;
+static size_t      qualify_sz = 0;
+
+// one record per line, or NUL terminated with --null. Sizes count the NUL
+// as in ficor_t, the strings need not have one
+static void print_record(const char* file, uint32_t file_sz, const char* info, uint32_t info_sz,
+                         uint32_t* tag, uint32_t tag_sz)
+{
+    printed += 1;
+    if (qualify && *file != '/') {
+        out_write(&out, qualify, qualify_sz);
+        out_char(&out, '/');
+    }
+    out_write(&out, file, file_sz - 1);
+    if (flag_info && info_sz) {
+        out_char(&out, ' ');
+        out_write(&out, info, info_sz - 1);
+    }
+    if (flag_tags && tag_sz) {
+        uint32_t* t  = tag;
+        uint32_t* te = t + tag_sz;
+        char      c  = ' ';
+        for (; t != te; ++t, c = ':') {
+            out_char(&out, c);
+            out_write(&out, tag_name(*t), dict(*t)->name_sz - 1);
+        }
+    }
+    out_char(&out, flag_null ? 0 : '\n');
+}
+
+static void print_ficor(ficor_t* f)
+{
+    ERR_IF_MSG(flag_tags && !tags_ok(f), ERR_FILE, "%s is corrupted. --fsck tells more", ficor_file);
+    print_record(str(f->file), f->file_sz, str(f->info), f->info_sz, tags(f), f->tag_sz);
+
+error:
+    return;
+}
+
+static void get(char* file)
+{
+    uint32_t i = find_ficor(file);
+    ERR_IF_MSG(i == ficor_sz, ERR_GENERAL, "%s not found", file);
+    print_ficor(rec(i));
+
+error:
+    return;
+}
+
+// --offset, --limit and --sort. Matches are numbered in the order they are
+// listed and those in [page_lo, page_hi) are printed. In record order, and
+// by path where path_order has them sorted already, listing stops once the
+// page is complete. Otherwise the first page_hi matches are kept in a
+// bounded heap (top, the last of them on top) and sorted when all are seen
+
+enum { SORT_NONE, SORT_PATH, SORT_TAGS, SORT_TIME };
+
+static int      sort_by   = SORT_NONE;
+static bool     sort_back = 0;           // descending
+static uint64_t page_lo   = 0;
+static uint64_t page_hi   = UINT64_MAX;  // UINT64_MAX without --limit
+static uint64_t page_at   = 0;           // matches listed so far
+static char*    top       = NULL;        // uint32_t record indices
+static uint64_t top_sz    = 0;
+static uint64_t top_cap   = 0;
+
+static uint64_t page_number(const char* name, const char* s)
+{
+    char*    e = NULL;
+    uint64_t n = strtoull(s, &e, 10);
+    ERR_IF_MSG(!*s || *e || *s == '-', ERR_GENERAL, "--%s expects a number, not '%s'", name, s);
+    return n;
+
+error:
+    return 0;
+}
+
+static void page_init(void)
+{
+    sort_by   = SORT_NONE;
+    sort_back = 0;
+    page_lo   = 0;
+    page_hi   = UINT64_MAX;
+    page_at   = 0;
+    top_sz    = 0;
+
+    if (flag_offset) {
+        page_lo = page_number("offset", flag_offset);
+        ERR_FORWARD();
+    }
+    if (flag_limit) {
+        uint64_t n = page_number("limit", flag_limit);
+        ERR_FORWARD();
+        page_hi = n < UINT64_MAX - page_lo ? page_lo + n : UINT64_MAX;
+    }
+    if (flag_sort) {
+        const char* s = flag_sort;
+        sort_back = *s == '-';
+        s += sort_back;
+        sort_by = !strcmp(s, "path") ? SORT_PATH
+                : !strcmp(s, "tags") ? SORT_TAGS
+                : !strcmp(s, "time") ? SORT_TIME
+                : SORT_NONE;
+        ERR_IF_MSG(sort_by == SORT_NONE, ERR_GENERAL,
+                   "--sort expects 'path', 'tags' or 'time', not '%s'", flag_sort);
+    }
+
+error:
+    return;
+}
+
+// the matches come in record order and are not sorted afterwards
+static bool page_ordered(void)
+{
+    return sort_by == SORT_NONE || sort_by == SORT_TIME;
+}
+
+// the next match in listing order is on the page
+static bool page_take(void)
+{
+    return page_at++ >= page_lo;
+}
+
+static bool page_done(void)
+{
+    return page_at >= page_hi;
+}
+
+// records in listing order, ties in record order
+static int cmp_rec(uint32_t a, uint32_t b)
+{
+    int r = 0;
+    if (sort_by == SORT_PATH) {
+        r = strcmp(str(rec(a)->file), str(rec(b)->file));
+    } else if (sort_by == SORT_TAGS) {
+        r = (rec(a)->tag_sz > rec(b)->tag_sz) - (rec(a)->tag_sz < rec(b)->tag_sz);
+    } else if (sort_by == SORT_TIME) {
+        r = (a > b) - (a < b);
+    }
+    r = sort_back ? -r : r;
+    return r ? r : (a > b) - (a < b);
+}
+
+static int cmp_sort(const void* a, const void* b)
+{
+    return cmp_rec(*(const uint32_t*)a, *(const uint32_t*)b);
+}
+
+static void top_push(uint32_t i)
+{
+    uint32_t* t = (uint32_t*)top;
+    uint64_t  j = 0;
+    if (top_sz == page_hi) {
+        if (cmp_rec(i, t[0]) > 0) {
+            return;
+        }
+        // the new one sinks from the top
+        for (;;) {
+            uint64_t k = 2 * j + 1;
+            if (k >= top_sz) {
+                break;
+            }
+            k += k + 1 < top_sz && cmp_rec(t[k + 1], t[k]) > 0;
+            if (cmp_rec(t[k], i) <= 0) {
+                break;
+            }
+            t[j] = t[k];
+            j    = k;
+        }
+        t[j] = i;
+        return;
+    }
+
+    reserve(&top, &top_cap, (top_sz + 1) * sizeof(uint32_t));
+    ERR_FORWARD();
+    t = (uint32_t*)top;
+
+    // without a limit all are sorted at the end anyway
+    j = top_sz++;
+    for (; page_hi != UINT64_MAX && j && cmp_rec(t[(j - 1) / 2], i) < 0; j = (j - 1) / 2) {
+        t[j] = t[(j - 1) / 2];
+    }
+    t[j] = i;
+
+error:
+    return;
+}
+
+// prints record i if on the page or keeps it for sorting, returns 0 once
+// the page is complete or memory ran out
+static bool page_add(uint32_t i)
+{
+    if (!page_ordered()) {
+        top_push(i);
+        return error == ERR_OK;
+    }
+    if (page_done()) {
+        return 0;
+    }
+    if (page_take()) {
+        print_ficor(rec(i));
+    }
+    return !page_done() && error == ERR_OK;
+}
+
+// sorts the sz records of t by tag count, counting them. Records with the
+// same count stay in order
+static void sort_tags(uint32_t* t, uint64_t sz)
+{
+    uint64_t* at  = NULL;
+    uint32_t* tmp = malloc(sz * sizeof(*tmp) + 1);
+    ERR_IF(!tmp, ERR_BAD_MALLOC);
+
+    uint32_t max = 0;
+    uint64_t i   = 0;
+    for (; i < sz; ++i) {
+        max = rec(t[i])->tag_sz > max ? rec(t[i])->tag_sz : max;
+    }
+    at = calloc((uint64_t)max + 1, sizeof(*at));
+    ERR_IF(!at, ERR_BAD_MALLOC);
+    for (i = 0; i < sz; ++i) {
+        at[rec(t[i])->tag_sz] += 1;
+    }
+
+    // at[n] becomes where the records with n tags start
+    uint64_t o = 0;
+    uint64_t n = 0;
+    for (; n <= max; ++n) {
+        uint64_t k = sort_back ? max - n : n;
+        uint64_t c = at[k];
+        at[k] = o;
+        o    += c;
+    }
+    for (i = 0; i < sz; ++i) {
+        tmp[at[rec(t[i])->tag_sz]++] = t[i];
+    }
+    memcpy(t, tmp, sz * sizeof(*t));
+
+error:
+    free(tmp);
+    free(at);
+    return;
+}
+
+// prints the page of the records kept by page_add(). Without a limit they
+// came in record order
+static void top_print(void)
+{
+    uint32_t* t = (uint32_t*)top;
+    if (sort_by == SORT_TAGS && page_hi == UINT64_MAX) {
+        sort_tags(t, top_sz);
+        ERR_FORWARD();
+    } else {
+        qsort(t, top_sz, sizeof(*t), cmp_sort);
+    }
+
+    uint64_t k = page_lo;
+    for (; k < top_sz; ++k) {
+        print_ficor(rec(t[k]));
+        ERR_FORWARD();
+    }
+    page_at = top_sz;
+
+error:
+    return;
+}
+
+// large scans are split into one contiguous part per thread, every thread
+// collects the matches of its part and they are printed part by part, so
+// the order is the same as for a single thread
+
+// without -j threads are used from SCAN_MIN records on, each getting at
+// least SCAN_PART of them
+#define SCAN_MIN     (1 << 17)
+#define SCAN_PART    (1 << 15)
+#define SCAN_MAX_JOB 256
+
+// scans of a clean mapping drop what they read every SCAN_DROP records
+#define SCAN_DROP    (1 << 14)
+
+typedef struct scan_t scan_t;
+struct scan_t {
+    filter_t* q;
+    uint32_t* c;       // record indices to check, NULL for [lo, hi)
+    uint32_t  lo;
+    uint32_t  hi;
+    uint32_t* hit;     // matching record indices, in order
+    uint32_t  hit_sz;
+    uint32_t  hit_cap;
+    bool      failed;  // out of memory
+    bool      bad;     // a record failed filter_ok()
+};
+
+// drops the pages from the one holding lo up to the one holding hi from the
+// mapping. The file is not changed, touching them again reads them back
+static void map_drop(const void* lo, const void* hi)
+{
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t a    = (uintptr_t)lo & ~(page - 1);
+    uintptr_t b    = (uintptr_t)hi & ~(page - 1);
+    if (a < b) {
+        madvise((void*)a, b - a, MADV_DONTNEED);
+    }
+}
+
+// drops records [lo, hi) and their part of the heap, which follows record
+// order in a snapshot without journal. Keeps a listing of a large database at
+// a flat footprint
+static void drop_records(uint32_t lo, uint32_t hi)
+{
+    if (!map_clean || lo >= hi || hi > ficor_map_sz) {
+        return;
+    }
+    uint64_t a = ficor[lo].tag < heap_map_sz ? ficor[lo].tag : heap_map_sz;
+    uint64_t b = hi < ficor_map_sz && ficor[hi].tag < heap_map_sz ? ficor[hi].tag : heap_map_sz;
+    map_drop(&ficor[lo], &ficor[hi]);
+    map_drop(heap_map + a, heap_map + b);
+}
+
+static void* scan(void* arg)
+{
+    scan_t* s = arg;
+    uint32_t i = s->lo;
+    for (; i < s->hi; ++i) {
+        uint32_t j = s->c ? s->c[i] : i;
+        if (i != s->lo && (i - s->lo) % SCAN_DROP == 0) {
+            drop_records(s->c ? s->c[i - SCAN_DROP] : i - SCAN_DROP, j);
+        }
+        if (!filter_ok(s->q, j)) {
+            s->bad = 1;
+            continue;
+        }
+        ficor_t* f = rec(j);
+        if ((f->flags & FICOR_DEAD) || !filter_match(s->q, f)) {
+            continue;
+        }
+        if (s->hit_sz == s->hit_cap) {
+            uint32_t  cap = s->hit_cap ? s->hit_cap * 2 : 1024;
+            uint32_t* n   = realloc(s->hit, cap * sizeof(*n));
+            if (!n) {
+                s->failed = 1;
+                return s;
+            }
+            s->hit     = n;
+            s->hit_cap = cap;
+        }
+        s->hit[s->hit_sz++] = j;
+    }
+    return s;
+}
+
+// number of threads for checking sz records
+static uint32_t scan_jobs(uint32_t sz)
+{
+    uint64_t j = 1;
+    if (flag_jobs) {
+        char* e = NULL;
+        j = strtoul(flag_jobs, &e, 10);
+        ERR_IF_MSG(!*flag_jobs || *e || !j, ERR_GENERAL, "-j expects a positive number, not '%s'", flag_jobs);
+    } else if (sz >= SCAN_MIN) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        j = n > 0 ? (uint64_t)n : 1;
+        j = j < sz / SCAN_PART ? j : sz / SCAN_PART;
+    }
+    j = j < SCAN_MAX_JOB ? j : SCAN_MAX_JOB;
+    return j < sz ? j : (sz ? sz : 1);
+
+error:
+    return 1;
+}
+
+// checks the records in c, or all of them if c is NULL, with jobs threads
+static void scan_parallel(filter_t* q, uint32_t* c, uint32_t sz, uint32_t jobs)
+{
+    scan_t    s[SCAN_MAX_JOB];
+    pthread_t t[SCAN_MAX_JOB];
+    bool      started[SCAN_MAX_JOB];
+
+    uint32_t i = 0;
+    for (; i < jobs; ++i) {
+        s[i] = (scan_t){
+            .q  = q,
+            .c  = c,
+            .lo = (uint64_t)sz * i / jobs,
+            .hi = (uint64_t)sz * (i + 1) / jobs,
+        };
+    }
+
+    // the first part is ours, a thread that cannot be started is run here
+    for (i = 1; i < jobs; ++i) {
+        started[i] = pthread_create(&t[i], NULL, scan, &s[i]) == 0;
+    }
+    scan(&s[0]);
+    for (i = 1; i < jobs; ++i) {
+        if (started[i]) {
+            pthread_join(t[i], NULL);
+        } else {
+            scan(&s[i]);
+        }
+    }
+
+    for (i = 0; i < jobs; ++i) {
+        ERR_IF(s[i].failed, ERR_BAD_MALLOC);
+        ERR_IF_MSG(s[i].bad, ERR_FILE, "%s is corrupted. --fsck tells more", ficor_file);
+    }
+    for (i = 0; i < jobs; ++i) {
+        uint32_t* h        = s[i].hit;
+        uint32_t* const he = h + s[i].hit_sz;
+        for (; h != he && page_add(*h); ++h) {  }
+        ERR_FORWARD();
+        if (s[i].lo < s[i].hi) {
+            drop_records(c ? c[s[i].lo] : s[i].lo, c ? c[s[i].hi - 1] + 1 : s[i].hi);
+        }
+    }
+
+error:
+    for (i = 0; i < jobs; ++i) {
+        free(s[i].hit);
+    }
+    return;
+}
+
+// a match of stream_list(), file and tag are offsets into its buffers
+typedef struct stream_hit_t stream_hit_t;
+struct stream_hit_t {
+    uint32_t    pos;
+    uint32_t    file_sz;
+    uint64_t    file;
+    uint32_t    tag_sz;
+    uint32_t    info_sz;
+    uint64_t    tag;
+    const char* info;
+};
+
+static int cmp_hit(const void* a, const void* b)
+{
+    uint32_t x = ((const stream_hit_t*)a)->pos;
+    uint32_t y = ((const stream_hit_t*)b)->pos;
+    return (x > y) - (x < y);
+}
+
+// lists a packed snapshot while decoding it. The matches of a block are
+// printed in record order before the next block is decoded, and the pages
+// read are dropped, so memory stays at about a block
+static void stream_list(void)
+{
+    stream_hit_t* hit      = NULL;
+    char*         file     = NULL;
+    uint64_t      file_sz  = 0;
+    uint64_t      file_cap = 0;
+    char*         tag      = NULL;  // uint32_t tag ids
+    uint64_t      tag_sz   = 0;
+    uint64_t      tag_cap  = 0;
+    unpack_t      u        = { 0 };
+
+    filter_t q;
+    filter_init(&q, flag_include, flag_exclude, flag_query, flag_under, flag_glob, flag_search);
+    ERR_FORWARD();
+
+    // blocks are decoded in order, -j is only checked
+    scan_jobs(0);
+    ERR_FORWARD();
+
+    if (q.empty) {
+        filter_free(&q);
+        return;
+    }
+
+    hit = malloc(PACKED_BLOCK * sizeof(*hit));
+    ERR_IF(!hit, ERR_BAD_MALLOC);
+    unpack_init(&u, stream);
+    ERR_FORWARD();
+
+    const uint8_t* start = u.p;
+    madvise((void*)u.p, u.e - u.p, MADV_SEQUENTIAL);
+
+    while (u.i < u.n) {
+        uint32_t hit_sz = 0;
+        file_sz = 0;
+        tag_sz  = 0;
+
+        do {
+            unpack_next(&u);
+            ERR_FORWARD();
+            if (!filter_match_tags(&q, u.tag, u.tag_sz, u.tag_mask) || !filter_match_path(&q, u.file)
+                || !filter_match_info(&q, u.info, u.info_sz)) {
+                continue;
+            }
+
+            stream_hit_t* h = &hit[hit_sz++];
+            *h = (stream_hit_t){
+                .pos     = u.pos,
+                .file_sz = u.file_sz,
+                .file    = file_sz,
+                .info_sz = u.info_sz,
+                .info    = u.info,
+            };
+            reserve(&file, &file_cap, file_sz + u.file_sz);
+            ERR_FORWARD();
+            memcpy(file + file_sz, u.file, u.file_sz);
+            file_sz += u.file_sz;
+
+            if (flag_tags) {
+                uint64_t sz = (uint64_t)u.tag_sz * sizeof(*u.tag);
+                reserve(&tag, &tag_cap, tag_sz + sz);
+                ERR_FORWARD();
+                memcpy(tag + tag_sz, u.tag, sz);
+                h->tag    = tag_sz;
+                h->tag_sz = u.tag_sz;
+                tag_sz   += sz;
+            }
+        } while (u.i % PACKED_BLOCK && u.i < u.n);
+
+        qsort(hit, hit_sz, sizeof(*hit), cmp_hit);
+        stream_hit_t*       h  = hit;
+        stream_hit_t* const he = hit + hit_sz;
+        for (; h != he && !page_done(); ++h) {
+            if (page_take()) {
+                print_record(file + h->file, h->file_sz, h->info, h->info_sz,
+                             h->tag_sz ? (uint32_t*)(tag + h->tag) : NULL, h->tag_sz);
+            }
+        }
+        if (page_done()) {
+            break;
+        }
+
+        // the infos printed above point into the mapping
+        map_drop(start, u.p);
+        start = u.p;
+    }
+    checked = u.i;
+
+error:
+    unpack_free(&u);
+    free(hit);
+    free(file);
+    free(tag);
+    filter_free(&q);
+    return;
+}
+
+// --sort path over path_order[lo, hi) merged with the matches among the
+// records added since the snapshot, stops once the page is complete
+static void list_path(filter_t* q, uint32_t lo, uint32_t hi)
+{
+    uint32_t* add    = NULL;
+    uint32_t  add_sz = 0;
+
+    add = malloc((ficor_sz - ficor_map_sz + 1) * sizeof(*add));
+    ERR_IF(!add, ERR_BAD_MALLOC);
+    uint32_t i = ficor_map_sz;
+    for (; i < ficor_sz; ++i) {
+        ficor_t* f = rec(i);
+        if (!(f->flags & FICOR_DEAD) && filter_match(q, f)) {
+            add[add_sz++] = i;
+        }
+    }
+    qsort(add, add_sz, sizeof(*add), cmp_sort);
+
+    // m is the next match in path_order. The strings of a removed record
+    // are gone, it is skipped before comparing
+    uint32_t* a  = add;
+    uint32_t* ae = add + add_sz;
+    uint32_t  m  = UINT32_MAX;
+    uint32_t  n  = 0;
+    while (!page_done()) {
+        for (; m == UINT32_MAX && n < hi - lo; ++n) {
+            m = path_order[sort_back ? hi - 1 - n : lo + n];
+            ERR_IF_MSG(m < ficor_map_sz && !filter_ok(q, m), ERR_FILE, "%s is corrupted. --fsck tells more", ficor_file);
+            if (m >= ficor_map_sz || (rec(m)->flags & FICOR_DEAD) || !filter_match(q, rec(m))) {
+                m = UINT32_MAX;
+            }
+        }
+        if (a != ae && (m == UINT32_MAX || cmp_rec(*a, m) < 0)) {
+            i = *a++;
+        } else if (m != UINT32_MAX) {
+            i = m;
+            m = UINT32_MAX;
+        } else {
+            break;
+        }
+        if (page_take()) {
+            print_ficor(rec(i));
+            ERR_FORWARD();
+        }
+    }
+    checked = n + ficor_sz - ficor_map_sz;
+
+error:
+    free(add);
+    return;
+}
+
+// with include tags only the records in their posting lists are looked at,
+// with --under or a --glob prefix only those in the range of path_order,
+// with --search only those in the trigram postings of its words, whichever
+// is fewest. Otherwise every record is. A page in record order, or by path
+// where path_order is walked, is listed by one thread that stops at its end
+static void list_scan(void)
+{
+    uint32_t* c    = NULL;
+    uint32_t  c_sz = 0;
+    filter_t  q    = { 0 };
+
+    if (stream) {
+        stream_list();
+        return;
+    }
+
+    filter_init(&q, flag_include, flag_exclude, flag_query, flag_under, flag_glob, flag_search);
+    ERR_FORWARD();
+
+    if (q.empty) {
+        filter_free(&q);
+        return;
+    }
+
+    uint32_t lo      = 0;
+    uint32_t hi      = 0;
+    bool     by_path = path_order && (q.under || q.glob_sz);
+    if (by_path) {
+        hi = ficor_map_sz;
+        if (q.under) {
+            path_range(q.under, q.under_sz, &lo, &hi);
+        }
+        if (q.glob_sz) {
+            path_range(q.glob, q.glob_sz, &lo, &hi);
+        }
+    }
+
+    uint32_t rare = UINT32_MAX;
+    uint32_t k    = 0;
+    for (; k < q.include_sz; ++k) {
+        rare = post_sz(q.include_id[k]) < rare ? post_sz(q.include_id[k]) : rare;
+    }
+    uint32_t path_sz = by_path ? hi - lo : UINT32_MAX;
+    uint32_t text_sz = text_rare(&q);
+    bool     by_tags = q.include_sz && rare <= path_sz && rare <= text_sz;
+    bool     by_text = !by_tags && text_sz != UINT32_MAX && text_sz <= path_sz;
+
+    if (sort_by == SORT_PATH && path_order && !by_tags && !by_text) {
+        scan_jobs(0);
+        ERR_FORWARD();
+        list_path(&q, lo, by_path ? hi : ficor_map_sz);
+        filter_free(&q);
+        return;
+    }
+
+    if (by_tags) {
+        c = candidates(&q, &c_sz);
+        ERR_FORWARD();
+    } else if (by_text) {
+        c = text_candidates(&q, &c_sz);
+        ERR_FORWARD();
+    } else if (by_path) {
+        c = path_candidates(lo, hi, &c_sz);
+        ERR_FORWARD();
+    }
+
+    uint32_t sz   = c ? c_sz : ficor_sz;
+    uint32_t jobs = scan_jobs(sz);
+    ERR_FORWARD();
+    bool back = sort_by == SORT_TIME && sort_back;
+    if (back || (page_ordered() && page_hi != UINT64_MAX)) {
+        jobs = 1;
+    }
+    checked = sz;
+
+    if (!c && map_clean) {
+        madvise(map, map_sz, MADV_SEQUENTIAL);
+    }
+
+    if (jobs > 1) {
+        scan_parallel(&q, c, sz, jobs);
+        ERR_FORWARD();
+    } else {
+        uint32_t n = 0;
+        for (; n < sz; ++n) {
+            uint32_t k = back ? sz - 1 - n : n;
+            uint32_t i = c ? c[k] : k;
+            if (!back && n && n % SCAN_DROP == 0) {
+                drop_records(c ? c[n - SCAN_DROP] : n - SCAN_DROP, i);
+            }
+            ERR_IF_MSG(!filter_ok(&q, i), ERR_FILE, "%s is corrupted. --fsck tells more", ficor_file);
+            ficor_t* f = rec(i);
+            if (!(f->flags & FICOR_DEAD) && filter_match(&q, f) && !page_add(i)) {
+                n += 1;
+                break;
+            }
+        }
+        ERR_FORWARD();
+        checked = n;
+    }
+
+    if (!page_ordered()) {
+        top_print();
+        ERR_FORWARD();
+    }
+
+error:
+    free(c);
+    free(top);
+    top     = NULL;
+    top_cap = 0;
+    filter_free(&q);
+    return;
+}
+
+static int cmp_str(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// appends name, the length of v and v to the key
+static void key_add(char** key, uint64_t* sz, uint64_t* cap, const char* name, const char* v, size_t v_sz)
+{
+    char n[64];
+    int  l = snprintf(n, sizeof(n), "%s %zu:", name, v_sz);
+    reserve(key, cap, *sz + l + v_sz);
+    ERR_FORWARD();
+    memcpy(*key + *sz, n, l);
+    memcpy(*key + *sz + l, v, v_sz);
+    *sz += l + v_sz;
+
+error:
+    return;
+}
+
+// the tags of a ':' separated list sorted and without repeats, they select
+// the same records in any order
+static void key_tags(char** key, uint64_t* sz, uint64_t* cap, const char* name, char* list)
+{
+    char**   tag    = NULL;
+    uint32_t tag_sz = 0;
+    tag_array(&tag, &tag_sz, list);
+    ERR_FORWARD();
+
+    qsort(tag, tag_sz, sizeof(*tag), cmp_str);
+    uint32_t i = 0;
+    for (; i < tag_sz; ++i) {
+        if (!i || strcmp(tag[i - 1], tag[i])) {
+            key_add(key, sz, cap, name, tag[i], strlen(tag[i]));
+            ERR_FORWARD();
+        }
+    }
+
+error:
+    free(tag);
+}
+
+// the words of --search folded to lower case, sorted and without repeats,
+// as filter_words() splits them
+static void key_words(char** key, uint64_t* sz, uint64_t* cap, char* search)
+{
+    static const char* const space = " \t\n\v\f\r";
+
+    size_t   l    = strlen(search) + 1;
+    uint32_t n    = 0;
+    char**   word = malloc((l / 2 + 1) * sizeof(*word) + l);
+    ERR_IF(!word, ERR_BAD_MALLOC);
+
+    char* s = memcpy(word + l / 2 + 1, search, l);
+    for (s += strspn(s, space); *s; s += strspn(s, space)) {
+        word[n++] = s;
+        for (; *s && !strchr(space, *s); ++s) {
+            *s = *s >= 'A' && *s <= 'Z' ? *s - 'A' + 'a' : *s;
+        }
+        if (*s) {
+            *s++ = 0;
+        }
+    }
+
+    qsort(word, n, sizeof(*word), cmp_str);
+    uint32_t i = 0;
+    for (; i < n; ++i) {
+        if (!i || strcmp(word[i - 1], word[i])) {
+            key_add(key, sz, cap, "search", word[i], strlen(word[i]));
+            ERR_FORWARD();
+        }
+    }
+
+error:
+    free(word);
+}
+
+// everything that makes up the output of list(), spelled the same for
+// filters that are the same
+static void list_key(char** key, uint64_t* sz, uint64_t* cap)
+{
+    char o[128];
+    int  l = snprintf(o, sizeof(o), "%llu %llu %d %d %d %d %d",
+                      (unsigned long long)page_lo, (unsigned long long)page_hi,
+                      sort_by, sort_back, flag_info, flag_tags, flag_null);
+    key_add(key, sz, cap, "page", o, l);
+    ERR_FORWARD();
+
+    if (flag_include) {
+        key_tags(key, sz, cap, "include", flag_include);
+        ERR_FORWARD();
+    }
+    if (flag_exclude) {
+        key_tags(key, sz, cap, "exclude", flag_exclude);
+        ERR_FORWARD();
+    }
+    if (flag_search) {
+        key_words(key, sz, cap, flag_search);
+        ERR_FORWARD();
+    }
+    if (flag_under) {
+        size_t u = strlen(flag_under);
+        for (; u > 1 && flag_under[u - 1] == '/'; --u) {  }
+        key_add(key, sz, cap, "under", flag_under, u);
+        ERR_FORWARD();
+    }
+    if (flag_glob) {
+        key_add(key, sz, cap, "glob", flag_glob, strlen(flag_glob));
+        ERR_FORWARD();
+    }
+    if (flag_query) {
+        key_add(key, sz, cap, "query", flag_query, strlen(flag_query));
+        ERR_FORWARD();
+    }
+    if (qualify) {
+        key_add(key, sz, cap, "qualify", qualify, qualify_sz);
+        ERR_FORWARD();
+    }
+
+error:
+    return;
+}
+
+// with --cache a listing already made for the generation of the records is
+// answered from <config>.cache, a new one is kept there. Without it a listing
+// writes nothing. Entries not on disk yet, as in a daemon before it writes
+// them, give a generation other processes may reach with other records, then
+// the cache is left alone
+static void list(void)
+{
+    char*    key     = NULL;
+    uint64_t key_sz  = 0;
+    uint64_t key_cap = 0;
+    char*    path    = NULL;
+    char*    data    = NULL;
+    size_t   data_sz = 0;
+
+    page_init();
+    ERR_FORWARD();
+    if (page_lo >= page_hi) {
+        return;
+    }
+    if (!flag_cache || journal_sz) {
+        list_scan();
+        return;
+    }
+
+    list_key(&key, &key_sz, &key_cap);
+    ERR_FORWARD();
+    path = malloc(strlen(ficor_file) + sizeof(".cache"));
+    ERR_IF(!path, ERR_BAD_MALLOC);
+    sprintf(path, "%s.cache", ficor_file);
+
+    if (cache_get(path, generation, key, key_sz, &data, &data_sz)) {
+        out_write(&out, data, data_sz);
+        stats_set(&stats, "cached", 1);
+        goto error;
+    }
+
+    out_flush(&out);
+    out_keep(&out, CACHE_ENTRY_MAX);
+    list_scan();
+    ERR_FORWARD();
+    if (out_flush(&out) == 0 && out.keep_max) {
+        cache_put(path, generation, key, key_sz, out.keep, out.keep_sz, file_mode());
+    }
+
+error:
+    out_keep(&out, 0);
+    free(data);
+    free(path);
+    free(key);
+}
+
+// --tag-stats names the STATS_TOP tags found most often together with each.
+// The tags are counted in passes over all records, each pass with up to
+// STATS_CELLS counters, or through their postings. Records are read in
+// order by a pass, so it costs about as much as reaching one in STATS_DENSE
+// of them through postings, and it is shared by all tags it counts
+#define STATS_TOP   5
+#define STATS_DENSE 16
+#define STATS_CELLS (1 << 24)
+
+// most used first, by name after that
+static int cmp_count(const void* a, const void* b)
+{
+    tag_t* x = dict(*(const uint32_t*)a);
+    tag_t* y = dict(*(const uint32_t*)b);
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return strcmp(str(x->name), str(y->name));
+}
+
+// prints the line of tag t, co counts the files it shares with each tag id.
+// Only the ids in u are looked at, all of them if u is NULL
+static void stats_line(uint32_t t, const uint32_t* co, const uint32_t* u, uint32_t u_sz)
+{
+    uint32_t top[STATS_TOP];
+    uint32_t top_sz = 0;
+    uint32_t i      = 0;
+    for (; i < u_sz; ++i) {
+        uint32_t v = u ? u[i] : i;
+        if (v == t || !co[v]) {
+            continue;
+        }
+
+        // most frequent first, lower ids on ties
+        uint32_t j = top_sz;
+        for (; j && (co[top[j - 1]] < co[v] || (co[top[j - 1]] == co[v] && top[j - 1] > v)); --j) {
+            if (j < STATS_TOP) {
+                top[j] = top[j - 1];
+            }
+        }
+        if (j < STATS_TOP) {
+            top[j]  = v;
+            top_sz += top_sz < STATS_TOP;
+        }
+    }
+
+    char buf[64];
+    out_write(&out, tag_name(t), dict(t)->name_sz - 1);
+    snprintf(buf, sizeof(buf), "\t%u\t%.2f%%\t", dict(t)->count, 100.0 * dict(t)->count / path_table.used);
+    out_str(&out, buf);
+    for (i = 0; i < top_sz; ++i) {
+        if (i) {
+            out_str(&out, ", ");
+        }
+        out_write(&out, tag_name(top[i]), dict(top[i])->name_sz - 1);
+        snprintf(buf, sizeof(buf), " (%u)", co[top[i]]);
+        out_str(&out, buf);
+    }
+    out_char(&out, '\n');
+}
+
+// counts for the tags id[0, sz), rows of dict_sz counters in m, in one pass
+// over the records
+static void stats_pass(uint32_t* id, uint32_t sz, uint32_t* row, uint32_t* m)
+{
+    uint32_t i = 0;
+    for (; i < sz; ++i) {
+        row[id[i]] = i;
+    }
+
+    for (i = 0; i < ficor_sz; ++i) {
+        ficor_t*        f  = rec(i);
+        uint32_t*       t  = tags(f);
+        uint32_t* const te = t + f->tag_sz;
+        for (; t != te; ++t) {
+            if (row[*t] == UINT32_MAX) {
+                continue;
+            }
+            uint32_t* r = m + (uint64_t)row[*t] * dict_sz;
+            uint32_t* u = tags(f);
+            for (; u != te; ++u) {
+                r[*u] += 1;
+            }
+        }
+    }
+
+    for (i = 0; i < sz; ++i) {
+        stats_line(id[i], m + (uint64_t)i * dict_sz, NULL, dict_sz);
+        row[id[i]] = UINT32_MAX;
+    }
+}
+
+// one line per tag in use: name, files carrying it, their share of all files
+// and the tags found most often on them, each with the number of files
+// having both
+static void tag_stats(void)
+{
+    uint32_t* id   = malloc((dict_sz + 1) * sizeof(*id));
+    uint32_t* co   = calloc(dict_sz + 1, sizeof(*co));
+    uint32_t* seen = malloc((dict_sz + 1) * sizeof(*seen));
+    uint32_t* row  = malloc((dict_sz + 1) * sizeof(*row));
+    uint32_t* c    = NULL;
+    uint32_t* m    = NULL;
+    ERR_IF(!id || !co || !seen || !row, ERR_BAD_MALLOC);
+    memset(row, 0xff, (dict_sz + 1) * sizeof(*row));
+    check_records();
+    ERR_FORWARD();
+
+    uint32_t rows  = STATS_CELLS / (dict_sz + 1);
+    uint32_t id_sz = 0;
+    uint32_t dense = 0;
+    uint32_t max   = 0;
+    uint32_t i     = 0;
+    rows = rows ? rows : 1;
+    for (; i < dict_sz; ++i) {
+        tag_t* t = dict(i);
+        if (!t->count) {
+            continue;
+        }
+        id[id_sz++] = i;
+        if ((uint64_t)t->count * STATS_DENSE * rows >= path_table.used) {
+            dense += 1;
+        } else {
+            max = post_sz(i) > max ? post_sz(i) : max;
+        }
+    }
+    qsort(id, id_sz, sizeof(*id), cmp_count);
+
+    // the tags counted in passes are the most used ones
+    rows = rows < dense ? rows : dense;
+    m    = calloc((uint64_t)rows * dict_sz + 1, sizeof(*m));
+    c    = malloc(((uint64_t)max + 1) * sizeof(*c));
+    ERR_IF(!m || !c, ERR_BAD_MALLOC);
+
+    uint32_t k = 0;
+    for (; k < dense; k += rows) {
+        uint32_t sz = dense - k < rows ? dense - k : rows;
+        stats_pass(id + k, sz, row, m);
+        memset(m, 0, (uint64_t)rows * dict_sz * sizeof(*m));
+    }
+
+    for (k = dense; k < id_sz; ++k) {
+        uint32_t t       = id[k];
+        uint32_t seen_sz = 0;
+
+        // postings still hold the records that lost the tag since compaction
+        uint32_t n = post_merge(t, c);
+        for (i = 0; i < n; ++i) {
+            ficor_t* f = rec(c[i]);
+            if ((f->flags & FICOR_DEAD) || !in_sorted(tags(f), f->tag_sz, t)) {
+                continue;
+            }
+            uint32_t*       u  = tags(f);
+            uint32_t* const ue = u + f->tag_sz;
+            for (; u != ue; ++u) {
+                if (!co[*u]++) {
+                    seen[seen_sz++] = *u;
+                }
+            }
+        }
+
+        stats_line(t, co, seen, seen_sz);
+        for (i = 0; i < seen_sz; ++i) {
+            co[seen[i]] = 0;
+        }
+    }
+
+error:
+    free(m);
+    free(c);
+    free(row);
+    free(seen);
+    free(co);
+    free(id);
+    return;
+}
+
+// --tag-rules: files matching glob get tags. A glob with a '/' is matched
+// against the path below the tree, any other against the file name
+typedef struct rule_t rule_t;
+struct rule_t {
+    char* glob;  // the allocation, tags points into it
+    char* tags;
+    bool  path;
+};
+
+// reads rules from path, one per line as glob, tab, tags. Empty lines and
+// lines starting with '#' are skipped
+static rule_t* read_rules(char* path, uint32_t* rule_sz)
+{
+    rule_t*  rule     = NULL;
+    uint32_t rule_cap = 0;
+    char*    line     = NULL;
+    size_t   cap      = 0;
+    uint32_t n        = 0;
+
+    *rule_sz = 0;
+    FILE* f = fopen(path, "r");
+    ERR_IF_MSG(!f, ERR_FILE, "could not open file '%s': %s", path, strerror(errno));
+
+    ssize_t l = 0;
+    while ((l = getline(&line, &cap, f)) > 0) {
+        n += 1;
+        l -= line[l - 1] == '\n';
+        l -= l && line[l - 1] == '\r';
+        line[l] = 0;
+        if (!l || *line == '#') {
+            continue;
+        }
+
+        char* tab = strchr(line, '\t');
+        ERR_IF_MSG(!tab || tab == line || !tab[1] || strchr(tab + 1, '\t'), ERR_GENERAL,
+                   "%s:%u: malformed rule, expected '<glob>' and '<tags>' separated by a tab", path, n);
+
+        if (*rule_sz == rule_cap) {
+            uint32_t cap = rule_cap ? rule_cap * 2 : 16;
+            rule_t*  r   = realloc(rule, cap * sizeof(*r));
+            ERR_IF(!r, ERR_BAD_MALLOC);
+            rule     = r;
+            rule_cap = cap;
+        }
+        char* glob = strdup(line);
+        ERR_IF(!glob, ERR_BAD_MALLOC);
+        glob[tab - line] = 0;
+        rule[(*rule_sz)++] = (rule_t){
+            .glob = glob,
+            .tags = glob + (tab - line) + 1,
+            .path = strchr(glob, '/') != NULL,
+        };
+    }
+
+    fclose(f);
+    free(line);
+    return rule;
+
+error:
+    if (f) {
+        fclose(f);
+    }
+    for (; *rule_sz; --*rule_sz) {
+        free(rule[*rule_sz - 1].glob);
+    }
+    free(rule);
+    free(line);
+    return NULL;
+}
+
+// adds the ':' separated list t to the one of sz bytes in buf, set_tags()
+// drops duplicates
+static void tag_append(char** buf, uint64_t* cap, uint64_t* sz, char* t)
+{
+    uint64_t l = strlen(t);
+    reserve(buf, cap, *sz + l + 2);
+    ERR_FORWARD();
+    if (*sz) {
+        (*buf)[(*sz)++] = ':';
+    }
+    memcpy(*buf + *sz, t, l + 1);
+    *sz += l;
+
+error:
+    return;
+}
+
+static void walk_error(void* failed, const char* path, int err)
+{
+    fprintf(stderr, "Error: could not read directory '%s': %s\n", path, strerror(err));
+    *(uint32_t*)failed += 1;
+}
+
+// adds the files below dir that are not in ficor yet with the tags of -t and
+// of the matching --tag-rules, and the info of --set-info. They are walked by
+// as many threads as the largest scan would use, and added in path order.
+// Returns the number of directories that could not be read
+static uint32_t add_tree(char* dir)
+{
+    uint32_t failed  = 0;
+    rule_t*  rule    = NULL;
+    uint32_t rule_sz = 0;
+    char*    tag     = NULL;
+    uint64_t tag_cap = 0;
+    walk_t   w       = { 0 };
+
+    if (flag_tag_rules) {
+        rule = read_rules(flag_tag_rules, &rule_sz);
+        ERR_FORWARD();
+    }
+
+    uint32_t jobs = scan_jobs(UINT32_MAX);
+    ERR_FORWARD();
+    ERR_IF_MSG(walk_tree(&w, dir, jobs, walk_error, &failed) < 0, ERR_FILE,
+               "could not walk directory '%s': %s", dir, strerror(errno));
+
+    char**       p  = w.path;
+    char** const pe = w.path + w.path_sz;
+    for (; p != pe; ++p) {
+        if (find_ficor(*p) != ficor_sz) {
+            continue;
+        }
+
+        char*    below = *p + w.root_sz;
+        char*    name  = strrchr(below, '/');
+        uint64_t sz    = 0;
+        name = name ? name + 1 : below;
+
+        if (flag_set_tag) {
+            tag_append(&tag, &tag_cap, &sz, flag_set_tag);
+            ERR_FORWARD();
+        }
+        rule_t*       r  = rule;
+        rule_t* const re = rule + rule_sz;
+        for (; r != re; ++r) {
+            if (!fnmatch(r->glob, r->path ? below : name, r->path ? FNM_PATHNAME : 0)) {
+                tag_append(&tag, &tag_cap, &sz, r->tags);
+                ERR_FORWARD();
+            }
+        }
+
+        mutate(JOURNAL_ADD_FILE, *p, sz ? tag : NULL, flag_set_info);
+        ERR_FORWARD();
+    }
+
+error:
+    for (; rule_sz; --rule_sz) {
+        free(rule[rule_sz - 1].glob);
+    }
+    free(rule);
+    free(tag);
+    walk_free(&w);
+    return failed;
+}
+
+static void count_stats(void)
+{
+    stats_set(&stats, "checked", checked);
+    stats_set(&stats, "printed", printed);
+    stats_set(&stats, "out_bytes", out.written);
+    stats_set(&stats, "out_wait_us", out.wait_ns / 1000);
+}
+
+// writes the report of --stats to stderr and appends it to FICOR_STATS. A
+// report that cannot be written does not fail the invocation
+static void report_stats(int argc, char** argv)
+{
+    if (flag_stats) {
+        stats_print(&stats, stderr);
+    }
+    if (stats_file) {
+        FILE* f = fopen(stats_file, "a");
+        if (!f) {
+            fprintf(stderr, "Error: could not open '%s': %s\n", stats_file, strerror(errno));
+            return;
+        }
+        stats_json(&stats, f, argc, argv);
+        fclose(f);
+    }
+}
+
+// runs the command given by the flags against the loaded database, returns
+// the number of failed batch commands
+static uint32_t run(void)
+{
+    uint32_t failed = 0;
+
+    printed = 0;
+    checked = 0;
+    stats_set(&stats, "records", stream ? stream->ficor_sz : path_table.used);
+    ERR_IF(out_init(&out, STDOUT_FILENO, OUT_SZ) < 0, ERR_BAD_MALLOC);
+
+    // a new format means a new snapshot
+    if (flag_format) {
+        set_format();
+        ERR_FORWARD();
+        flag_compact = 1;
+    }
+
+    if (flag_batch) {
+        failed = batch(flag_batch);
+    } else if (flag_add_tree) {
+        failed = add_tree(flag_add_tree);
+    } else if (flag_add_file) {
+        mutate(JOURNAL_ADD_FILE, flag_add_file, flag_set_tag, flag_set_info);
+    } else if (flag_rm_file) {
+        mutate(JOURNAL_RM_FILE, flag_rm_file, NULL, NULL);
+    } else if (flag_rm_tag) {
+        mutate(JOURNAL_RM_TAG, flag_rm_tag, flag_set_tag, NULL);
+    } else if (flag_add_tag) {
+        mutate(JOURNAL_ADD_TAG, flag_add_tag, flag_set_tag, NULL);
+    } else if (flag_edit_file) {
+        mutate(JOURNAL_SET_INFO, flag_edit_file, flag_set_info, NULL);
+    } else if (flag_get) {
+        get(flag_get);
+    } else if (flag_tag_stats) {
+        tag_stats();
+    } else if (!flag_compact) {
+        list();
+    }
+    ERR_FORWARD();
+
+    if (flag_dump) {
+        check_records();
+        ERR_FORWARD();
+        dump();
+    }
+
+    // a reader that went away early is not an error
+    ERR_IF_MSG(out_flush(&out) < 0 && errno != EPIPE, ERR_FILE, "could not write output: %s", strerror(errno));
+    out_free(&out);
+    count_stats();
+    return failed;
+
+error:
+    out_flush(&out);
+    out_free(&out);
+    count_stats();
+    return failed;
+}
+
+// --across lists the databases below a directory, up to -j at once. Every
+// one is listed by a child process of its own into a temporary file, which
+// is printed once the databases before it are. Children scan with a single
+// thread and list up to the end of the page, which the parent cuts out of
+// the records of all of them
+
+// starts listing database db, whose directory is its first dir_sz bytes
+static pid_t across_start(char* db, size_t dir_sz, FILE** tmp)
+{
+    *tmp = tmpfile();
+    if (!*tmp) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid) {
+        return pid;
+    }
+
+    if (dup2(fileno(*tmp), STDOUT_FILENO) < 0) {
+        _exit(1);
+    }
+    // a listing leaves no cache behind in every directory it passes
+    flag_stats = 0;
+    flag_cache = 0;
+    stats_file = NULL;
+    ficor_file = db;
+    qualify    = db;
+    qualify_sz = dir_sz;
+    list_only  = 1;
+    load_ficor();
+    if (error == ERR_OK) {
+        run();
+    }
+    _exit(error != ERR_OK);
+}
+
+// prints what a child listed, the records from page_lo on until page_hi
+static void across_print(FILE* tmp)
+{
+    char  buf[64 * 1024];
+    char  sep    = flag_null ? 0 : '\n';
+    bool  in     = 0;  // inside a record
+    bool  take   = 0;  // which is printed
+    int   fd     = fileno(tmp);
+    off_t at     = 0;
+    ssize_t n    = 0;
+    while (!(page_done() && !in) && (n = pread(fd, buf, sizeof(buf), at)) > 0) {
+        at += n;
+        char*       s  = buf;
+        char* const se = buf + n;
+        while (s != se && !(page_done() && !in)) {
+            if (!in) {
+                take = page_take();
+                in   = 1;
+            }
+            char* e = memchr(s, sep, se - s);
+            e       = e ? e + 1 : se;
+            if (take) {
+                out_write(&out, s, e - s);
+            }
+            in = e[-1] != sep;
+            s  = e;
+        }
+    }
 }
 
-static void list(void)
+// returns the number of databases and directories that failed
+static uint32_t across(char* dir)
 {
-    char**   include    = NULL;
-    uint32_t include_sz = 0;
-    char**   exclude    = NULL;
-    uint32_t exclude_sz = 0;
+    uint32_t failed = 0;
+    walk_t   w      = { 0 };
+    pid_t*   pid    = NULL;
+    FILE**   tmp    = NULL;
+    uint64_t db_sz  = 0;
+    uint64_t next   = 0;
+    uint64_t k      = 0;
+    char     limit[24];
 
-    if (flag_include) {
-        tag_array(&include, &include_sz, flag_include);
+    page_init();
+    ERR_FORWARD();
+    uint32_t jobs = scan_jobs(UINT32_MAX);
+    ERR_FORWARD();
+    ERR_IF(out_init(&out, STDOUT_FILENO, OUT_SZ) < 0, ERR_BAD_MALLOC);
+
+    ERR_IF_MSG(walk_tree(&w, dir, jobs, walk_error, &failed) < 0, ERR_FILE,
+               "could not walk directory '%s': %s", dir, strerror(errno));
+
+    // the databases in path order, in place of all files
+    const char* name = strrchr(ficor_file, '/');
+    name = name ? name + 1 : ficor_file;
+    for (k = 0; k < w.path_sz; ++k) {
+        const char* base = strrchr(w.path[k], '/') + 1;
+        if (!strcmp(base, name)) {
+            w.path[db_sz++] = w.path[k];
+        }
+    }
+
+    stats_set(&stats, "databases", db_sz);
+
+    pid = malloc((db_sz + 1) * sizeof(*pid));
+    tmp = calloc(db_sz + 1, sizeof(*tmp));
+    ERR_IF(!pid || !tmp, ERR_BAD_MALLOC);
+
+    flag_offset = NULL;
+    flag_jobs   = "1";
+    if (page_hi != UINT64_MAX) {
+        snprintf(limit, sizeof(limit), "%llu", (unsigned long long)page_hi);
+        flag_limit = limit;
+    }
+
+    for (k = 0; k < db_sz && !page_done(); ++k) {
+        for (; next < db_sz && next < k + jobs; ++next) {
+            char* db = w.path[next];
+            pid[next] = across_start(db, strrchr(db, '/') - db, &tmp[next]);
+            ERR_IF_MSG(pid[next] < 0, ERR_GENERAL, "could not list '%s': %s", db, strerror(errno));
+        }
+
+        // only the files of the running children stay open
+        int status = 0;
+        while (waitpid(pid[k], &status, 0) < 0 && errno == EINTR) {  }
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            failed += 1;
+        } else {
+            across_print(tmp[k]);
+        }
+        fclose(tmp[k]);
+        tmp[k] = NULL;
+    }
+
+error:
+    // the rest are not needed any more
+    for (; k < next; ++k) {
+        kill(pid[k], SIGTERM);
+        while (waitpid(pid[k], NULL, 0) < 0 && errno == EINTR) {  }
+    }
+    for (k = 0; tmp && k < db_sz; ++k) {
+        if (tmp[k]) {
+            fclose(tmp[k]);
+        }
+    }
+    if (error == ERR_OK && out_flush(&out) < 0 && errno != EPIPE) {
+        fprintf(stderr, "Error: could not write output: %s\n", strerror(errno));
+        error = ERR_FILE;
+    }
+    out_flush(&out);
+    out_free(&out);
+    free(pid);
+    free(tmp);
+    walk_free(&w);
+    return failed;
+}
+
+static const char* const section_name[SECTION_MAX] = {
+    [SECTION_RECORDS]    = "records",
+    [SECTION_TAGS]       = "tags",
+    [SECTION_PATH_TABLE] = "path table",
+    [SECTION_TAG_TABLE]  = "tag table",
+    [SECTION_PATH_ORDER] = "path order",
+    [SECTION_GRAMS]      = "trigrams",
+    [SECTION_GRAM_POST]  = "trigram postings",
+    [SECTION_HEAP]       = "heap",
+    [SECTION_CHECKS]     = "checksums",
+};
+
+typedef struct fsck_t fsck_t;
+struct fsck_t {
+    header_t*      h;
+    const uint8_t* base;
+    uint64_t       lo;
+    uint64_t       hi;
+    bool*          bad;
+};
+
+static void* fsck_part(void* arg)
+{
+    fsck_t*  p = arg;
+    uint64_t i = p->lo;
+    for (; i < p->hi; ++i) {
+        p->bad[i] = !check_block_ok(p->h, p->base, i);
+    }
+    return NULL;
+}
+
+// names block i and the sections it holds parts of
+static void fsck_block(header_t* h, uint64_t i)
+{
+    uint64_t lo = align8(sizeof(*h)) + i * h->check_block;
+    uint64_t hi = lo + h->check_block < h->section[SECTION_CHECKS].off
+                ? lo + h->check_block : h->section[SECTION_CHECKS].off;
+    char     buf[128];
+    snprintf(buf, sizeof(buf), "block %llu, bytes %llu to %llu:",
+             (unsigned long long)i, (unsigned long long)lo, (unsigned long long)hi);
+    out_str(&out, buf);
+
+    uint32_t s = 0;
+    char     c = ' ';
+    for (; s < SECTION_CHECKS; ++s) {
+        section_t* x = &h->section[s];
+        if (x->sz && x->off < hi && x->off + x->sz > lo) {
+            out_char(&out, c);
+            out_str(&out, section_name[s]);
+            c = ',';
+        }
+    }
+    out_str(&out, " damaged\n");
+}
+
+// checks the blocks of the file against its checksums with up to -j threads,
+// then its journal entry by entry, and reports every damaged block and the
+// first damaged entry. If all is well the file is loaded, so its structure is
+// checked as well. Returns the number of problems found
+static uint32_t fsck(void)
+{
+    uint32_t  damaged = 0;
+    uint8_t*  base    = NULL;
+    uint64_t  sz      = 0;
+    bool*     bad     = NULL;
+    fsck_t    part[SCAN_MAX_JOB];
+    pthread_t t[SCAN_MAX_JOB];
+    bool      started[SCAN_MAX_JOB] = { 0 };
+    char      buf[256];
+
+    uint32_t jobs = scan_jobs(UINT32_MAX);
+    ERR_FORWARD();
+    ERR_IF(out_init(&out, STDOUT_FILENO, OUT_SZ) < 0, ERR_BAD_MALLOC);
+
+    int fd = open(ficor_file, O_RDONLY | O_CLOEXEC);
+    ERR_IF_MSG(fd < 0, ERR_FILE, "could not open file '%s': %s", ficor_file, strerror(errno));
+    if (lock_fd(fd, LOCK_SH) < 0) {
+        close(fd);
+        ERR_IF_MSG(1, ERR_FILE, "could not lock file '%s': %s", ficor_file, strerror(errno));
+    }
+    struct stat st;
+    int         e = 0;
+    if (fstat(fd, &st) == 0 && st.st_size) {
+        sz   = st.st_size;
+        base = mmap(NULL, sz, PROT_READ, MAP_SHARED, fd, 0);
+        e    = errno;
+    }
+    close(fd);
+    ERR_IF_MSG(base == MAP_FAILED || !base, ERR_FILE, "could not map file '%s': %s", ficor_file,
+               base ? strerror(e) : "it is empty");
+
+    header_t* h   = (header_t*)base;
+    uint64_t  sig = 0;
+    memcpy(&sig, base, sz < sizeof(sig) ? sz : sizeof(sig));
+    if (sig == SIGNATURE_LEGACY) {
+        out_str(&out, "old layout without checksums\n");
+    } else if (sig != SIGNATURE || sz < sizeof(*h) || (h->version != VERSION && h->version != VERSION_PACKED)) {
+        out_str(&out, "not a ficor file of this version\n");
+        damaged += 1;
+    } else if (!check_header_ok(h, base, sz) || h->journal > sz) {
+        out_str(&out, "header or checksum table damaged, the blocks cannot be checked\n");
+        damaged += 1;
+    } else {
+        uint64_t n = check_blocks(h);
+        bad = calloc(n + 1, sizeof(*bad));
+        ERR_IF(!bad, ERR_BAD_MALLOC);
+        madvise(base, sz, MADV_SEQUENTIAL);
+
+        // contiguous ranges, so every thread reads ahead on its own
+        jobs = jobs < n ? jobs : (n ? n : 1);
+        uint32_t j = 0;
+        for (; j < jobs; ++j) {
+            part[j] = (fsck_t){ .h = h, .base = base, .lo = n * j / jobs, .hi = n * (j + 1) / jobs, .bad = bad };
+            started[j] = j && pthread_create(&t[j], NULL, fsck_part, &part[j]) == 0;
+            if (j && !started[j]) {
+                fsck_part(&part[j]);
+            }
+        }
+        fsck_part(&part[0]);
+        for (j = 1; j < jobs; ++j) {
+            if (started[j]) {
+                pthread_join(t[j], NULL);
+            }
+        }
+
+        uint64_t i = 0;
+        for (; i < n; ++i) {
+            if (bad[i]) {
+                fsck_block(h, i);
+                damaged += 1;
+            }
+        }
+
+        uint8_t*       p       = base + h->journal;
+        uint8_t* const e       = base + sz;
+        uint64_t       entries = 0;
+        while (p != e) {
+            char*    argv[3];
+            uint32_t op = 0;
+            uint64_t l  = journal_entry(p, e, &op, argv);
+            if (!l) {
+                snprintf(buf, sizeof(buf), "journal entry %llu at byte %llu damaged, it and the %llu bytes after it are lost\n",
+                         (unsigned long long)entries, (unsigned long long)(p - base),
+                         (unsigned long long)(e - p));
+                out_str(&out, buf);
+                damaged += 1;
+                break;
+            }
+            entries += 1;
+            p       += l;
+        }
+
+        snprintf(buf, sizeof(buf), "%llu blocks of %u KiB, %llu journal entries\n",
+                 (unsigned long long)n, h->check_block / 1024, (unsigned long long)entries);
+        out_str(&out, buf);
+    }
+    munmap(base, sz);
+    base = NULL;
+
+    if (!damaged) {
+        load_ficor();
+        ERR_FORWARD();
+        check_records();
         ERR_FORWARD();
+        free_ficor();
     }
+    snprintf(buf, sizeof(buf), "%s: %s\n", ficor_file, damaged ? "damaged" : "ok");
+    out_str(&out, buf);
 
-    if (flag_exclude) {
-        tag_array(&exclude, &exclude_sz, flag_exclude);
+error:
+    if (base && base != MAP_FAILED) {
+        munmap(base, sz);
+    }
+    free(bad);
+    out_flush(&out);
+    out_free(&out);
+    return damaged;
+}
+
+// daemon stuff
+//
+// a client sends its arguments along with its stdin, stdout, stderr and
+// working directory, the daemon runs them in its place and answers with the
+// exit status. Mutations queue up in the journal, which is written as soon
+// as no other client is waiting or once it is SERVE_FLUSH_MS old or
+// SERVE_FLUSH_SZ big, so a burst of clients costs a single write. A client
+// that changed something is answered after that write, like one writing
+// itself. While a database is served every writer has to go through the
+// daemon
+//
+// clients are answered one at a time, so none may hand over a file the
+// daemon could wait on forever. A client spools a terminal, pipe or socket
+// through a temporary file it fills or drains itself, a request that still
+// holds such a file gets SERVE_DEADLINE_S seconds before they are swapped
+// for /dev/null
+
+#define SERVE_FLUSH_MS   100
+#define SERVE_FLUSH_SZ   (64 * 1024)
+#define SERVE_ACK_MAX    64
+#define SERVE_DEADLINE_S 10
+
+enum { SERVE_STDIN, SERVE_STDOUT, SERVE_STDERR, SERVE_CWD, SERVE_FD_MAX };
+
+typedef union flag_value_t flag_value_t;
+union flag_value_t {
+    bool  b;
+    char* s;
+};
+
+// flag values the daemon was started with, every request starts from them
+static flag_value_t flag_default[sizeof(flags) / sizeof(*flags)];
+
+typedef struct serve_ack_t serve_ack_t;
+struct serve_ack_t {
+    int     sock;
+    int32_t status;
+};
+
+static char* serve_file = NULL;
+
+// clients waiting for their changes to be written
+static serve_ack_t serve_ack[SERVE_ACK_MAX];
+static uint32_t    serve_ack_sz = 0;
+
+static volatile sig_atomic_t serve_stop    = 0;
+static volatile sig_atomic_t serve_expired = 0;
+
+static int serve_null = -1;
+
+static void serve_signal(int sig)
+{
+    (void)sig;
+    serve_stop = 1;
+}
+
+// the blocked read or write returns with EINTR, every later one hits
+// /dev/null
+static void serve_expire(int sig)
+{
+    (void)sig;
+    serve_expired = 1;
+    dup2(serve_null, STDIN_FILENO);
+    dup2(serve_null, STDOUT_FILENO);
+    dup2(serve_null, STDERR_FILENO);
+}
+
+// whether reading or writing fd may wait for somebody else
+static bool fd_blocks(int fd)
+{
+    struct stat s;
+    return isatty(fd) || (fstat(fd, &s) == 0 && (S_ISFIFO(s.st_mode) || S_ISSOCK(s.st_mode)));
+}
+
+static char* sock_path(void)
+{
+    char* p = malloc(strlen(ficor_file) + sizeof(".sock"));
+    if (p) {
+        sprintf(p, "%s.sock", ficor_file);
+    }
+    return p;
+}
+
+static void flags_save(void)
+{
+    uint32_t i = 0;
+    for (; i < flags_len; ++i) {
+        if (flags[i].type == FLAG_BOOL) {
+            flag_default[i].b = *(bool*)flags[i].target;
+        } else {
+            flag_default[i].s = *(char**)flags[i].target;
+        }
+    }
+}
+
+static void flags_restore(void)
+{
+    uint32_t i = 0;
+    for (; i < flags_len; ++i) {
+        if (flags[i].type == FLAG_BOOL) {
+            *(bool*)flags[i].target = flag_default[i].b;
+        } else {
+            *(char**)flags[i].target = flag_default[i].s;
+        }
+    }
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+// writes the queued entries. A compaction replaces the file, its snapshot is
+// mapped in place of the old one
+static void serve_flush(bool compact)
+{
+    if (compact || want_compact()) {
+        save_ficor();
+        ERR_FORWARD();
+        free_ficor();
+        load_ficor();
+        ERR_FORWARD();
+    } else if (journal_sz) {
+        append_journal();
         ERR_FORWARD();
     }
 
-    ficor_t* f = ficor;
-    ficor_t* fe = ficor + ficor_sz;
+error:
+    return;
+}
 
-    for (; f != fe; ++f) {
-        if (include && !is_tag_subset(f->tag, f->tag_sz, include, include_sz)) {
-            continue;
+// answers the clients waiting for the last write, with failure if it failed
+static void serve_answer(int32_t failed)
+{
+    uint32_t i = 0;
+    for (; i < serve_ack_sz; ++i) {
+        ipc_send_status(serve_ack[i].sock, serve_ack[i].status | failed);
+        close(serve_ack[i].sock);
+    }
+    serve_ack_sz = 0;
+}
+
+// parses and runs one request. The database is always the served one,
+// whatever --config says
+static int32_t serve_run(int argc, char** argv, bool* compact)
+{
+    int    args_sz = argc;
+    char** args    = argv;
+
+    stats_free(&stats);
+    stats_init(&stats);
+    int e = flag_parse(argc, argv, flags, flags_len, &argc, &argv);
+    ficor_file = serve_file;
+    if (e) {
+        fprintf(stderr, "Error: while parsing flags: %s: %s\n", flag_error_format(e), *flag_error_position());
+        return 1;
+    }
+    if (flag_help || flag_init || flag_serve) {
+        fprintf(stderr, "Error: --help, --init and --serve are not run by the daemon\n");
+        return 1;
+    }
+
+    if (flag_stats || stats_file) {
+        stats_hw(&stats);
+    }
+    stats_mark(&stats, "parse");
+
+    uint32_t failed = run();
+    int32_t  status = error != ERR_OK || failed != 0;
+    *compact       |= flag_compact;
+    stats_mark(&stats, "run");
+    report_stats(args_sz, args);
+    return status;
+}
+
+// answers one client on its own files and directory, ours are parked in
+// home (SERVE_STDIN .. SERVE_STDERR and the working directory at SERVE_CWD).
+// A client that changed something joins serve_ack
+static void serve_request(int sock, int* home, bool* compact)
+{
+    char**   argv    = NULL;
+    int      argc    = 0;
+    int      fds[SERVE_FD_MAX];
+    int32_t  status  = 1;
+    uint64_t pending = journal_sz;
+
+    int c = ipc_accept(sock);
+    if (c < 0) {
+        return;
+    }
+
+    // the socket is ours alone, a peer of another user is not served even if
+    // it got at it
+    uid_t uid;
+    if (ipc_peer_uid(c, &uid) < 0 || uid != geteuid()
+        || ipc_recv_request(c, &argc, &argv, fds, SERVE_FD_MAX) < 0) {
+        close(c);
+        return;
+    }
+
+    int* f        = fds;
+    int* const fe = fds + SERVE_FD_MAX;
+    for (; f != fe && *f >= 0; ++f) {  }
+    if (f == fe) {
+        bool stall = fd_blocks(fds[SERVE_STDIN]) || fd_blocks(fds[SERVE_STDOUT]) || fd_blocks(fds[SERVE_STDERR]);
+        serve_expired = 0;
+        if (stall) {
+            alarm(SERVE_DEADLINE_S);
         }
-        if (exclude && !is_tag_disjunct(f->tag, f->tag_sz, exclude, include_sz)) {
+
+        dup2(fds[SERVE_STDIN], STDIN_FILENO);
+        dup2(fds[SERVE_STDOUT], STDOUT_FILENO);
+        dup2(fds[SERVE_STDERR], STDERR_FILENO);
+        if (fchdir(fds[SERVE_CWD]) == 0) {
+            flags_restore();
+            status = serve_run(argc, argv, compact);
+        } else {
+            fprintf(stderr, "Error: could not enter working directory: %s\n", strerror(errno));
+        }
+
+        fflush(stdout);
+        fflush(stderr);
+        alarm(0);
+        status |= serve_expired;
+        clearerr(stdin);
+        clearerr(stdout);
+        clearerr(stderr);
+        dup2(home[SERVE_STDIN], STDIN_FILENO);
+        dup2(home[SERVE_STDOUT], STDOUT_FILENO);
+        dup2(home[SERVE_STDERR], STDERR_FILENO);
+        fchdir(home[SERVE_CWD]);
+    }
+
+    if (journal_sz != pending || *compact) {
+        serve_ack[serve_ack_sz].sock   = c;
+        serve_ack[serve_ack_sz].status = status;
+        serve_ack_sz                  += 1;
+    } else {
+        ipc_send_status(c, status);
+        close(c);
+    }
+    for (f = fds; f != fe; ++f) {
+        if (*f >= 0) close(*f);
+    }
+    free(argv);
+}
+
+static void serve(void)
+{
+    char* path = NULL;
+    int   sock = -1;
+    int   home[SERVE_FD_MAX] = { -1, -1, -1, -1 };
+
+    // requests run in the client's directory
+    serve_file = realpath(ficor_file, NULL);
+    ERR_IF_MSG(!serve_file, ERR_FILE, "could not resolve '%s': %s", ficor_file, strerror(errno));
+    ficor_file = serve_file;
+
+    path = sock_path();
+    ERR_IF(!path, ERR_BAD_MALLOC);
+
+    // the socket of a daemon that died is left behind
+    int other = ipc_connect(path);
+    if (other >= 0) {
+        close(other);
+    }
+    ERR_IF_MSG(other >= 0, ERR_GENERAL, "%s is already served", ficor_file);
+    unlink(path);
+
+    // the database is ours until the daemon exits
+    lock_writer();
+    ERR_FORWARD();
+
+    sock = ipc_listen(path);
+    ERR_IF_MSG(sock < 0, ERR_FILE, "could not listen on '%s': %s", path, strerror(errno));
+
+    home[SERVE_STDIN]  = dup(STDIN_FILENO);
+    home[SERVE_STDOUT] = dup(STDOUT_FILENO);
+    home[SERVE_STDERR] = dup(STDERR_FILENO);
+    home[SERVE_CWD]    = open(".", O_RDONLY | O_DIRECTORY);
+    serve_null         = open("/dev/null", O_RDWR | O_CLOEXEC);
+    ERR_IF_MSG(home[SERVE_STDIN] < 0 || home[SERVE_STDOUT] < 0 || home[SERVE_STDERR] < 0 || home[SERVE_CWD] < 0
+               || serve_null < 0,
+               ERR_FILE, "could not keep own files: %s", strerror(errno));
+
+    // no SA_RESTART, poll() returns on a signal and so do a stalled client's
+    // read() and write() on its deadline
+    struct sigaction sa = { .sa_handler = serve_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = serve_expire;
+    sigaction(SIGALRM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    load_ficor();
+    ERR_FORWARD_MSG("could not load file additional output above");
+    flag_serve = 0;
+    flags_save();
+
+    uint64_t first   = 0;
+    bool     compact = 0;
+    while (!serve_stop) {
+        // with changes queued only clients already waiting are served
+        // before writing them
+        struct pollfd p = { .fd = sock, .events = POLLIN };
+        int r = poll(&p, 1, journal_sz ? 0 : -1);
+        ERR_IF_MSG(r < 0 && errno != EINTR, ERR_GENERAL, "could not wait for clients: %s", strerror(errno));
+
+        if (r > 0) {
+            uint64_t pending = journal_sz;
+            serve_request(sock, home, &compact);
+            ERR_IF(error == ERR_BAD_MALLOC, ERR_BAD_MALLOC);
+            error = ERR_OK;
+            if (!pending && journal_sz) {
+                first = now_ms();
+            }
+        }
+
+        if (compact || journal_sz >= SERVE_FLUSH_SZ || serve_ack_sz == SERVE_ACK_MAX
+            || (journal_sz && (r == 0 || now_ms() - first >= SERVE_FLUSH_MS))) {
+            flags_restore();
+            serve_flush(compact);
+            serve_answer(error != ERR_OK);
+            ERR_FORWARD_MSG("could not save file additional output above");
+            compact = 0;
+        }
+    }
+
+    flags_restore();
+    serve_flush(0);
+    serve_answer(error != ERR_OK);
+    ERR_FORWARD_MSG("could not save file additional output above");
+
+error:
+    serve_answer(1);
+    if (sock >= 0) {
+        close(sock);
+        unlink(path);
+    }
+    int* h        = home;
+    int* const he = home + SERVE_FD_MAX;
+    for (; h != he; ++h) {
+        if (*h >= 0) close(*h);
+    }
+    if (serve_null >= 0) close(serve_null);
+    free(path);
+    return;
+}
+
+// copies what is left of from to to
+static int spool_copy(int from, int to)
+{
+    char buf[64 * 1024];
+    for (;;) {
+        ssize_t n = read(from, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
             continue;
         }
-        printf("%s", f->file);
-        if (flag_info && f->info) {
-            printf(" %s", f->info);
+        if (n <= 0) {
+            return n;
         }
-        if (flag_tags && f->tag) {
-            char** t  = f->tag;
-            char** te = f->tag + f->tag_sz;
-            printf(" %s", *t++);
-            for (; t != te; ++t) {
-                printf(":%s", *t);
+        char* p = buf;
+        while (n) {
+            ssize_t w = write(to, p, n);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w < 0) {
+                return -1;
             }
+            p += w;
+            n -= w;
         }
-        putc('\n', stdout);
     }
+}
 
-    free(include);
-    free(exclude);
+// replaces stdin by a temporary file holding all of it
+static int spool_stdin(void)
+{
+    FILE* f = tmpfile();
+    if (!f) {
+        return -1;
+    }
+    int r = spool_copy(STDIN_FILENO, fileno(f)) < 0 || lseek(fileno(f), 0, SEEK_SET) < 0
+            || dup2(fileno(f), STDIN_FILENO) < 0 ? -1 : 0;
+    int e = errno;
+    fclose(f);
+    errno = e;
+    return r;
+}
 
-    return;
+// hands the invocation to the daemon serving the database, if there is one.
+// Returns 0 when nobody is listening
+static bool forward(int argc, char** argv, int32_t* status)
+{
+    int   fds[SERVE_FD_MAX] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1 };
+    FILE* spool[SERVE_CWD]  = { NULL, NULL, NULL };
+    int   sock              = -1;
+    int   i                 = 0;
 
-error:
-    free(include);
-    free(exclude);
+    char* path = sock_path();
+    ERR_IF(!path, ERR_BAD_MALLOC);
 
-    return;
+    // only --batch - reads stdin. The daemon takes a connection as soon as
+    // it is made, so stdin is read to the end before. It stays in place of
+    // stdin in case the daemon is gone and the invocation runs here
+    struct stat st;
+    bool batch_stdin = flag_batch && strcmp(flag_batch, "-") == 0;
+    if (batch_stdin && stat(path, &st) == 0 && S_ISSOCK(st.st_mode) && fd_blocks(STDIN_FILENO)) {
+        ERR_IF_MSG(spool_stdin() < 0, ERR_FILE, "could not read stdin: %s", strerror(errno));
+    }
+
+    sock = ipc_connect(path);
+    free(path);
+    path = NULL;
+    if (sock < 0) {
+        return 0;
+    }
+
+    *status        = 1;
+    fds[SERVE_CWD] = open(".", O_RDONLY | O_DIRECTORY);
+    ERR_IF_MSG(fds[SERVE_CWD] < 0, ERR_FILE, "could not open working directory: %s", strerror(errno));
+
+    for (; i < SERVE_CWD; ++i) {
+        if (!fd_blocks(fds[i])) {
+            continue;
+        }
+        spool[i] = i == SERVE_STDIN ? fopen("/dev/null", "r") : tmpfile();
+        ERR_IF_MSG(!spool[i], ERR_FILE, "could not create a temporary file: %s", strerror(errno));
+        fds[i] = fileno(spool[i]);
+    }
+
+    ERR_IF_MSG(ipc_send_request(sock, argc, argv, fds, SERVE_FD_MAX) < 0
+               || ipc_recv_status(sock, status) < 0,
+               ERR_GENERAL, "daemon of %s did not answer: %s", ficor_file, strerror(errno));
+
+    for (i = SERVE_STDOUT; i < SERVE_CWD; ++i) {
+        if (spool[i] && (lseek(fds[i], 0, SEEK_SET) < 0 || spool_copy(fds[i], i) < 0)) {
+            *status = 1;
+        }
+    }
+
+error:
+    for (i = 0; i < SERVE_CWD; ++i) {
+        if (spool[i]) fclose(spool[i]);
+    }
+    if (fds[SERVE_CWD] >= 0) close(fds[SERVE_CWD]);
+    if (sock >= 0) close(sock);
+    free(path);
+    return 1;
 }
 
 int main(int argc, char** argv)
 {
+    stats_init(&stats);
+    stats_file = getenv("FICOR_STATS");
+    crc32c     = crc_select();
+
+    // flag_parse() reorders argv, the daemon gets the arguments as given
+    int    args_sz = argc;
+    char** args    = malloc(argc * sizeof(*args));
+    ERR_IF(!args, ERR_BAD_MALLOC);
+    memcpy(args, argv, argc * sizeof(*args));
+
     // flag stuff
     {
         int e = flag_parse(argc, argv, flags, flags_len, &argc, &argv);
         ERR_IF_MSG(e, ERR_FLAG, "while parsing flags: %s: %s", flag_error_format(e), *flag_error_position());
     }
+    if (flag_stats || stats_file) {
+        stats_hw(&stats);
+    }
+    stats_mark(&stats, "parse");
 
     if (flag_help) {
         flag_print_usage(stdout, "Simple file decorator tool", flags, flags_len);
+        free(args);
         exit(0);
     }
 
     if (flag_init) {
+        lock_writer();
+        ERR_FORWARD();
         init();
         ERR_FORWARD_MSG("could not initialize direcoty additional output above");
+        free(args);
         exit(0);
     }
 
-    load_ficor();
-    ERR_FORWARD_MSG("could not load file additional output above");
+    match_tags = match_select();
 
-    if (flag_add_file) {
-        add_file();
-        ERR_FORWARD();
-    } else if (flag_rm_file) {
-        rm_file();
-        ERR_FORWARD();
-    } else if (flag_rm_tag) {
-        rm_tag();
+    if (flag_serve) {
+        serve();
         ERR_FORWARD();
-    } else if (flag_add_tag) {
-        add_tag();
+        free_ficor();
+        free(serve_file);
+        free(args);
+        return 0;
+    }
+
+    bool writer = flag_batch || flag_add_file || flag_add_tree || flag_rm_file || flag_rm_tag
+               || flag_add_tag || flag_edit_file || flag_compact || flag_format;
+    if (flag_across) {
+        ERR_IF_MSG(writer || flag_get || flag_dump || flag_tag_stats, ERR_GENERAL,
+                   "--across only lists");
+        uint32_t failed = across(flag_across);
         ERR_FORWARD();
-    } else {
-        list();
+        stats_mark(&stats, "run");
+        report_stats(args_sz, args);
+        stats_free(&stats);
+        free(args);
+        return failed != 0;
     }
 
-    if (flag_dump) {
-        dump();
+    // the file as it is on disk, not what a daemon has in memory
+    if (flag_fsck) {
+        ERR_IF_MSG(writer || flag_get || flag_dump || flag_tag_stats, ERR_GENERAL, "--fsck only checks");
+        uint32_t damaged = fsck();
+        ERR_FORWARD_MSG("could not check file additional output above");
+        stats_mark(&stats, "run");
+        report_stats(args_sz, args);
+        stats_free(&stats);
+        free(args);
+        return damaged != 0;
     }
 
-    unload_ficor();
-    ERR_FORWARD_MSG("could not unload file additional output above");
+    if (!flag_no_daemon) {
+        int32_t status = 0;
+        if (forward(args_sz, args, &status)) {
+            // the daemon reported --stats on its own
+            stats_mark(&stats, "forward");
+            flag_stats = 0;
+            report_stats(args_sz, args);
+            stats_free(&stats);
+            free(args);
+            return status != 0 || error != ERR_OK;
+        }
+    }
 
-    return 0;
+    list_only = !writer && !flag_get && !flag_dump && !flag_tag_stats;
+    if (writer) {
+        lock_writer();
+        ERR_FORWARD();
+        stats_mark(&stats, "lock");
+    }
+
+    load_ficor();
+    ERR_FORWARD_MSG("could not load file additional output above");
+    stats_mark(&stats, "load");
+
+    uint32_t failed = run();
+    ERR_FORWARD();
+    stats_mark(&stats, "run");
+
+    commit_ficor();
+    ERR_FORWARD_MSG("could not save file additional output above");
+    stats_mark(&stats, "commit");
+
+    free_ficor();
+    stats_mark(&stats, "unload");
+    report_stats(args_sz, args);
+    stats_free(&stats);
+    free(args);
+    return failed != 0;
 
 error:
+    free_ficor();
+    stats_mark(&stats, "error");
+    report_stats(args ? args_sz : 0, args);
+    stats_free(&stats);
+    free(serve_file);
+    free(args);
     return 1;
 }
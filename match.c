@@ -0,0 +1,70 @@
+#include "match.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATCH_X86
+#endif
+
+uint32_t match_scalar(const uint64_t* include, const uint64_t* exclude, const uint32_t* id, uint32_t sz)
+{
+    uint32_t              hit = 0;
+    const uint32_t*       i   = id;
+    const uint32_t* const ie  = id + sz;
+    for (; i != ie; ++i) {
+        if (exclude[*i / 64] >> (*i % 64) & 1) {
+            return MATCH_EXCLUDED;
+        }
+        hit += include[*i / 64] >> (*i % 64) & 1;
+    }
+    return hit;
+}
+
+#ifdef MATCH_X86
+
+// eight ids at a time: the 32 bit words holding their bits are gathered
+// from both sets and shifted into place. On little endian bit i is bit
+// i % 32 of 32 bit word i / 32 as well
+__attribute__((target("avx2")))
+static uint32_t match_avx2(const uint64_t* include, const uint64_t* exclude, const uint32_t* id, uint32_t sz)
+{
+    const int* inc = (const int*)include;
+    const int* exc = (const int*)exclude;
+
+    const __m256i one  = _mm256_set1_epi32(1);
+    const __m256i low  = _mm256_set1_epi32(31);
+    __m256i       hits = _mm256_setzero_si256();
+
+    uint32_t i = 0;
+    for (; i + 8 <= sz; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(id + i));
+        __m256i w = _mm256_srli_epi32(v, 5);
+        __m256i s = _mm256_and_si256(v, low);
+
+        __m256i e = _mm256_srlv_epi32(_mm256_i32gather_epi32(exc, w, 4), s);
+        if (!_mm256_testz_si256(e, one)) {
+            return MATCH_EXCLUDED;
+        }
+        __m256i n = _mm256_srlv_epi32(_mm256_i32gather_epi32(inc, w, 4), s);
+        hits = _mm256_add_epi32(hits, _mm256_and_si256(n, one));
+    }
+
+    __m128i h = _mm_add_epi32(_mm256_castsi256_si128(hits), _mm256_extracti128_si256(hits, 1));
+    h = _mm_add_epi32(h, _mm_shuffle_epi32(h, 0x4e));
+    h = _mm_add_epi32(h, _mm_shuffle_epi32(h, 0xb1));
+
+    uint32_t rest = match_scalar(include, exclude, id + i, sz - i);
+    return rest == MATCH_EXCLUDED ? rest : (uint32_t)_mm_cvtsi128_si32(h) + rest;
+}
+
+#endif
+
+match_fn_t* match_select(void)
+{
+#ifdef MATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return match_avx2;
+    }
+#endif
+    return match_scalar;
+}
@@ -0,0 +1,19 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stdint.h>
+
+// checks an array of tag ids against include and exclude bitsets, bit i of
+// a set is bit i % 64 of word i / 64. Returns the number of ids set in
+// include, or MATCH_EXCLUDED as soon as one is set in exclude
+
+#define MATCH_EXCLUDED UINT32_MAX
+
+typedef uint32_t match_fn_t(const uint64_t* include, const uint64_t* exclude, const uint32_t* id, uint32_t sz);
+
+uint32_t match_scalar(const uint64_t* include, const uint64_t* exclude, const uint32_t* id, uint32_t sz);
+
+// the fastest implementation the running cpu supports
+match_fn_t* match_select(void);
+
+#endif
@@ -0,0 +1,147 @@
+#include "out.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+int out_init(out_t* o, int fd, size_t cap)
+{
+    o->fd       = fd;
+    o->buf      = malloc(cap);
+    o->sz       = 0;
+    o->cap      = o->buf ? cap : 0;
+    o->error    = 0;
+    o->written  = 0;
+    o->wait_ns  = 0;
+    o->keep     = NULL;
+    o->keep_sz  = 0;
+    o->keep_cap = 0;
+    o->keep_max = 0;
+    return o->buf ? 0 : -1;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void keep_drop(out_t* o)
+{
+    free(o->keep);
+    o->keep     = NULL;
+    o->keep_sz  = 0;
+    o->keep_cap = 0;
+    o->keep_max = 0;
+}
+
+static void keep_iov(out_t* o, struct iovec* iov, int iov_sz)
+{
+    int i = 0;
+    for (; i < iov_sz && o->keep_max; ++i) {
+        size_t sz = o->keep_sz + iov[i].iov_len;
+        if (!iov[i].iov_len) {
+            continue;
+        }
+        if (sz > o->keep_max) {
+            keep_drop(o);
+            return;
+        }
+        if (sz > o->keep_cap) {
+            size_t cap = o->keep_cap ? o->keep_cap : 4096;
+            for (; cap < sz; cap *= 2) {  }
+            char* k = realloc(o->keep, cap);
+            if (!k) {
+                keep_drop(o);
+                return;
+            }
+            o->keep     = k;
+            o->keep_cap = cap;
+        }
+        memcpy(o->keep + o->keep_sz, iov[i].iov_base, iov[i].iov_len);
+        o->keep_sz = sz;
+    }
+}
+
+// writes all of iov, advancing it past partial writes
+static void out_writev(out_t* o, struct iovec* iov, int iov_sz)
+{
+    if (o->keep_max) {
+        keep_iov(o, iov, iov_sz);
+    }
+
+    uint64_t start = now_ns();
+    while (iov_sz && !o->error) {
+        ssize_t n = writev(o->fd, iov, iov_sz);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            o->error = errno;
+            break;
+        }
+        o->written += n;
+        for (; iov_sz && (size_t)n >= iov->iov_len; ++iov, --iov_sz) {
+            n -= iov->iov_len;
+        }
+        if (iov_sz) {
+            iov->iov_base  = (char*)iov->iov_base + n;
+            iov->iov_len  -= n;
+        }
+    }
+    o->wait_ns += now_ns() - start;
+}
+
+void out_write_slow(out_t* o, const char* s, size_t sz)
+{
+    if (o->error) {
+        o->sz = 0;
+        return;
+    }
+
+    // small strings start the next buffer, big ones go out right away
+    if (sz < o->cap / 2) {
+        struct iovec iov = { .iov_base = o->buf, .iov_len = o->sz };
+        out_writev(o, &iov, 1);
+        memcpy(o->buf, s, sz);
+        o->sz = sz;
+        return;
+    }
+
+    struct iovec iov[2] = {
+        { .iov_base = o->buf,    .iov_len = o->sz },
+        { .iov_base = (char*)s, .iov_len = sz },
+    };
+    out_writev(o, iov, 2);
+    o->sz = 0;
+}
+
+int out_flush(out_t* o)
+{
+    struct iovec iov = { .iov_base = o->buf, .iov_len = o->sz };
+    out_writev(o, &iov, 1);
+    o->sz = 0;
+    if (o->error) {
+        errno = o->error;
+        return -1;
+    }
+    return 0;
+}
+
+void out_keep(out_t* o, size_t max)
+{
+    keep_drop(o);
+    o->keep_max = max;
+}
+
+void out_free(out_t* o)
+{
+    keep_drop(o);
+    free(o->buf);
+    o->buf = NULL;
+    o->sz  = 0;
+    o->cap = 0;
+}
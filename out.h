@@ -0,0 +1,73 @@
+#ifndef OUT_H
+#define OUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// buffered writer on a file descriptor. Output collects in buf and goes out
+// with one write() once it is full; a string that does not fit any more is
+// written together with the buffer by a single writev()
+//
+// after a failed write everything is dropped, out_flush() reports the error.
+// written and wait count the bytes that went out and the time spent in
+// writev() for them
+
+typedef struct out_t out_t;
+struct out_t {
+    int      fd;
+    char*    buf;
+    size_t   sz;
+    size_t   cap;
+    int      error;    // errno of the first failed write, 0 if none
+    uint64_t written;
+    uint64_t wait_ns;
+    char*    keep;      // copy of the output, see out_keep()
+    size_t   keep_sz;
+    size_t   keep_cap;
+    size_t   keep_max;
+};
+
+// returns 0 on success and -1 if the buffer could not be allocated
+int out_init(out_t* o, int fd, size_t cap);
+
+void out_write_slow(out_t* o, const char* s, size_t sz);
+
+static inline void out_write(out_t* o, const char* s, size_t sz)
+{
+    if (sz <= o->cap - o->sz) {
+        memcpy(o->buf + o->sz, s, sz);
+        o->sz += sz;
+    } else {
+        out_write_slow(o, s, sz);
+    }
+}
+
+static inline void out_char(out_t* o, char c)
+{
+    if (o->sz == o->cap) {
+        out_write_slow(o, &c, 1);
+    } else {
+        o->buf[o->sz++] = c;
+    }
+}
+
+static inline void out_str(out_t* o, const char* s)
+{
+    out_write(o, s, strlen(s));
+}
+
+// writes what is buffered, returns 0 on success and -1 with errno set to
+// the first error
+int out_flush(out_t* o);
+
+// keeps a copy of the output from the next write to fd on in keep, what is
+// buffered included, up to max bytes. Past that, or without memory, keep is
+// dropped and keep_max is 0. A max of 0 stops keeping
+void out_keep(out_t* o, size_t max);
+
+// flushes nothing, call out_flush() first
+void out_free(out_t* o);
+
+#endif
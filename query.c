@@ -0,0 +1,597 @@
+#include "query.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define QUERY_MAX_DEPTH 256
+#define QUERY_NONE      UINT32_MAX
+
+typedef enum {
+    NODE_TAG,
+    NODE_NOT,
+    NODE_AND,
+    NODE_OR,
+    NODE_TRUE,
+    NODE_FALSE,
+} node_kind_t;
+
+struct query_node_t {
+    node_kind_t kind;
+    char*       name;    // NODE_TAG
+    uint32_t    id;      // NODE_TAG, once planned
+    uint32_t    kid;     // first child in query_t.kid
+    uint32_t    kid_sz;
+    double      p;       // chance to be true
+    double      cost;    // tags looked at
+};
+
+typedef enum {
+    OP_HAS,  // acc = record has tag arg
+    OP_NOT,  // acc = !acc
+    OP_JF,   // jump to arg if !acc
+    OP_JT,   // jump to arg if acc
+} op_kind_t;
+
+struct query_op_t {
+    op_kind_t op;
+    uint32_t  arg;
+};
+
+typedef enum {
+    TOK_END,
+    TOK_TAG,
+    TOK_AND,
+    TOK_OR,
+    TOK_NOT,
+    TOK_OPEN,
+    TOK_CLOSE,
+} tok_t;
+
+typedef struct parser_t parser_t;
+struct parser_t {
+    query_t* q;
+    char*    s;      // next unread char of q->buf
+    char*    names;  // where the next tag name is copied to
+    uint32_t depth;
+    int      error;  // -1 syntax, -2 memory
+};
+
+// growable arrays
+
+static int push_u32(uint32_t** a, uint32_t* sz, uint32_t* cap, uint32_t v)
+{
+    if (*sz == *cap) {
+        uint32_t  c = *cap ? *cap * 2 : 16;
+        uint32_t* n = realloc(*a, c * sizeof(*n));
+        if (!n) {
+            return -2;
+        }
+        *a   = n;
+        *cap = c;
+    }
+    (*a)[(*sz)++] = v;
+    return 0;
+}
+
+static uint32_t new_node(parser_t* p, node_kind_t kind)
+{
+    query_t* q = p->q;
+    if (q->node_sz == q->node_cap) {
+        uint32_t      c = q->node_cap ? q->node_cap * 2 : 16;
+        query_node_t* n = realloc(q->node, c * sizeof(*n));
+        if (!n) {
+            p->error = -2;
+            return QUERY_NONE;
+        }
+        q->node     = n;
+        q->node_cap = c;
+    }
+    memset(&q->node[q->node_sz], 0, sizeof(*q->node));
+    q->node[q->node_sz].kind = kind;
+    return q->node_sz++;
+}
+
+// moves stack[base, stack_sz) into the children of node n
+static int set_kids(query_t* q, uint32_t n, uint32_t base)
+{
+    uint32_t sz  = q->stack_sz - base;
+    uint32_t kid = q->kid_sz;
+    uint32_t i   = 0;
+    for (; i < sz; ++i) {
+        if (push_u32(&q->kid, &q->kid_sz, &q->kid_cap, q->stack[base + i]) < 0) {
+            return -2;
+        }
+    }
+    q->node[n].kid    = kid;
+    q->node[n].kid_sz = sz;
+    q->stack_sz       = base;
+    return 0;
+}
+
+// tokens
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool is_tag_char(char c)
+{
+    return c && !is_space(c) && c != '(' && c != ')' && c != '&' && c != '|' && c != ':';
+}
+
+// the next token, *end is set behind it
+static tok_t peek(parser_t* p, char** end)
+{
+    for (; is_space(*p->s); ++p->s) {  }
+
+    char* s = p->s;
+    *end    = s + 1;
+    switch (*s) {
+    case 0:
+        *end = s;
+        return TOK_END;
+    case '(':
+        return TOK_OPEN;
+    case ')':
+        return TOK_CLOSE;
+    case '&':
+        return TOK_AND;
+    case '|':
+        return TOK_OR;
+    case '!':
+        return TOK_NOT;
+    }
+
+    char* e = s;
+    for (; is_tag_char(*e); ++e) {  }
+    *end = e;
+    if (e == s) {
+        return TOK_END;
+    }
+    if (e - s == 3 && memcmp(s, "AND", 3) == 0) {
+        return TOK_AND;
+    }
+    if (e - s == 2 && memcmp(s, "OR", 2) == 0) {
+        return TOK_OR;
+    }
+    if (e - s == 3 && memcmp(s, "NOT", 3) == 0) {
+        return TOK_NOT;
+    }
+    return TOK_TAG;
+}
+
+static uint32_t syntax(parser_t* p, const char* what)
+{
+    if (!p->error) {
+        p->error       = -1;
+        p->q->error    = what;
+        p->q->error_at = p->s;
+    }
+    return QUERY_NONE;
+}
+
+// parser, every function returns a node or QUERY_NONE with p->error set
+
+static uint32_t parse_or(parser_t* p);
+
+static uint32_t parse_not(parser_t* p)
+{
+    char*    end = NULL;
+    tok_t    t   = peek(p, &end);
+    uint32_t n   = QUERY_NONE;
+
+    if (t == TOK_TAG) {
+        n = new_node(p, NODE_TAG);
+        if (n == QUERY_NONE) {
+            return n;
+        }
+        uint32_t l = end - p->s;
+        memcpy(p->names, p->s, l);
+        p->names[l]        = 0;
+        p->q->node[n].name = p->names;
+        p->names          += l + 1;
+        p->s               = end;
+        return n;
+    }
+
+    if (t != TOK_NOT && t != TOK_OPEN) {
+        return syntax(p, *p->s && *p->s != ')' ? "unexpected character" : "expected a tag");
+    }
+    if (++p->depth > QUERY_MAX_DEPTH) {
+        return syntax(p, "nested too deep");
+    }
+    p->s = end;
+
+    if (t == TOK_OPEN) {
+        n = parse_or(p);
+        if (n == QUERY_NONE) {
+            return n;
+        }
+        if (peek(p, &end) != TOK_CLOSE) {
+            return syntax(p, "expected ')'");
+        }
+        p->s = end;
+    } else {
+        uint32_t k = parse_not(p);
+        if (k == QUERY_NONE) {
+            return k;
+        }
+        n = new_node(p, NODE_NOT);
+        if (n == QUERY_NONE) {
+            return n;
+        }
+        uint32_t base = p->q->stack_sz;
+        if (push_u32(&p->q->stack, &p->q->stack_sz, &p->q->stack_cap, k) < 0
+            || set_kids(p->q, n, base) < 0) {
+            p->error = -2;
+            return QUERY_NONE;
+        }
+    }
+
+    p->depth -= 1;
+    return n;
+}
+
+// a run of operands joined by op, parsed by next. A single one is returned
+// as is
+static uint32_t parse_list(parser_t* p, node_kind_t kind, uint32_t (*next)(parser_t*))
+{
+    query_t* q    = p->q;
+    uint32_t base = q->stack_sz;
+
+    while (1) {
+        uint32_t k = next(p);
+        if (k == QUERY_NONE) {
+            return k;
+        }
+        if (push_u32(&q->stack, &q->stack_sz, &q->stack_cap, k) < 0) {
+            p->error = -2;
+            return QUERY_NONE;
+        }
+
+        char* end = NULL;
+        tok_t t   = peek(p, &end);
+        if (kind == NODE_OR && t == TOK_OR) {
+            p->s = end;
+        } else if (kind == NODE_AND && t == TOK_AND) {
+            p->s = end;
+        } else if (!(kind == NODE_AND && (t == TOK_TAG || t == TOK_NOT || t == TOK_OPEN))) {
+            break;
+        }
+    }
+
+    if (q->stack_sz - base == 1) {
+        return q->stack[--q->stack_sz];
+    }
+    uint32_t n = new_node(p, kind);
+    if (n == QUERY_NONE) {
+        return n;
+    }
+    if (set_kids(q, n, base) < 0) {
+        p->error = -2;
+        return QUERY_NONE;
+    }
+    return n;
+}
+
+static uint32_t parse_and(parser_t* p)
+{
+    return parse_list(p, NODE_AND, parse_not);
+}
+
+static uint32_t parse_or(parser_t* p)
+{
+    return parse_list(p, NODE_OR, parse_and);
+}
+
+int query_parse(query_t* q, const char* expr)
+{
+    memset(q, 0, sizeof(*q));
+
+    // the expression, then room for its tag names
+    size_t l = strlen(expr) + 1;
+    q->buf = malloc(2 * l);
+    if (!q->buf) {
+        return -2;
+    }
+    memcpy(q->buf, expr, l);
+
+    parser_t p = { .q = q, .s = q->buf, .names = q->buf + l };
+    q->root = parse_or(&p);
+    if (q->root != QUERY_NONE) {
+        char* end = NULL;
+        if (peek(&p, &end) != TOK_END || *p.s) {
+            syntax(&p, *p.s == ')' ? "unbalanced ')'" : "unexpected character");
+        }
+    }
+    return p.error;
+}
+
+// planner
+
+// lower ranks go first: cheap operands likely to decide the AND / OR
+static double rank(query_node_t* n, node_kind_t parent)
+{
+    double decide = parent == NODE_AND ? 1 - n->p : n->p;
+    return decide > 0 ? n->cost / decide : 1e300;
+}
+
+static void set_const(query_node_t* n, bool v)
+{
+    n->kind   = v ? NODE_TRUE : NODE_FALSE;
+    n->kid_sz = 0;
+    n->p      = v;
+    n->cost   = 0;
+}
+
+// resolves, folds and orders the tree below n in place. Returns the node
+// taking n's place
+static uint32_t plan(query_t* q, uint32_t n, uint32_t (*resolve)(const char*, double*), int* error)
+{
+    query_node_t* x = &q->node[n];
+
+    if (x->kind == NODE_TAG) {
+        double p = 0;
+        x->id = resolve(x->name, &p);
+        if (x->id == QUERY_UNKNOWN) {
+            set_const(x, 0);
+        } else {
+            x->p    = p;
+            x->cost = 1;
+        }
+        return n;
+    }
+
+    if (x->kind == NODE_NOT) {
+        uint32_t      k = plan(q, q->kid[x->kid], resolve, error);
+        query_node_t* y = &q->node[k];
+        x               = &q->node[n];
+        if (y->kind == NODE_TRUE || y->kind == NODE_FALSE) {
+            set_const(x, y->kind == NODE_FALSE);
+            return n;
+        }
+        if (y->kind == NODE_NOT) {
+            return q->kid[y->kid];
+        }
+        q->kid[x->kid] = k;
+        x->p           = 1 - y->p;
+        x->cost        = y->cost;
+        return n;
+    }
+
+    if (x->kind != NODE_AND && x->kind != NODE_OR) {
+        return n;
+    }
+
+    // children of the same kind are merged into this node
+    node_kind_t kind   = x->kind;
+    node_kind_t absorb = kind == NODE_AND ? NODE_FALSE : NODE_TRUE;
+    uint32_t    base   = q->stack_sz;
+    uint32_t    i      = 0;
+    bool        fixed  = 0;
+    for (; i < q->node[n].kid_sz && !fixed; ++i) {
+        uint32_t      k = plan(q, q->kid[q->node[n].kid + i], resolve, error);
+        query_node_t* y = &q->node[k];
+        if (y->kind == absorb) {
+            fixed = 1;
+        } else if (y->kind == kind) {
+            uint32_t j = 0;
+            for (; j < y->kid_sz; ++j) {
+                *error |= push_u32(&q->stack, &q->stack_sz, &q->stack_cap, q->kid[y->kid + j]);
+            }
+        } else if (y->kind != NODE_TRUE && y->kind != NODE_FALSE) {
+            *error |= push_u32(&q->stack, &q->stack_sz, &q->stack_cap, k);
+        }
+    }
+    x = &q->node[n];
+    if (*error) {
+        q->stack_sz = base;
+        return n;
+    }
+    if (fixed || q->stack_sz == base) {
+        q->stack_sz = base;
+        set_const(x, fixed ? absorb == NODE_TRUE : kind == NODE_AND);
+        return n;
+    }
+    if (q->stack_sz - base == 1) {
+        return q->stack[--q->stack_sz];
+    }
+
+    // insertion sort by rank, operand lists are short
+    uint32_t* k  = q->stack + base;
+    uint32_t  sz = q->stack_sz - base;
+    for (i = 1; i < sz; ++i) {
+        uint32_t v = k[i];
+        double   r = rank(&q->node[v], kind);
+        uint32_t j = i;
+        for (; j && rank(&q->node[k[j - 1]], kind) > r; --j) {
+            k[j] = k[j - 1];
+        }
+        k[j] = v;
+    }
+
+    double miss = 1;
+    x->cost     = 0;
+    for (i = 0; i < sz; ++i) {
+        query_node_t* y = &q->node[k[i]];
+        miss           *= kind == NODE_AND ? y->p : 1 - y->p;
+        x->cost        += y->cost;
+    }
+    x->p = kind == NODE_AND ? miss : 1 - miss;
+
+    *error |= set_kids(q, n, base);
+    return n;
+}
+
+static int emit(query_t* q, op_kind_t op, uint32_t arg)
+{
+    if (q->op_sz == q->op_cap) {
+        uint32_t    c = q->op_cap ? q->op_cap * 2 : 16;
+        query_op_t* o = realloc(q->op, c * sizeof(*o));
+        if (!o) {
+            return -2;
+        }
+        q->op     = o;
+        q->op_cap = c;
+    }
+    q->op[q->op_sz++] = (query_op_t){ .op = op, .arg = arg };
+    return 0;
+}
+
+// compiles kid[kid, kid + sz) joined by kind, or the single node n if sz is 0
+static int compile(query_t* q, uint32_t n, node_kind_t kind, uint32_t kid, uint32_t sz)
+{
+    if (!sz) {
+        query_node_t* x = &q->node[n];
+        switch (x->kind) {
+        case NODE_TAG:
+            return emit(q, OP_HAS, x->id);
+        case NODE_NOT:
+            if (compile(q, q->kid[x->kid], 0, 0, 0) < 0) {
+                return -2;
+            }
+            return emit(q, OP_NOT, 0);
+        default:
+            return compile(q, n, x->kind, x->kid, x->kid_sz);
+        }
+    }
+
+    // every jump goes to the end of the run, patched once it is known
+    uint32_t first = q->op_sz;
+    uint32_t i     = 0;
+    for (; i < sz; ++i) {
+        if (compile(q, q->kid[kid + i], 0, 0, 0) < 0) {
+            return -2;
+        }
+        if (i + 1 < sz && emit(q, kind == NODE_AND ? OP_JF : OP_JT, QUERY_NONE) < 0) {
+            return -2;
+        }
+    }
+    for (i = first; i < q->op_sz; ++i) {
+        if ((q->op[i].op == OP_JF || q->op[i].op == OP_JT) && q->op[i].arg == QUERY_NONE) {
+            q->op[i].arg = q->op_sz;
+        }
+    }
+    return 0;
+}
+
+int query_plan(query_t* q, uint32_t (*resolve)(const char* name, double* p))
+{
+    int error = 0;
+    q->root = plan(q, q->root, resolve, &error);
+    if (error) {
+        return -2;
+    }
+
+    query_node_t* r = &q->node[q->root];
+    if (r->kind == NODE_FALSE) {
+        q->never = 1;
+        return 0;
+    }
+    if (r->kind == NODE_TRUE) {
+        return 0;
+    }
+
+    // top level tags and negated tags go to must / must_not, the rest of
+    // the operands stays in order
+    uint32_t  one = q->root;
+    uint32_t* kid = &one;
+    uint32_t  sz  = 1;
+    if (r->kind == NODE_AND) {
+        kid = q->kid + r->kid;
+        sz  = r->kid_sz;
+    }
+
+    uint32_t must_cap     = 0;
+    uint32_t must_not_cap = 0;
+    uint32_t base         = q->stack_sz;
+    uint32_t i            = 0;
+    for (; i < sz; ++i) {
+        query_node_t* y = &q->node[kid[i]];
+        if (y->kind == NODE_TAG) {
+            error |= push_u32(&q->must, &q->must_sz, &must_cap, y->id);
+        } else if (y->kind == NODE_NOT && q->node[q->kid[y->kid]].kind == NODE_TAG) {
+            error |= push_u32(&q->must_not, &q->must_not_sz, &must_not_cap, q->node[q->kid[y->kid]].id);
+        } else {
+            error |= push_u32(&q->stack, &q->stack_sz, &q->stack_cap, kid[i]);
+        }
+    }
+    if (error) {
+        return -2;
+    }
+
+    // what is left runs as an AND of its own
+    uint32_t rest = q->stack_sz - base;
+    if (rest) {
+        uint32_t n = q->root;
+        if (rest > 1) {
+            n = q->node_sz;
+            parser_t p = { .q = q };
+            if (new_node(&p, NODE_AND) == QUERY_NONE || set_kids(q, n, base) < 0) {
+                return -2;
+            }
+        } else {
+            n = q->stack[--q->stack_sz];
+        }
+        if (compile(q, n, 0, 0, 0) < 0) {
+            return -2;
+        }
+    }
+    q->stack_sz = base;
+    return 0;
+}
+
+// evaluation
+
+static inline bool has(const uint32_t* a, uint32_t sz, uint32_t v)
+{
+    while (sz) {
+        uint32_t h = sz / 2;
+        if (a[h] < v) {
+            a  += h + 1;
+            sz -= h + 1;
+        } else if (a[h] > v) {
+            sz = h;
+        } else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+bool query_run(const query_t* q, const uint32_t* tag, uint32_t tag_sz, uint64_t mask)
+{
+    bool     acc = 1;
+    uint32_t pc  = 0;
+    while (pc < q->op_sz) {
+        const query_op_t* o = &q->op[pc++];
+        switch (o->op) {
+        case OP_HAS:
+            acc = (mask >> (o->arg % 64) & 1) && has(tag, tag_sz, o->arg);
+            break;
+        case OP_NOT:
+            acc = !acc;
+            break;
+        case OP_JF:
+            pc = acc ? pc : o->arg;
+            break;
+        case OP_JT:
+            pc = acc ? o->arg : pc;
+            break;
+        }
+    }
+    return acc;
+}
+
+void query_free(query_t* q)
+{
+    free(q->buf);
+    free(q->node);
+    free(q->kid);
+    free(q->stack);
+    free(q->must);
+    free(q->must_not);
+    free(q->op);
+    memset(q, 0, sizeof(*q));
+}
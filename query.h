@@ -0,0 +1,68 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// boolean tag queries
+//
+//     query := or
+//        or := and { ("OR" | "|") and }
+//       and := not { ["AND" | "&"] not }
+//       not := ("NOT" | "!") not | "(" or ")" | tag
+//
+// tags next to each other are and-ed. query_plan() resolves the tags,
+// folds constants and orders the operands of every AND / OR so the ones
+// most likely to decide it, relative to their cost, are evaluated first.
+// Tags that every match must have or must not have are handed out as
+// must / must_not, the rest is compiled into a short circuiting program
+// run by query_run()
+
+#define QUERY_UNKNOWN UINT32_MAX
+
+typedef struct query_node_t query_node_t;
+typedef struct query_op_t   query_op_t;
+
+typedef struct query_t query_t;
+struct query_t {
+    char*         buf;       // copy of the expression, tag names point here
+    query_node_t* node;
+    uint32_t      node_sz;
+    uint32_t      node_cap;
+    uint32_t*     kid;       // children of all nodes, contiguous per node
+    uint32_t      kid_sz;
+    uint32_t      kid_cap;
+    uint32_t      root;
+    uint32_t*     stack;     // children of the nodes being built
+    uint32_t      stack_sz;
+    uint32_t      stack_cap;
+
+    // set by query_plan()
+    bool          never;     // nothing matches
+    uint32_t*     must;
+    uint32_t      must_sz;
+    uint32_t*     must_not;
+    uint32_t      must_not_sz;
+    query_op_t*   op;        // NULL if must / must_not decide alone
+    uint32_t      op_sz;
+    uint32_t      op_cap;
+
+    const char*   error;     // what query_parse() stumbled over
+    const char*   error_at;  // and where in the expression
+};
+
+// returns 0 on success, -1 with q->error set for a syntax error and -2 if
+// out of memory. q has to be freed with query_free() either way
+int query_parse(query_t* q, const char* expr);
+
+// resolve returns the id of a tag, or QUERY_UNKNOWN, and the fraction of
+// records carrying it. Returns 0 on success and -2 if out of memory
+int query_plan(query_t* q, uint32_t (*resolve)(const char* name, double* p));
+
+// tag is the sorted array of the record's tag ids, mask has bit id % 64
+// set for each of them
+bool query_run(const query_t* q, const uint32_t* tag, uint32_t tag_sz, uint64_t mask);
+
+void query_free(query_t* q);
+
+#endif
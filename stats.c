@@ -0,0 +1,325 @@
+#include "stats.h"
+
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+static const char* const hw_name[STATS_HW_MAX] = {
+    [STATS_CYCLES]        = "cycles",
+    [STATS_INSTRUCTIONS]  = "instructions",
+    [STATS_CACHE_MISSES]  = "cache_misses",
+    [STATS_BRANCH_MISSES] = "branch_misses",
+};
+
+static const uint64_t hw_config[STATS_HW_MAX] = {
+    [STATS_CYCLES]        = PERF_COUNT_HW_CPU_CYCLES,
+    [STATS_INSTRUCTIONS]  = PERF_COUNT_HW_INSTRUCTIONS,
+    [STATS_CACHE_MISSES]  = PERF_COUNT_HW_CACHE_MISSES,
+    [STATS_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static double seconds(struct timeval t)
+{
+    return t.tv_sec + t.tv_usec / 1e6;
+}
+
+static uint64_t heap_in_use(void)
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 m = mallinfo2();
+    return m.uordblks + m.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+// the counter scaled up for the time it was not scheduled on the pmu
+static uint64_t hw_read(int fd)
+{
+    uint64_t v[3] = { 0, 0, 0 };  // value, time enabled, time running
+    if (read(fd, v, sizeof(v)) != sizeof(v) || !v[2]) {
+        return 0;
+    }
+    return v[2] < v[1] ? (uint64_t)((double)v[0] * v[1] / v[2]) : v[0];
+}
+
+static void sample(stats_t* s, stats_sample_t* x)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    x->wall = t.tv_sec + t.tv_nsec / 1e9;
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    x->user    = seconds(ru.ru_utime);
+    x->sys     = seconds(ru.ru_stime);
+    x->minflt  = ru.ru_minflt;
+    x->majflt  = ru.ru_majflt;
+    x->inblock = ru.ru_inblock;
+    x->oublock = ru.ru_oublock;
+
+    uint32_t i = 0;
+    for (; i < STATS_HW_MAX; ++i) {
+        x->hw[i] = s->hw_fd[i] < 0 ? 0 : hw_read(s->hw_fd[i]);
+    }
+}
+
+void stats_init(stats_t* s)
+{
+    memset(s, 0, sizeof(*s));
+    uint32_t i = 0;
+    for (; i < STATS_HW_MAX; ++i) {
+        s->hw_fd[i] = -1;
+    }
+    sample(s, &s->last);
+}
+
+void stats_hw(stats_t* s)
+{
+    uint32_t i = 0;
+    for (; i < STATS_HW_MAX; ++i) {
+        if (s->hw_fd[i] >= 0) {
+            continue;
+        }
+        struct perf_event_attr a = {
+            .type           = PERF_TYPE_HARDWARE,
+            .size           = sizeof(a),
+            .config         = hw_config[i],
+            .read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+            .inherit        = 1,
+            .exclude_kernel = 1,
+            .exclude_hv     = 1,
+        };
+        s->hw_fd[i]   = syscall(SYS_perf_event_open, &a, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        s->last.hw[i] = 0;
+    }
+}
+
+void stats_mark(stats_t* s, const char* phase)
+{
+    stats_sample_t now;
+    sample(s, &now);
+
+    uint32_t i = 0;
+    for (; i < s->phase_sz && strcmp(s->phase[i].name, phase) != 0; ++i) {  }
+    if (i == STATS_MAX) {
+        s->last = now;
+        return;
+    }
+    if (i == s->phase_sz) {
+        memset(&s->phase[i], 0, sizeof(s->phase[i]));
+        s->phase[i].name = phase;
+        s->phase_sz     += 1;
+    }
+
+    stats_phase_t* p = &s->phase[i];
+    p->wall    += now.wall - s->last.wall;
+    p->user    += now.user - s->last.user;
+    p->sys     += now.sys - s->last.sys;
+    p->minflt  += now.minflt - s->last.minflt;
+    p->majflt  += now.majflt - s->last.majflt;
+    p->inblock += now.inblock - s->last.inblock;
+    p->oublock += now.oublock - s->last.oublock;
+    p->heap     = heap_in_use();
+    for (i = 0; i < STATS_HW_MAX; ++i) {
+        p->hw[i] += now.hw[i] - s->last.hw[i];
+    }
+    s->last = now;
+}
+
+void stats_set(stats_t* s, const char* name, uint64_t v)
+{
+    uint32_t i = 0;
+    for (; i < s->counter_sz && strcmp(s->counter_name[i], name) != 0; ++i) {  }
+    if (i == STATS_MAX) {
+        return;
+    }
+    s->counter_name[i] = name;
+    s->counter[i]      = v;
+    s->counter_sz     += i == s->counter_sz;
+}
+
+// rchar / wchar count all bytes passed to read() and write(), read_bytes /
+// write_bytes what reached the storage. Missing without procfs
+typedef struct io_t io_t;
+struct io_t {
+    uint64_t rchar;
+    uint64_t wchar;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+};
+
+static void read_io(io_t* io)
+{
+    memset(io, 0, sizeof(*io));
+    FILE* f = fopen("/proc/self/io", "r");
+    if (!f) {
+        return;
+    }
+
+    char               key[32];
+    unsigned long long v = 0;
+    while (fscanf(f, "%31[^:]: %llu\n", key, &v) == 2) {
+        if (strcmp(key, "rchar") == 0) {
+            io->rchar = v;
+        } else if (strcmp(key, "wchar") == 0) {
+            io->wchar = v;
+        } else if (strcmp(key, "read_bytes") == 0) {
+            io->read_bytes = v;
+        } else if (strcmp(key, "write_bytes") == 0) {
+            io->write_bytes = v;
+        }
+    }
+    fclose(f);
+}
+
+static bool has_hw(stats_t* s, uint32_t i)
+{
+    return s->hw_fd[i] >= 0;
+}
+
+static long max_rss(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+void stats_print(stats_t* s, FILE* f)
+{
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    fprintf(f, "%-8s %10s %10s %10s %8s %8s %8s %8s %10s",
+            "phase", "wall_ms", "user_ms", "sys_ms", "minflt", "majflt", "inblock", "oublock", "heap_kb");
+    for (j = 0; j < STATS_HW_MAX; ++j) {
+        if (has_hw(s, j)) {
+            fprintf(f, " %14s", hw_name[j]);
+        }
+    }
+    fputc('\n', f);
+
+    stats_phase_t total = { .name = "total" };
+    for (i = 0; i <= s->phase_sz; ++i) {
+        stats_phase_t* p = i < s->phase_sz ? &s->phase[i] : &total;
+        if (p != &total) {
+            total.wall    += p->wall;
+            total.user    += p->user;
+            total.sys     += p->sys;
+            total.minflt  += p->minflt;
+            total.majflt  += p->majflt;
+            total.inblock += p->inblock;
+            total.oublock += p->oublock;
+            total.heap     = p->heap > total.heap ? p->heap : total.heap;
+            for (j = 0; j < STATS_HW_MAX; ++j) {
+                total.hw[j] += p->hw[j];
+            }
+        }
+
+        fprintf(f, "%-8s %10.3f %10.3f %10.3f %8llu %8llu %8llu %8llu %10llu",
+                p->name, p->wall * 1e3, p->user * 1e3, p->sys * 1e3,
+                (unsigned long long)p->minflt, (unsigned long long)p->majflt,
+                (unsigned long long)p->inblock, (unsigned long long)p->oublock,
+                (unsigned long long)p->heap / 1024);
+        for (j = 0; j < STATS_HW_MAX; ++j) {
+            if (has_hw(s, j)) {
+                fprintf(f, " %14llu", (unsigned long long)p->hw[j]);
+            }
+        }
+        fputc('\n', f);
+    }
+
+    io_t io;
+    read_io(&io);
+    for (i = 0; i < s->counter_sz; ++i) {
+        fprintf(f, "%s %llu\n", s->counter_name[i], (unsigned long long)s->counter[i]);
+    }
+    fprintf(f, "maxrss_kb %ld\nrchar %llu\nwchar %llu\nread_bytes %llu\nwrite_bytes %llu\n",
+            max_rss(),
+            (unsigned long long)io.rchar, (unsigned long long)io.wchar,
+            (unsigned long long)io.read_bytes, (unsigned long long)io.write_bytes);
+}
+
+static void json_str(FILE* f, const char* s)
+{
+    fputc('"', f);
+    for (; *s; ++s) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+void stats_json(stats_t* s, FILE* f, int argc, char** argv)
+{
+    uint32_t i = 0;
+    uint32_t j = 0;
+
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    fprintf(f, "{\"time\":%lld.%03ld,\"pid\":%ld,\"argv\":[", (long long)t.tv_sec, t.tv_nsec / 1000000, (long)getpid());
+    for (i = 0; i < (uint32_t)argc; ++i) {
+        if (i) {
+            fputc(',', f);
+        }
+        json_str(f, argv[i]);
+    }
+
+    fputs("],\"phases\":[", f);
+    for (i = 0; i < s->phase_sz; ++i) {
+        stats_phase_t* p = &s->phase[i];
+        fprintf(f, "%s{\"name\":", i ? "," : "");
+        json_str(f, p->name);
+        fprintf(f, ",\"wall_ms\":%.3f,\"user_ms\":%.3f,\"sys_ms\":%.3f,\"minflt\":%llu,\"majflt\":%llu,"
+                   "\"inblock\":%llu,\"oublock\":%llu,\"heap\":%llu",
+                p->wall * 1e3, p->user * 1e3, p->sys * 1e3,
+                (unsigned long long)p->minflt, (unsigned long long)p->majflt,
+                (unsigned long long)p->inblock, (unsigned long long)p->oublock,
+                (unsigned long long)p->heap);
+        for (j = 0; j < STATS_HW_MAX; ++j) {
+            if (has_hw(s, j)) {
+                fprintf(f, ",\"%s\":%llu", hw_name[j], (unsigned long long)p->hw[j]);
+            }
+        }
+        fputc('}', f);
+    }
+    fputc(']', f);
+
+    for (i = 0; i < s->counter_sz; ++i) {
+        fputc(',', f);
+        json_str(f, s->counter_name[i]);
+        fprintf(f, ":%llu", (unsigned long long)s->counter[i]);
+    }
+
+    io_t io;
+    read_io(&io);
+    fprintf(f, ",\"maxrss_kb\":%ld,\"rchar\":%llu,\"wchar\":%llu,\"read_bytes\":%llu,\"write_bytes\":%llu}\n",
+            max_rss(),
+            (unsigned long long)io.rchar, (unsigned long long)io.wchar,
+            (unsigned long long)io.read_bytes, (unsigned long long)io.write_bytes);
+}
+
+void stats_free(stats_t* s)
+{
+    uint32_t i = 0;
+    for (; i < STATS_HW_MAX; ++i) {
+        if (s->hw_fd[i] >= 0) {
+            close(s->hw_fd[i]);
+            s->hw_fd[i] = -1;
+        }
+    }
+}
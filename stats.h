@@ -0,0 +1,83 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// phase and resource accounting of a single invocation. stats_mark() charges
+// everything since the previous mark to a phase: wall clock, user and system
+// time of all threads, page faults, block i/o, the heap in use at its end
+// and, if the kernel lets us, hardware counters. Named counters are set by
+// the caller, the report adds peak RSS and the bytes the process read and
+// wrote, as text or as a line of JSON
+//
+// a mark for a phase that already has one adds to it
+
+#define STATS_MAX 16
+
+typedef enum {
+    STATS_CYCLES = 0,
+    STATS_INSTRUCTIONS,
+    STATS_CACHE_MISSES,
+    STATS_BRANCH_MISSES,
+    STATS_HW_MAX,
+} stats_hw_t;
+
+typedef struct stats_phase_t stats_phase_t;
+struct stats_phase_t {
+    const char* name;
+    double      wall;  // seconds
+    double      user;
+    double      sys;
+    uint64_t    minflt;
+    uint64_t    majflt;
+    uint64_t    inblock;
+    uint64_t    oublock;
+    uint64_t    heap;  // bytes allocated at the end of the phase
+    uint64_t    hw[STATS_HW_MAX];
+};
+
+// running totals of the process
+typedef struct stats_sample_t stats_sample_t;
+struct stats_sample_t {
+    double   wall;
+    double   user;
+    double   sys;
+    uint64_t minflt;
+    uint64_t majflt;
+    uint64_t inblock;
+    uint64_t oublock;
+    uint64_t hw[STATS_HW_MAX];
+};
+
+typedef struct stats_t stats_t;
+struct stats_t {
+    stats_phase_t  phase[STATS_MAX];
+    uint32_t       phase_sz;
+    const char*    counter_name[STATS_MAX];
+    uint64_t       counter[STATS_MAX];
+    uint32_t       counter_sz;
+    stats_sample_t last;                 // at the previous mark
+    int            hw_fd[STATS_HW_MAX];  // -1 if not available
+};
+
+// starts counting, without hardware counters
+void stats_init(stats_t* s);
+
+// opens the hardware counters, the ones the kernel refuses are left out.
+// They count from here on, threads started later included
+void stats_hw(stats_t* s);
+
+void stats_mark(stats_t* s, const char* phase);
+
+// the name has to outlive s
+void stats_set(stats_t* s, const char* name, uint64_t v);
+
+void stats_print(stats_t* s, FILE* f);
+
+// one JSON object and a newline, argv is the command line
+void stats_json(stats_t* s, FILE* f, int argc, char** argv);
+
+void stats_free(stats_t* s);
+
+#endif
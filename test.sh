@@ -0,0 +1,899 @@
+#!/bin/sh
+# regression tests, one line per case:
+#
+#     ok|FAIL  case
+#
+# usage: test.sh <ficor binary> [<gen binary>]
+# TEST_DIR sets the scratch directory, it is removed afterwards. Exits 1 if a
+# case failed
+
+ficor=$(realpath "$1")
+gen=${2:+$(realpath "$2")}
+
+dir=${TEST_DIR:-$(mktemp -d)}
+mkdir -p "$dir"
+trap 'rm -rf "$dir"' EXIT
+
+failed=0
+
+pass() {
+    printf "ok\t%s\n" "$1"
+}
+
+fail() {
+    printf "FAIL\t%s\n" "$1"
+    failed=$((failed + 1))
+}
+
+# section <name>: the following cases run in a fresh directory of their own
+section() {
+    cd "$dir" && mkdir "$1" && cd "$1" || exit 1
+}
+
+# check <case> <expected stdout> <command...>: the command succeeds and prints
+# exactly the expected lines
+check() {
+    name=$1
+    want=$2
+    shift 2
+    if got=$("$@" 2> "$dir/stderr") && [ "$got" = "$want" ]; then
+        pass "$name"
+    else
+        fail "$name"
+        printf "%s\n" "$want" > "$dir/want"
+        printf "%s\n" "$got" > "$dir/got"
+        diff "$dir/want" "$dir/got" | sed 's/^/    /'
+        sed 's/^/    stderr: /' "$dir/stderr"
+    fi
+}
+
+# refuses <case> <command...>: the command fails
+refuses() {
+    name=$1
+    shift
+    if "$@" > /dev/null 2>&1; then
+        fail "$name"
+    else
+        pass "$name"
+    fi
+}
+
+# same <case> <file> <file>: both files have the same bytes
+same() {
+    if cmp -s "$2" "$3"; then
+        pass "$1"
+    else
+        fail "$1"
+    fi
+}
+
+lines() {
+    printf "%s\n" "$@"
+}
+
+# count <command...>: the number of lines the command prints
+count() {
+    "$@" | wc -l | tr -d ' '
+}
+
+# records are used in place from the mapped file
+section mapped
+"$ficor" --init
+"$ficor" --add-file a.jpg -t photo:raw --set-info "hello world"
+"$ficor" --add-file b.jpg -t photo
+"$ficor" --add-file c.txt --set-info "no tags"
+
+check list    "$(lines a.jpg b.jpg c.txt)" "$ficor"
+check tags    "$(lines "a.jpg photo:raw" "b.jpg photo" "c.txt")" "$ficor" --tags
+check info    "$(lines "a.jpg hello world" "b.jpg" "c.txt no tags")" "$ficor" --info
+check include "$(lines a.jpg b.jpg)" "$ficor" -i photo
+check exclude "$(lines b.jpg c.txt)" "$ficor" -e raw
+
+"$ficor" --add-tag c.txt -t doc
+"$ficor" --rm-tag a.jpg -t raw
+"$ficor" --rm-file b.jpg
+check   mutated         "$(lines "a.jpg photo" "c.txt doc")" "$ficor" --tags
+refuses rm-missing      "$ficor" --rm-file b.jpg
+refuses add-tag-missing "$ficor" --add-tag b.jpg -t x
+
+"$ficor" --config other --init
+"$ficor" --config other --add-file d.txt -t doc
+check config           "$(lines d.txt)" "$ficor" --config other -i doc
+check config-untouched "$(lines c.txt)" "$ficor" -i doc
+check dump             "$(printf 'd.txt\nName:\n\td.txt\nInfo:\nTags:\n\tdoc\n')" "$ficor" --config other --dump
+
+# mutations are journaled behind the snapshot and replayed on load
+section journal
+"$ficor" --init
+"$ficor" --add-file a -t x:y --set-info "first"
+"$ficor" --add-file b -t y
+"$ficor" --add-file c -t x
+"$ficor" --compact
+"$ficor" --add-file d -t y
+"$ficor" --rm-file b
+"$ficor" --rm-tag a -t y
+"$ficor" --add-tag c -t y
+
+check replay         "$(lines "a x" "c x:y" "d y")" "$ficor" --tags
+check replay-info    "$(lines "a first" c d)" "$ficor" --info
+check replay-include "$(lines c d)" "$ficor" -i y
+
+cp .ficor before
+"$ficor" > /dev/null
+"$ficor" --tags -i x -e y > /dev/null
+same read-only-writes-nothing before .ficor
+
+"$ficor" --compact
+check compacted "$(lines "a x" "c x:y" "d y")" "$ficor" --tags
+"$ficor" --rm-file a
+"$ficor" --rm-file d
+check rm-after-compact "$(lines "c x:y")" "$ficor" --tags
+
+# a torn last entry is dropped, the ones before it stay
+"$ficor" --add-file e -t x
+"$ficor" --add-file f -t x
+sz=$(wc -c < .ficor)
+head -c $((sz - 3)) .ficor > torn
+mv torn .ficor
+check torn-tail "$(lines c e)" "$ficor" -i x
+"$ficor" --add-file g -t x 2> /dev/null
+check after-torn-tail "$(lines c e g)" "$ficor" -i x
+
+# tags are interned, records match on id masks before their tag arrays
+section dictionary
+"$ficor" --init
+i=0
+while [ "$i" -lt 70 ]; do
+    "$ficor" --add-file "f$i" -t "all:t$i"
+    i=$((i + 1))
+done
+
+# more tags than mask bits, t65 shares its bit with t1
+check mask-collision         "$(lines f65)" "$ficor" -i t65
+check mask-collision-exclude 69 count "$ficor" -i all -e t65
+check include-two            "$(lines f7)" "$ficor" -i all:t7
+check include-unknown        "" "$ficor" -i no-such-tag
+check exclude-unknown        70 count "$ficor" -e no-such-tag
+
+# compaction drops the tags nobody carries anymore and renumbers the rest
+"$ficor" --rm-tag f3 -t t3
+"$ficor" --rm-file f4
+"$ficor" --compact
+check unused-tag-dropped "" "$ficor" -i t3
+check renumbered         69 count "$ficor" -i all
+check tag-removed        "$(lines "f3 all")" sh -c '"$1" --tags | grep "^f3 "' sh "$ficor"
+check renumbered-last    "$(lines "f69 all:t69")" "$ficor" --tags -i t69
+
+# tags print in the order the database first saw them, not as given
+"$ficor" --add-file g -t t9:all
+check tag-order         "$(lines "g all:t9")" "$ficor" --get g --tags
+check tag-order-compact "$(lines "g all:t9")" sh -c '"$1" --compact && "$1" --get g --tags' sh "$ficor"
+
+# -i intersects the posting lists of the snapshot and the journal's additions
+section postings
+"$ficor" --init
+for f in a b c d e f; do
+    "$ficor" --add-file "$f" -t common
+done
+"$ficor" --add-tag b -t rare
+"$ficor" --add-tag d -t rare:mid
+"$ficor" --add-tag e -t mid
+"$ficor" --compact
+
+check snapshot-lists "$(lines d)" "$ficor" -i rare:mid:common
+"$ficor" --add-tag f -t rare:mid
+"$ficor" --add-file g -t mid:rare
+check journal-added "$(lines d f g)" "$ficor" -i mid:rare
+"$ficor" --rm-tag d -t rare
+"$ficor" --rm-file f
+check stale-entries   "$(lines g)" "$ficor" -i rare:mid
+check include-exclude "$(lines b)" "$ficor" -i rare -e mid
+check exclude-only    "$(lines a c)" "$ficor" -e rare:mid
+"$ficor" --compact
+check rebuilt-lists "$(lines d e g)" "$ficor" -i mid
+
+# paths and tag names are found through hash tables kept in the snapshot
+section hash
+"$ficor" --init
+"$ficor" --add-file a -t x --set-info "of a"
+"$ficor" --add-file b -t y
+"$ficor" --compact
+
+refuses duplicate-path "$ficor" --add-file a
+check   get            "a" "$ficor" --get a
+check   get-tags-info  "a of a x" "$ficor" --get a --tags --info
+refuses get-missing    "$ficor" --get c
+
+# the snapshot's tables outgrow their mapping
+i=0
+while [ "$i" -lt 40 ]; do
+    "$ficor" --add-file "g$i" -t "tag$i"
+    i=$((i + 1))
+done
+check grown-path "g39 tag39" "$ficor" --get g39 --tags
+check grown-tag  "$(lines g17)" "$ficor" -i tag17
+
+# removal shifts the following slots back, readding finds a free one
+"$ficor" --rm-file g20
+"$ficor" --rm-file a
+refuses removed-path "$ficor" --get g20
+check   kept-path    "g21" "$ficor" --get g21
+"$ficor" --add-file a -t z
+check readded "a z" "$ficor" --get a --tags
+"$ficor" --compact
+check compacted-tables "$(lines "b y" "g21 tag21" "a z")" sh -c '"$1" --get b --tags && "$1" --get g21 --tags && "$1" --get a --tags' sh "$ficor"
+
+# --batch applies many commands and commits them once
+section batch
+"$ficor" --init
+printf 'add-file\ta\tx:y\tinfo of a\nadd-file\tb\ty\n# a comment\n\nadd-file\tc\nadd-tag\tc\tz\nrm-tag\ta\ty\nrm-file\tb\n' > cmds
+check batch        "" "$ficor" --batch cmds
+check batch-result "$(lines "a info of a x" "c z")" "$ficor" --tags --info
+
+# failing lines are skipped and make the batch fail
+printf 'add-file\td\tx\nrm-file\tnope\nbogus\td\nadd-file\n' > bad
+refuses batch-failing "$ficor" --batch bad
+check   batch-partial "$(lines a d)" "$ficor" -i x
+
+printf 'add-file\te\tx\n' | "$ficor" --batch -
+printf 'add-file\tf g\tx\0rm-tag\ta\tx\0' | "$ficor" --batch - -0
+check   batch-stdin-null "$(lines d e "f g")" "$ficor" -i x
+refuses batch-missing    "$ficor" --batch no-such-file
+
+# invocations are forwarded to a daemon serving the database
+section daemon
+"$ficor" --init
+"$ficor" --add-file a -t x
+"$ficor" --serve 2> /dev/null &
+serving=$!
+i=0
+while [ ! -S .ficor.sock ] && [ "$i" -lt 50 ]; do
+    sleep 0.1
+    i=$((i + 1))
+done
+
+"$ficor" --add-file b -t x:y
+printf 'add-file\tc\ty\n' | "$ficor" --batch -
+check   daemon-list      "$(lines a b)" "$ficor" -i x
+check   daemon-stdin     "$(lines b c)" "$ficor" -i y
+check   daemon-get       "b x:y" "$ficor" --get b --tags
+refuses daemon-failing   "$ficor" --rm-file nope
+refuses daemon-duplicate "$ficor" --add-file a
+
+# queued changes are written when the daemon stops
+kill "$serving"
+wait "$serving"
+if [ -e .ficor.sock ]; then
+    fail daemon-socket-removed
+else
+    pass daemon-socket-removed
+fi
+check daemon-persisted "$(lines b c)" "$ficor" -i y
+
+# strings of every size class are freed and reused without mixing them up
+section arena
+"$ficor" --init
+: > cmds
+: > want
+i=1
+while [ "$i" -le 60 ]; do
+    info=$(printf "%$((i * 11))s" "" | tr ' ' "$(printf '\\%03o' $((97 + i % 26)))")
+    printf 'add-file\tf%s\tt%s:all\t%s\n' "$i" "$i" "$info" >> cmds
+    if [ $((i % 3)) -ne 0 ]; then
+        printf 'f%s %s\n' "$i" "$info" >> want
+    fi
+    i=$((i + 1))
+done
+"$ficor" --batch cmds
+i=3
+while [ "$i" -le 60 ]; do
+    printf 'rm-file\tf%s\n' "$i"
+    i=$((i + 3))
+done > rm
+"$ficor" --batch rm
+check arena-churn "$(cat want)" "$ficor" --info
+
+# the freed blocks are handed out again
+i=3
+while [ "$i" -le 60 ]; do
+    printf 'add-file\tf%s\tall\n' "$i" >> readd
+    printf 'f%s\n' "$i" >> want
+    i=$((i + 3))
+done
+"$ficor" --batch readd
+check arena-reused "$(cat want)" "$ficor" --info
+"$ficor" --compact
+check arena-compacted "$(cat want)" "$ficor" --info
+check arena-tags      60 count "$ficor" -i all
+
+# output goes through one buffer, longer strings around it
+section output
+"$ficor" --init
+i=0
+while [ "$i" -lt 4000 ]; do
+    printf 'add-file\tdirectory-with-a-long-name/file-%s\tall\n' "$i"
+    i=$((i + 1))
+done > cmds
+big=$(printf "%300000s" "" | tr ' ' b)
+printf 'add-file\tbig\tlarge\t%s\n' "$big" >> cmds
+"$ficor" --batch cmds
+
+check output-many   4000 count "$ficor" -i all
+check output-last   "directory-with-a-long-name/file-3999" sh -c '"$1" -i all | tail -n 1' sh "$ficor"
+check output-long   "big $big" "$ficor" -i large --info
+check output-null   "$(printf 'big.')" sh -c '"$1" -i large -0 | tr "\0" .' sh "$ficor"
+check output-closed "directory-with-a-long-name/file-0" sh -c '"$1" | head -n 1' sh "$ficor"
+check output-get    "big large" "$ficor" --get big --tags
+
+# a scan split across threads prints what a serial one prints
+section jobs
+"$ficor" --init
+i=0
+while [ "$i" -lt 5000 ]; do
+    printf 'add-file\tf%s\tt%s:u%s\n' "$i" $((i % 7)) $((i % 3))
+    i=$((i + 1))
+done > cmds
+"$ficor" --batch cmds
+printf 'rm-file\tf%s\n' 10 2000 4999 > rm
+"$ficor" --batch rm
+
+for args in "" "-i t3" "-e u1" "-i t2:u0 -e t5"; do
+    "$ficor" -j 1 $args > serial
+    "$ficor" -j 7 $args > parallel
+    same "jobs${args:+ $args}" serial parallel
+done
+check jobs-count 713 count "$ficor" -j 5 -i t3
+
+# records with more tags than one vector step, matched against shell arithmetic
+section match
+"$ficor" --init
+common=c0:c1:c2:c3:c4:c5:c6:c7:c8:c9:c10:c11
+i=0
+while [ "$i" -lt 256 ]; do
+    tags=$common
+    k=0
+    while [ "$k" -lt 8 ]; do
+        if [ $(((i >> k) & 1)) -eq 1 ]; then
+            tags="$tags:b$k"
+        fi
+        k=$((k + 1))
+    done
+    printf 'add-file\tf%s\t%s\n' "$i" "$tags"
+    i=$((i + 1))
+done > cmds
+"$ficor" --batch cmds
+
+# expect <include mask> <exclude mask>: the files whose bits match
+expect() {
+    i=0
+    while [ "$i" -lt 256 ]; do
+        if [ $((i & $1)) -eq "$1" ] && [ $((i & $2)) -eq 0 ]; then
+            echo "f$i"
+        fi
+        i=$((i + 1))
+    done
+}
+
+check match-include "$(expect 10 0)" "$ficor" -i b1:b3
+check match-exclude "$(expect 0 160)" "$ficor" -e b5:b7
+check match-both    "$(expect 129 6)" "$ficor" -i b0:b7:c3 -e b1:b2
+check match-common  256 count "$ficor" -i c11:c0
+check match-none    "" "$ficor" -i c4 -e c9
+
+# -q queries against every combination of four tags
+section query
+"$ficor" --init
+i=0
+while [ "$i" -lt 16 ]; do
+    tags=all
+    k=0
+    while [ "$k" -lt 4 ]; do
+        if [ $(((i >> k) & 1)) -eq 1 ]; then
+            tags="$tags:b$k"
+        fi
+        k=$((k + 1))
+    done
+    printf 'add-file\tf%s\t%s\n' "$i" "$tags"
+    i=$((i + 1))
+done > cmds
+"$ficor" --batch cmds
+
+check   query-and          "$(lines f3 f7 f11 f15)" "$ficor" -q "b0 AND b1"
+check   query-or           "$(lines f1 f2 f3 f5 f6 f7 f9 f10 f11 f13 f14 f15)" "$ficor" -q "b0 OR b1"
+check   query-not          "$(lines f0 f2 f4 f6 f8 f10 f12 f14)" "$ficor" -q "NOT b0"
+check   query-precedence   "$(lines f3 f4 f5 f6 f7 f11 f12 f13 f14 f15)" "$ficor" -q "b0 AND b1 OR b2"
+check   query-grouping     "$(lines f5 f7 f13 f15)" "$ficor" -q "b0 AND (b1 OR b2) AND NOT b1 OR b0 AND b1 AND b2"
+check   query-nested       "$(lines f8 f9 f10 f12 f13)" "$ficor" -q "b3 AND NOT (b0 AND b1 OR b2 AND b1)"
+check   query-unknown      "" "$ficor" -q "all AND no-such-tag"
+check   query-not-unknown  16 count "$ficor" -q "NOT no-such-tag"
+check   query-with-include "$(lines f6 f14)" "$ficor" -i b1 -q "b2 AND NOT b0"
+refuses query-unbalanced   "$ficor" -q "(b0 AND b1"
+refuses query-dangling     "$ficor" -q "b0 AND"
+refuses query-empty        "$ficor" -q ""
+
+# the generator's output is deterministic and imports cleanly
+if [ -n "$gen" ]; then
+    section gen
+    "$gen" -n 500 -s 7 > a
+    "$gen" -n 500 -s 7 > b
+    "$gen" -n 500 -s 8 > c
+    same gen-deterministic a b
+    if cmp -s a c; then
+        fail gen-seeded
+    else
+        pass gen-seeded
+    fi
+    check gen-records 500 count cat a
+    "$ficor" --init
+    check gen-import   "" "$ficor" --batch a
+    check gen-imported 500 count "$ficor"
+    "$gen" -n 200 -t 5 -k 2 -d zipf -i 0 -p 40 > d
+    check gen-options 200 count cat d
+fi
+
+# a packed snapshot answers exactly like the mapped one
+section packed
+"$ficor" --init
+i=0
+while [ "$i" -lt 3000 ]; do
+    printf 'add-file\tdir%s/sub/file-%s\tt%s:u%s\tinfo %s\n' $((i % 13)) "$i" $((i % 5)) $((i % 4)) "$i"
+    i=$((i + 1))
+done > cmds
+"$ficor" --batch cmds
+"$ficor" --rm-file dir3/sub/file-3
+"$ficor" --compact
+
+# outputs <name>: every listing the checks below compare
+outputs() {
+    "$ficor" --tags --info > "$1.all"
+    "$ficor" -i t2 -e u1 > "$1.filter"
+    "$ficor" --get dir11/sub/file-2000 --tags --info > "$1.get"
+}
+
+outputs mapped
+cp .ficor mapped
+"$ficor" --format packed
+outputs packed
+same packed-list   mapped.all packed.all
+same packed-filter mapped.filter packed.filter
+same packed-get    mapped.get packed.get
+if [ "$(wc -c < .ficor)" -lt "$(wc -c < mapped)" ]; then
+    pass packed-smaller
+else
+    fail packed-smaller
+fi
+
+# the journal follows a packed snapshot, compaction keeps it packed
+"$ficor" --add-file new -t t2
+"$ficor" --rm-file dir0/sub/file-0
+"$ficor" --add-tag dir1/sub/file-1 -t extra
+outputs journal
+"$ficor" --compact
+outputs compacted
+same packed-compacted journal.all compacted.all
+"$ficor" --format mapped
+outputs remapped
+same  packed-remapped        journal.all remapped.all
+same  packed-remapped-filter journal.filter remapped.filter
+check packed-mutations       "$(lines "new t2" "dir1/sub/file-1 t1:u1:extra")" sh -c '"$1" --get new --tags && "$1" --get dir1/sub/file-1 --tags' sh "$ficor"
+
+# listings stream a snapshot without a journal, block by block
+section stream
+"$ficor" --init
+i=0
+while [ "$i" -lt 10000 ]; do
+    printf 'add-file\tz%s\tt%s:u%s\n' $((9999 - i)) $((i % 6)) $((i % 5))
+    i=$((i + 1))
+done > cmds
+"$ficor" --batch cmds
+
+for format in packed mapped; do
+    "$ficor" --format "$format"
+    "$ficor" --tags > streamed.all
+    "$ficor" -i t1 -e u2 > streamed.filter
+    "$ficor" -q "t3 OR u4" -j 3 > streamed.query
+    # a journal that changes nothing makes it load instead
+    "$ficor" --add-file extra
+    "$ficor" --rm-file extra
+    "$ficor" --tags > loaded.all
+    "$ficor" -i t1 -e u2 > loaded.filter
+    "$ficor" -q "t3 OR u4" -j 3 > loaded.query
+    same "stream-$format"        loaded.all streamed.all
+    same "stream-$format-filter" loaded.filter streamed.filter
+    same "stream-$format-query"  loaded.query streamed.query
+done
+check stream-order "$(lines z9999 z9998)" sh -c '"$1" | head -n 2' sh "$ficor"
+
+# --add-tree adds what is below a directory and not in the database yet
+section tree
+"$ficor" --init
+mkdir -p photos/2020/raw photos/2021 photos/empty
+touch photos/2020/a.jpg photos/2020/raw/a.cr2 photos/2021/b.jpg photos/2021/notes.txt photos/top.png
+ln -s 2021/b.jpg photos/link.jpg
+ln -s 2020 photos/linkdir
+"$ficor" --add-file photos/2021/b.jpg -t kept
+printf '*.jpg\tjpeg\n2020/raw/*\traw:old\n*.txt\tdoc\n' > rules
+
+check tree-add   "" "$ficor" --add-tree photos -t photo --tag-rules rules --set-info imported
+check tree-files "$(lines "photos/2021/b.jpg kept" "photos/2020/a.jpg photo:jpeg" "photos/2020/raw/a.cr2 photo:raw:old" "photos/2021/notes.txt photo:doc" "photos/link.jpg photo:jpeg" "photos/linkdir photo" "photos/top.png photo")" "$ficor" --tags
+check tree-info  "photos/top.png imported" "$ficor" --get photos/top.png --info
+check tree-again "" "$ficor" --add-tree photos
+check tree-count 7 count "$ficor"
+touch photos/2021/c.jpg
+"$ficor" --add-tree photos/ -j 3 --tag-rules rules
+check   tree-new     "$(lines "photos/2021/c.jpg jpeg")" "$ficor" --tags -i jpeg -e photo
+refuses tree-missing "$ficor" --add-tree no-such-dir
+
+# concurrent writers queue on the lock, none loses another's change
+section lock
+"$ficor" --init
+i=0
+while [ "$i" -lt 20 ]; do
+    if [ $((i % 4)) -eq 0 ]; then
+        "$ficor" --no-daemon --add-file "w$i" -t w --compact 2> /dev/null &
+    else
+        "$ficor" --no-daemon --add-file "w$i" -t w 2> /dev/null &
+    fi
+    i=$((i + 1))
+done
+wait
+check lock-writers 20 count "$ficor" -i w
+
+# a compaction replaces the file with the same permissions
+chmod 640 .ficor
+"$ficor" --compact
+check lock-mode 640 stat -c %a .ficor
+
+# readers do not wait for a writer holding the lock
+if command -v flock > /dev/null; then
+    flock .ficor.lock sleep 2 &
+    holder=$!
+    sleep 0.5
+    check   lock-reader       20 count timeout 1 "$ficor" -i w
+    refuses lock-writer-waits timeout 1 "$ficor" --add-file late
+    wait "$holder"
+fi
+
+# --under and --glob look paths up in the sorted index
+section paths
+"$ficor" --init
+printf 'add-file\t%s\tt\n' p/a p/b/c p/b/d p2/e pa/f q/g "p/b c" > cmds
+"$ficor" --batch cmds
+"$ficor" --compact
+"$ficor" --add-file p/z -t t
+"$ficor" --add-file p/b/y -t t
+
+check under         "$(lines p/a p/b/c p/b/d "p/b c" p/z p/b/y)" "$ficor" --under p
+check under-slash   "$(lines p/a p/b/c p/b/d "p/b c" p/z p/b/y)" "$ficor" --under p/
+check under-deeper  "$(lines p/b/c p/b/d p/b/y)" "$ficor" --under p/b
+check under-none    "" "$ficor" --under r
+check glob          "$(lines p/a p/z)" "$ficor" --glob 'p/?'
+check glob-star     "$(lines p/b/c p/b/d p/b/y)" "$ficor" --glob 'p/b/*'
+check glob-class    "$(lines p2/e pa/f)" "$ficor" --glob 'p[2a]/*'
+check glob-no-slash "" "$ficor" --glob 'p*c'
+check glob-space    "$(lines "p/b c")" "$ficor" --glob 'p/b *'
+check under-glob    "$(lines p/b/d)" "$ficor" --under p/b --glob '*/*/d'
+
+# records removed since the snapshot stay in its path index, without a path
+"$ficor" --init
+printf 'add-file\t%s\tz\n' p/1 p/2 p/3 p/4 p/5 p/6 p/7 p/8 q/1 q/2 q/3 q/4 q/5 q/6 q/7 q/8 > cmds
+"$ficor" --batch cmds
+"$ficor" --compact
+printf 'rm-file\t%s\n' p/5 p/6 p/7 p/8 q/1 q/2 q/3 > cmds
+"$ficor" --batch cmds
+
+check under-removed "$(lines q/4 q/5 q/6 q/7 q/8)" "$ficor" --under q
+check glob-removed  "$(lines q/4 q/5 q/6 q/7 q/8)" "$ficor" --glob 'q/*'
+check under-left    "$(lines p/1 p/2 p/3 p/4)" "$ficor" --under p
+
+# --search finds every word of the text in the info, ignoring case
+section search
+"$ficor" --init
+printf 'add-file\t%s\tt\t%s\n' a "Holiday in Rome, 2019" b "rome office" c "Roman holiday" d "ro" e "" > cmds
+"$ficor" --batch cmds
+"$ficor" --compact
+
+check search           "$(lines a b)" "$ficor" --search rome
+check search-words     "$(lines a)" "$ficor" --search "HOLIDAY rome"
+check search-substring "$(lines a b c)" "$ficor" --search "rom"
+check search-short     "$(lines a b c d)" "$ficor" --search "ro"
+check search-none      "" "$ficor" --search "paris"
+
+# edits and additions since the snapshot are searched too
+"$ficor" --edit-file b --set-info "paris office"
+"$ficor" --edit-file a
+"$ficor" --add-file f -t t --set-info "rome again"
+printf 'set-info\tc\tRome by night\n' > edit
+"$ficor" --batch edit
+check search-journal "$(lines c f)" "$ficor" --search rome
+check search-edited  "$(lines b)" "$ficor" --search paris
+check edit-removed   "a" "$ficor" --get a --info
+"$ficor" --compact
+check search-compacted "$(lines c f)" "$ficor" --search rome
+"$ficor" --format packed
+check   search-packed "$(lines c f)" "$ficor" --search rome
+refuses edit-missing  "$ficor" --edit-file nope --set-info x
+
+# --tag-stats counts live files per tag, also after changes since compaction
+section stats
+"$ficor" --init
+printf 'add-file\t%s\t%s\n' a x:y b x:y c x:z d x e w > cmds
+"$ficor" --batch cmds
+"$ficor" --compact
+"$ficor" --rm-file b
+"$ficor" --rm-tag a -t y
+"$ficor" --add-tag e -t z
+
+check tag-stats        "$(printf 'x\t3\t75.00%%\tz (1)\nz\t2\t50.00%%\tx (1), w (1)\nw\t1\t25.00%%\tz (1)\n')" "$ficor" --tag-stats
+check tag-stats-counts "$(lines c e)" "$ficor" -i z
+"$ficor" --compact
+check tag-stats-compacted "$(printf 'x\t3\t75.00%%\tz (1)\nz\t2\t50.00%%\tx (1), w (1)\nw\t1\t25.00%%\tz (1)\n')" "$ficor" --tag-stats
+
+# --stats reports phases on stderr and leaves stdout alone
+section instrument
+"$ficor" --init
+printf 'add-file\t%s\tx\n' a b c > cmds
+"$ficor" --batch cmds
+
+check stats-stdout "$(lines a b c)" "$ficor" --stats -i x
+check stats-phases "$(lines parse load run total)" sh -c '"$1" --stats -i x 2>&1 > /dev/null | cut -d " " -f 1 | grep -x -e parse -e load -e run -e total' sh "$ficor"
+check stats-counts "$(lines "records 3" "printed 2")" sh -c '"$1" --stats --glob "[ab]" 2>&1 > /dev/null | grep -e "^records " -e "^printed "' sh "$ficor"
+FICOR_STATS=stats.json "$ficor" -i x > /dev/null
+FICOR_STATS=stats.json "$ficor" --add-file d -t x
+check stats-json      2 count cat stats.json
+check stats-json-argv 1 count grep -F '"argv":["'"$ficor"'","--add-file","d","-t","x"]' stats.json
+
+# listings page and sort
+section page
+"$ficor" --init
+printf 'add-file\t%s\t%s\n' m x:y:z b x d x:y a y > cmds
+"$ficor" --batch cmds
+"$ficor" --compact
+"$ficor" --add-file c -t x:y
+
+check   limit         "$(lines m b)" "$ficor" --limit 2
+check   offset        "$(lines d a c)" "$ficor" --offset 2
+check   offset-limit  "$(lines b d)" "$ficor" --offset 1 --limit 2
+check   offset-past   "" "$ficor" --offset 10
+check   limit-filter  "$(lines b)" "$ficor" -i x -e y --limit 5
+check   sort-path     "$(lines a b c d m)" "$ficor" --sort path
+check   sort-path-rev "$(lines m d c)" "$ficor" --sort -path --limit 3
+check   sort-tags     "$(lines m d c)" "$ficor" --sort -tags --limit 3
+check   sort-tags-asc "$(lines b a)" "$ficor" --sort tags --limit 2
+check   sort-time     "$(lines m b d a c)" "$ficor" --sort time
+check   sort-time-rev "$(lines c a)" "$ficor" --sort -time --limit 2
+check   sort-page     "$(lines c d)" "$ficor" --sort path -i x --offset 1 --limit 2
+refuses sort-unknown  "$ficor" --sort size
+
+# --across lists every database below a directory, in path order
+section across
+mkdir -p top/one top/two/deep top/empty
+cd top/one
+"$ficor" --init
+"$ficor" --add-file a -t x
+"$ficor" --add-file "$dir/across/abs" -t x
+cd ../two/deep
+"$ficor" --init
+"$ficor" --add-file b -t x:y
+"$ficor" --add-file c -t y
+cd ../../..
+
+check across        "$(lines top/one/a "$dir/across/abs" top/two/deep/b top/two/deep/c)" "$ficor" --across top
+check across-filter "$(lines top/two/deep/b top/two/deep/c)" "$ficor" --across top -i y
+check across-page   "$(lines "$dir/across/abs" top/two/deep/b)" "$ficor" --across top --offset 1 --limit 2
+check across-sort   "$(lines top/one/a "$dir/across/abs" top/two/deep/c top/two/deep/b)" "$ficor" --across top --sort -path
+check across-config "" "$ficor" --across top --config .other
+
+# a broken database is reported, the others are still listed
+echo broken > top/empty/.ficor
+check across-broken "$(lines top/one/a "$dir/across/abs" top/two/deep/b top/two/deep/c)" sh -c '"$1" --across top; [ $? -eq 1 ]' sh "$ficor"
+
+# cached listings answer like fresh ones and follow every change
+section cache
+"$ficor" --init
+printf 'add-file\t%s\t%s\n' a x:y b x c y > cmds
+"$ficor" --batch cmds
+
+# a listing writes nothing unless asked to
+check cache-off "$(lines a b)" "$ficor" -i x
+if [ -e .ficor.cache ]; then
+    fail cache-off-writes
+else
+    pass cache-off-writes
+fi
+check cache-miss "$(lines a)" "$ficor" --cache -i x:y
+if [ -e .ficor.cache ]; then
+    pass cache-writes
+else
+    fail cache-writes
+fi
+check cache-hit  "$(lines a)" "$ficor" --cache -i y:x:y
+"$ficor" --add-tag b -t y
+check cache-changed "$(lines a b)" "$ficor" --cache -i x:y
+"$ficor" --compact
+check cache-compacted "$(lines a b)" "$ficor" --cache -i x:y
+check cache-page      "$(lines b)" "$ficor" --cache -i x:y --offset 1
+
+# a database created again at the same path starts a new generation
+rm .ficor
+"$ficor" --init
+"$ficor" --add-file d -t x:y
+check cache-recreated "$(lines d)" "$ficor" --cache -i x:y
+
+# --fsck checks every block against its checksum
+section fsck
+"$ficor" --init
+i=0
+while [ "$i" -lt 100 ]; do
+    printf 'add-file\tf%s\tt%s\tinfo %s\n' "$i" $((i % 3)) "$i"
+    i=$((i + 1))
+done > cmds
+"$ficor" --batch cmds
+"$ficor" --compact
+"$ficor" --add-file extra -t t0
+
+check fsck-clean ".ficor: ok" sh -c '"$1" --fsck | tail -n 1' sh "$ficor"
+cp .ficor good
+
+# a byte inside the snapshot, in front of the journal
+printf '\377' | dd of=.ficor bs=1 seek=400 conv=notrunc 2> /dev/null
+refuses fsck-damaged "$ficor" --fsck
+check   fsck-report  ".ficor: damaged" sh -c '"$1" --fsck | tail -n 1' sh "$ficor"
+cp good .ficor
+
+# so is a damaged header
+printf '\377' | dd of=.ficor bs=1 seek=30 conv=notrunc 2> /dev/null
+refuses fsck-header "$ficor" --fsck
+refuses load-header "$ficor"
+cp good .ficor
+
+"$ficor" --format packed
+check fsck-packed ".ficor: ok" sh -c '"$1" --fsck | tail -n 1' sh "$ficor"
+sz=$(wc -c < .ficor)
+printf '\377' | dd of=.ficor bs=1 seek=$((sz / 2)) conv=notrunc 2> /dev/null
+refuses fsck-packed-damaged "$ficor" --fsck
+refuses load-packed-damaged "$ficor"
+
+# empty paths and tags are refused before they reach the journal
+section empty
+"$ficor" --init
+"$ficor" --add-file a -t x
+
+refuses empty-path     "$ficor" --add-file ""
+refuses empty-tag      "$ficor" --add-tag a -t ""
+refuses empty-tag-part "$ficor" --rm-tag a -t "x::y"
+refuses empty-tag-lead "$ficor" --add-file b -t ":x"
+printf 'add-file\t\tx\nadd-tag\ta\t\nadd-file\tc\tx\n' > cmds
+refuses empty-batch "$ficor" --batch cmds
+check   empty-loads "$(lines "a x" "c x")" "$ficor" --tags
+
+# --across holds no more files than children and leaves no cache behind
+section across-many
+i=0
+while [ "$i" -lt 40 ]; do
+    mkdir "db$i"
+    "$ficor" --config "db$i/.ficor" --init
+    "$ficor" --config "db$i/.ficor" --add-file f -t x
+    i=$((i + 1))
+done
+check across-many     40 count sh -c 'ulimit -n 24 && "$1" --across . -i x' sh "$ficor"
+check across-no-cache "" find . -name .ficor.cache
+
+# a client whose reader stalls does not hold up the others
+section daemon-stall
+"$ficor" --init
+i=0
+while [ "$i" -lt 5000 ]; do
+    printf 'add-file\tfile-with-a-name-long-enough-to-fill-a-pipe-%s\ty\n' "$i"
+    i=$((i + 1))
+done > cmds
+"$ficor" --batch cmds
+"$ficor" --add-file a -t x
+"$ficor" --serve 2> /dev/null &
+serving=$!
+i=0
+while [ ! -S .ficor.sock ] && [ "$i" -lt 50 ]; do
+    sleep 0.1
+    i=$((i + 1))
+done
+
+"$ficor" -i y | (sleep 2; cat > stalled) &
+reader=$!
+sleep 0.5
+check daemon-not-blocked "$(lines a)" timeout 1 "$ficor" -i x
+wait "$reader"
+check daemon-stalled-out 5000 count cat stalled
+kill "$serving"
+wait "$serving"
+
+# the daemon writes a change before it answers
+section daemon-ack
+"$ficor" --init
+"$ficor" --serve 2> /dev/null &
+serving=$!
+i=0
+while [ ! -S .ficor.sock ] && [ "$i" -lt 50 ]; do
+    sleep 0.1
+    i=$((i + 1))
+done
+
+"$ficor" --add-file a -t x
+printf 'add-file\tb\tx\n' | "$ficor" --batch -
+kill -9 "$serving"
+wait "$serving" 2> /dev/null
+rm -f .ficor.sock
+check daemon-written "$(lines a b)" "$ficor" -i x
+
+# a client still reading its stdin does not hold up the others
+section daemon-stdin
+"$ficor" --init
+"$ficor" --add-file a -t x
+"$ficor" --serve 2> /dev/null &
+serving=$!
+i=0
+while [ ! -S .ficor.sock ] && [ "$i" -lt 50 ]; do
+    sleep 0.1
+    i=$((i + 1))
+done
+
+(sleep 2; printf 'add-file\tb\tx\n') | "$ficor" --batch - &
+writer=$!
+sleep 0.5
+check daemon-not-blocked "$(lines a)" timeout 1 "$ficor" -i x
+wait "$writer"
+check daemon-stdin-read "$(lines a b)" "$ficor" -i x
+kill "$serving"
+wait "$serving"
+
+
+# a snapshot whose checksums were not checked yet is not trusted either: a
+# record pointing out of the heap, or at a tag that does not exist, is refused
+section corrupted
+"$ficor" --init
+printf 'add-file\t%s\tt0:t1\n' a b c > cmds
+"$ficor" --batch cmds
+"$ficor" --compact
+cp .ficor good
+
+# the tag array offset of the first record, 16 bytes into it after the
+# 184 byte header
+printf '\377\377\377\377\377\377\377\377' | dd of=.ficor bs=1 seek=200 conv=notrunc 2> /dev/null
+corrupted="Error: .ficor is corrupted. --fsck tells more"
+check corrupted-list  "$corrupted" sh -c '! "$1" 2>&1' sh "$ficor"
+check corrupted-tag   "$corrupted" sh -c '! "$1" -i t1 2>&1' sh "$ficor"
+check corrupted-dump  "$corrupted" sh -c '! "$1" --dump 2>&1' sh "$ficor"
+check corrupted-stats "Error: .ficor is corrupted in record 0. --fsck tells more" \
+      sh -c '! "$1" --tag-stats 2>&1' sh "$ficor"
+check corrupted-get   "Error: a not found" sh -c '! "$1" --get a 2>&1' sh "$ficor"
+check corrupted-other "$(lines b)" "$ficor" --get b
+cp good .ficor
+
+# the first tag id of the first record, in the heap at the offset of section 7
+heap=$(od -An -tu8 -j152 -N8 .ficor | tr -d ' ')
+tag=$(od -An -tu8 -j200 -N8 .ficor | tr -d ' ')
+printf '\377\377\377\177' | dd of=.ficor bs=1 seek=$((heap + tag)) conv=notrunc 2> /dev/null
+check corrupted-id      "$corrupted" sh -c '! "$1" -i t1 2>&1' sh "$ficor"
+check corrupted-id-tags "$corrupted" sh -c '! "$1" --tags 2>&1' sh "$ficor"
+check corrupted-id-rm   "$corrupted" sh -c '! "$1" --rm-file a 2>&1' sh "$ficor"
+check corrupted-id-list "$(lines a b c)" "$ficor"
+cp good .ficor
+check corrupted-restored "$(lines a b c)" "$ficor"
+
+
+# whatever the umask, only the owner can connect to the daemon
+section daemon-owner
+"$ficor" --init
+(umask 0; exec "$ficor" --serve 2> /dev/null) &
+serving=$!
+i=0
+while [ ! -S .ficor.sock ] && [ "$i" -lt 50 ]; do
+    sleep 0.1
+    i=$((i + 1))
+done
+
+check daemon-socket-mode "600" stat -c %a .ficor.sock
+kill "$serving"
+wait "$serving"
+
+cd "$dir"
+[ "$failed" -eq 0 ]
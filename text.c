@@ -0,0 +1,68 @@
+#include "text.h"
+
+#include <stdlib.h>
+
+static inline uint8_t fold(char c)
+{
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : (uint8_t)c;
+}
+
+static int cmp_gram(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// most infos are short, an insertion sort beats qsort() on them
+uint32_t text_grams(const char* s, size_t sz, uint32_t* gram)
+{
+    if (sz < 3) {
+        return 0;
+    }
+
+    uint32_t n = sz - 2;
+    uint32_t g = (uint32_t)fold(s[0]) << 8 | fold(s[1]);
+    uint32_t i = 0;
+    for (; i < n; ++i) {
+        g = (g << 8 | fold(s[i + 2])) & 0xffffff;
+        if (n > 64) {
+            gram[i] = g;
+            continue;
+        }
+        uint32_t j = i;
+        for (; j && gram[j - 1] > g; --j) {
+            gram[j] = gram[j - 1];
+        }
+        gram[j] = g;
+    }
+    if (n > 64) {
+        qsort(gram, n, sizeof(*gram), cmp_gram);
+    }
+
+    uint32_t* o = gram;
+    for (i = 1; i < n; ++i) {
+        if (gram[i] != *o) {
+            *++o = gram[i];
+        }
+    }
+    return o - gram + 1;
+}
+
+bool text_find(const char* s, size_t sz, const char* word, size_t word_sz)
+{
+    if (word_sz > sz) {
+        return 0;
+    }
+
+    const char*       p  = s;
+    const char* const pe = s + sz - word_sz + 1;
+    for (; p != pe; ++p) {
+        size_t i = 0;
+        for (; i < word_sz && fold(p[i]) == fold(word[i]); ++i) {  }
+        if (i == word_sz) {
+            return 1;
+        }
+    }
+    return 0;
+}
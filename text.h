@@ -0,0 +1,19 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// substring search over free text, ASCII letters match regardless of case.
+// A trigram is three folded bytes in the low 24 bits of a uint32_t, the
+// first one highest, so trigrams order like the bytes they stand for
+
+// writes the distinct trigrams of the sz bytes of s to gram, sorted. gram
+// needs room for sz - 2 of them, returns how many there are
+uint32_t text_grams(const char* s, size_t sz, uint32_t* gram);
+
+// the sz bytes of s contain the word_sz bytes of word
+bool text_find(const char* s, size_t sz, const char* word, size_t word_sz);
+
+#endif
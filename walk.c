@@ -0,0 +1,370 @@
+#include "walk.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define WALK_DENTS   (64 * 1024)
+#define WALK_MAX_JOB 256
+
+// record of getdents64
+typedef struct dent_t dent_t;
+struct dent_t {
+    uint64_t       ino;
+    int64_t        off;
+    unsigned short reclen;
+    unsigned char  type;
+    char           name[];
+};
+
+// directories are relative to the root, "" is the root itself
+typedef struct pool_t pool_t;
+struct pool_t {
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;
+    char**           dir;
+    uint64_t         dir_sz;
+    uint64_t         dir_cap;
+    uint32_t         busy;   // threads reading a directory, they may push more
+    int              error;  // ENOMEM, everybody stops
+    int              root;
+    const char*      root_path;
+    size_t           root_sz;    // root_path without trailing slashes
+    walk_error_fn_t* on_error;
+    void*            ctx;
+};
+
+// files found by one thread, NUL terminated relative paths back to back
+typedef struct worker_t worker_t;
+struct worker_t {
+    pool_t*  pool;
+    char*    dents;
+    char*    buf;
+    uint64_t buf_sz;
+    uint64_t buf_cap;
+    uint64_t path_sz;
+};
+
+static void fail(pool_t* p, int err)
+{
+    pthread_mutex_lock(&p->lock);
+    p->error = err;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void report(pool_t* p, const char* rel, int err)
+{
+    if (!p->on_error) {
+        return;
+    }
+
+    size_t r    = p->root_sz;
+    char*  path = malloc(r + strlen(rel) + 2);
+    if (!path) {
+        fail(p, ENOMEM);
+        return;
+    }
+    memcpy(path, p->root_path, r);
+    path[r] = 0;
+    if (*rel) {
+        r -= p->root_path[r - 1] == '/';
+        path[r] = '/';
+        strcpy(path + r + 1, rel);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->on_error(p->ctx, path, err);
+    pthread_mutex_unlock(&p->lock);
+    free(path);
+}
+
+// rel + '/' + name, name alone below the root
+static char* join(const char* rel, const char* name)
+{
+    size_t r = strlen(rel);
+    size_t n = strlen(name);
+    char*  s = malloc(r + n + 2);
+    if (!s) {
+        return NULL;
+    }
+    memcpy(s, rel, r);
+    s[r] = '/';
+    memcpy(s + r + !!r, name, n + 1);
+    return s;
+}
+
+static int push_dir(pool_t* p, char* rel)
+{
+    pthread_mutex_lock(&p->lock);
+    if (p->dir_sz == p->dir_cap) {
+        uint64_t cap = p->dir_cap ? p->dir_cap * 2 : 64;
+        char**   n   = realloc(p->dir, cap * sizeof(*n));
+        if (!n) {
+            pthread_mutex_unlock(&p->lock);
+            return -1;
+        }
+        p->dir     = n;
+        p->dir_cap = cap;
+    }
+    p->dir[p->dir_sz++] = rel;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+static int push_file(worker_t* w, const char* rel, const char* name)
+{
+    size_t r  = strlen(rel);
+    size_t n  = strlen(name);
+    size_t sz = r + !!r + n + 1;
+    if (w->buf_sz + sz > w->buf_cap) {
+        uint64_t cap = w->buf_cap ? w->buf_cap * 2 : 64 * 1024;
+        for (; cap < w->buf_sz + sz; cap *= 2) {  }
+        char* b = realloc(w->buf, cap);
+        if (!b) {
+            return -1;
+        }
+        w->buf     = b;
+        w->buf_cap = cap;
+    }
+    char* s = w->buf + w->buf_sz;
+    memcpy(s, rel, r);
+    s[r] = '/';
+    memcpy(s + r + !!r, name, n + 1);
+    w->buf_sz  += sz;
+    w->path_sz += 1;
+    return 0;
+}
+
+// lists one directory, files go to w and subdirectories onto the stack
+static int read_dir(worker_t* w, const char* rel)
+{
+    pool_t* p  = w->pool;
+    int     fd = openat(p->root, *rel ? rel : ".", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        report(p, rel, errno);
+        return 0;
+    }
+
+    long n = 0;
+    while ((n = syscall(SYS_getdents64, fd, w->dents, WALK_DENTS)) > 0) {
+        long o = 0;
+        while (o < n) {
+            dent_t* d = (dent_t*)(w->dents + o);
+            o += d->reclen;
+            if (d->name[0] == '.' && (!d->name[1] || (d->name[1] == '.' && !d->name[2]))) {
+                continue;
+            }
+
+            // some file systems do not fill in the type
+            unsigned char type = d->type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, d->name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+                    continue;
+                }
+                type = S_ISDIR(st.st_mode) ? DT_DIR
+                     : S_ISREG(st.st_mode) ? DT_REG
+                     : S_ISLNK(st.st_mode) ? DT_LNK
+                     : DT_UNKNOWN;
+            }
+
+            if (type == DT_DIR) {
+                char* s = join(rel, d->name);
+                if (!s || push_dir(p, s) < 0) {
+                    free(s);
+                    close(fd);
+                    return -1;
+                }
+            } else if ((type == DT_REG || type == DT_LNK) && push_file(w, rel, d->name) < 0) {
+                close(fd);
+                return -1;
+            }
+        }
+    }
+    if (n < 0) {
+        report(p, rel, errno);
+    }
+
+    close(fd);
+    return 0;
+}
+
+// takes directories until the stack is empty and nobody is reading one
+static void* work(void* arg)
+{
+    worker_t* w = arg;
+    pool_t*   p = w->pool;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->dir_sz && p->busy && !p->error) {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        if (!p->dir_sz || p->error) {
+            break;
+        }
+        char* rel = p->dir[--p->dir_sz];
+        p->busy  += 1;
+        pthread_mutex_unlock(&p->lock);
+
+        int e = read_dir(w, rel);
+        free(rel);
+
+        pthread_mutex_lock(&p->lock);
+        p->busy -= 1;
+        if (e < 0) {
+            p->error = ENOMEM;
+        }
+        if ((!p->busy && !p->dir_sz) || p->error) {
+            pthread_cond_broadcast(&p->cond);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return w;
+}
+
+static int cmp_str(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// prefixes the relative paths of all workers with the root into w
+static int collect(walk_t* w, worker_t* k, uint32_t jobs, const char* root, size_t root_sz)
+{
+    uint64_t n  = 0;
+    uint64_t sz = 0;
+    uint32_t i  = 0;
+    for (; i < jobs; ++i) {
+        n  += k[i].path_sz;
+        sz += k[i].buf_sz + k[i].path_sz * (root_sz + 1);
+    }
+
+    w->path = malloc((n + 1) * sizeof(*w->path));
+    w->buf  = malloc(sz + 1);
+    if (!w->path || !w->buf) {
+        return -1;
+    }
+
+    char* b = w->buf;
+    for (i = 0; i < jobs; ++i) {
+        char*       s  = k[i].buf;
+        char* const se = s + k[i].buf_sz;
+        while (k[i].buf_sz && s != se) {
+            size_t l = strlen(s) + 1;
+            w->path[w->path_sz++] = b;
+            memcpy(b, root, root_sz);
+            b[root_sz] = '/';
+            memcpy(b + w->root_sz, s, l);
+            b += w->root_sz + l;
+            s += l;
+        }
+    }
+
+    qsort(w->path, w->path_sz, sizeof(*w->path), cmp_str);
+    return 0;
+}
+
+int walk_tree(walk_t* w, const char* root, uint32_t jobs, walk_error_fn_t* on_error, void* ctx)
+{
+    worker_t  k[WALK_MAX_JOB];
+    pthread_t t[WALK_MAX_JOB];
+    bool      started[WALK_MAX_JOB];
+    int       err = 0;
+
+    memset(w, 0, sizeof(*w));
+    jobs = jobs < 1 ? 1 : jobs > WALK_MAX_JOB ? WALK_MAX_JOB : jobs;
+
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    // "/" stays, otherwise the path below starts after a single '/'
+    size_t root_sz = strlen(root);
+    for (; root_sz > 1 && root[root_sz - 1] == '/'; --root_sz) {  }
+    w->root_sz = root_sz + (root[root_sz - 1] != '/');
+
+    pool_t p = {
+        .lock      = PTHREAD_MUTEX_INITIALIZER,
+        .cond      = PTHREAD_COND_INITIALIZER,
+        .root      = fd,
+        .root_path = root,
+        .root_sz   = root_sz,
+        .on_error  = on_error,
+        .ctx       = ctx,
+    };
+    char* top = strdup("");
+    if (!top || push_dir(&p, top) < 0) {
+        free(top);
+        close(p.root);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    uint32_t i = 0;
+    for (; i < jobs; ++i) {
+        k[i] = (worker_t){ .pool = &p, .dents = malloc(WALK_DENTS) };
+        if (!k[i].dents) {
+            jobs = i;
+            break;
+        }
+    }
+    if (!jobs) {
+        err = ENOMEM;
+        goto done;
+    }
+
+    // the first worker is us, one that cannot be started just is not there
+    for (i = 1; i < jobs; ++i) {
+        started[i] = pthread_create(&t[i], NULL, work, &k[i]) == 0;
+    }
+    work(&k[0]);
+    for (i = 1; i < jobs; ++i) {
+        if (started[i]) {
+            pthread_join(t[i], NULL);
+        }
+    }
+
+    err = p.error;
+    if (!err && collect(w, k, jobs, root, root_sz) < 0) {
+        err = ENOMEM;
+    }
+
+done:
+    for (i = 0; i < jobs; ++i) {
+        free(k[i].dents);
+        free(k[i].buf);
+    }
+    for (; p.dir_sz; --p.dir_sz) {
+        free(p.dir[p.dir_sz - 1]);
+    }
+    free(p.dir);
+    close(p.root);
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.cond);
+
+    if (err) {
+        walk_free(w);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+void walk_free(walk_t* w)
+{
+    free(w->path);
+    free(w->buf);
+    w->path    = NULL;
+    w->path_sz = 0;
+    w->buf     = NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <stdint.h>
+
+// collects the paths of the regular files and symlinks below a directory.
+// A pool of threads takes directories off a shared stack and reads them with
+// getdents64 relative to the root, the entry type comes with the listing so
+// files are not stat'ed. Symlinks to directories are not followed
+//
+// every path is the root, a '/' and the path below it. The root is used as
+// given, without trailing slashes
+
+// called for every directory that cannot be read, never by two threads at
+// once
+typedef void walk_error_fn_t(void* ctx, const char* path, int err);
+
+typedef struct walk_t walk_t;
+struct walk_t {
+    char**   path;     // sorted
+    uint64_t path_sz;
+    uint32_t root_sz;  // length of the root and its '/' in every path
+    char*    buf;      // holds the paths
+};
+
+// walks root with up to jobs threads. Returns 0 on success and -1 with errno
+// set if root cannot be opened or memory runs out, w is empty then
+int walk_tree(walk_t* w, const char* root, uint32_t jobs, walk_error_fn_t* on_error, void* ctx);
+
+void walk_free(walk_t* w);
+
+#endif